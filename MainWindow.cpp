@@ -3,10 +3,15 @@
 #include <QString>
 #include <QVBoxLayout>
 #include <QFileDialog>
+#include <QDateTime>
+#include <QDir>
 
 #include "MainWindow.h"
+#include "rendering/TextureRegistry.h"
+#include "rendering/GpuProfiler.h"
+#include "utility/CpuProfiler.h"
 
-MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
+MainWindow::MainWindow(const FramePacer& frame_pacer, QWidget *parent) : QMainWindow(parent), frame_pacer(frame_pacer) {
   // Set up the window
   setWindowTitle("QtGL");
   resize(800, 600);
@@ -33,15 +38,12 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 
   create_pause_menu();
 
-  // Set up mainloop
-  timer = new QTimer(this);
-  connect(timer, &QTimer::timeout, this, &MainWindow::mainLoop);
-  timer->start(16);
-  previous_frame_times = {16,16,16,16,16,16,16};
-  current_pft_index = 0;
-  frame_time.start();
-
-  GLWindow->settings->set_update_timer(timer);
+  // Set up mainloop: every presented frame starts the next one, so the loop runs at the display's (or the pacer's) rate
+  delta_time = 0.0f;
+  connect(GLWindow, &QOpenGLWidget::frameSwapped, this, &MainWindow::mainLoop);
+  qDebug() << "Frame pacing:" << frame_pacer.mode_name();
+  input_capture.start(QCoreApplication::arguments());
+  GLWindow->set_replaying(input_capture.get_mode() == InputCapture::REPLAY);
 
   // Show the main window (also shows child widget: GLWindow)
   show();
@@ -136,17 +138,25 @@ void MainWindow::resume() {
 }
 
 void MainWindow::mainLoop() {
-  delta_time = frame_time.elapsed();
-  frame_time.start();
+  PROFILE_ZONE("MainWindow::mainLoop");
+  delta_time = frame_pacer.begin_frame() / 1e6f;
 
-  if (!status_box->isHidden()) {
-    previous_frame_times[++current_pft_index] = delta_time;
-    if (current_pft_index>=previous_frame_times.size()) current_pft_index = 0;
-    double fps = 0.0;
-    for (auto i : previous_frame_times) fps += i;
-    fps = previous_frame_times.size()/fps*1000.0;
+  if (++frames_since_report >= FramePacer::HISTORY) {
+    qDebug().noquote() << "Frame times" << frame_pacer.report();
+    frames_since_report = 0;
+  }
 
-    fps_label->setText(QString("Frame time:")+QString::number(delta_time)+QString("\nFPS:")+QString::number(fps)+QString("\nFOV:")+QString::number((int)GLWindow->fov));
+  if (!status_box->isHidden()) {
+    FramePacer::Statistics frame_statistics = frame_pacer.statistics();
+    double fps = frame_statistics.mean_ms > 0.0 ? 1000.0/frame_statistics.mean_ms : 0.0;
+
+    fps_label->setText(QString("Frame time:")+QString::number(delta_time, 'f', 2)+QString("\nFPS:")+QString::number(fps, 'f', 1)
+      +QString(" (")+frame_pacer.mode_name()+QString(", std dev ")+QString::number(frame_statistics.standard_deviation_ms, 'f', 2)+QString("ms)")
+      +QString("\nFOV:")+QString::number((int)GLWindow->fov)
+      +QString("\nTextures:")+QString::number(TextureRegistry::size())
+      +QString(" (CPU:")+QString::number(TextureRegistry::resident_cpu_bytes()/1048576.0, 'f', 1)
+      +QString("MiB GPU:")+QString::number(TextureRegistry::resident_gpu_bytes()/1048576.0, 'f', 1)+QString("MiB)")
+      +QString("\n")+GpuProfiler::overlay_text());
     status_box->setGeometry(QRect(QPoint(10,10),status_box->minimumSizeHint()));
   }
 
@@ -157,6 +167,13 @@ void MainWindow::mainLoop() {
   } else {
     pause_menu->setGeometry(QRect(QPoint(5,5),pause_menu->minimumSizeHint()));
   }
+
+  // Replays replace this frame's live input; a finished replay reports the frame times (comparable between runs) and quits
+  if (!input_capture.frame(delta_time, mouse_movement, keys_pressed)) {
+    qDebug().noquote() << "Replayed" << input_capture.get_frame_count() << "frames. Frame times" << frame_pacer.report();
+    QApplication::quit();
+    return;
+  }
   GLWindow->update_scene();
   mouse_movement = QPoint(0,0);
 }
@@ -250,6 +267,34 @@ void MainWindow::keyPressEvent(QKeyEvent *event) {
       QColor col = GLWindow->grabFramebuffer().pixelColor(QCursor::pos()-screen_top_left);
       qDebug() << col.red() << col.green() << col.blue();
       break;}
+    case Qt::Key_F5:{
+      if (!paused)
+        pause();
+
+      QFileDialog dialog(this);
+      dialog.setWindowTitle("Save GPU Pass Times");
+      dialog.setFileMode(QFileDialog::AnyFile);
+      dialog.setAcceptMode(QFileDialog::AcceptSave);
+      dialog.setNameFilter(tr("CSV (*.csv)"));
+      if (dialog.exec()) {
+        QStringList fileNames(dialog.selectedFiles());
+        if (!GpuProfiler::export_csv(fileNames.at(0))) {
+          qDebug() << "Save error: could not write" << fileNames.at(0);
+        }
+      }
+      break;}
+    case Qt::Key_F6:{
+      if (!CpuProfiler::enabled()) {
+        qDebug() << "The CPU profiler is compiled out of release builds";
+        break;
+      }
+      QDir().mkpath("traces");
+      QString path = QString("traces/trace_")+QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss")+QString(".json");
+      if (CpuProfiler::export_chrome_trace(path))
+        qDebug() << "Saved the last" << CpuProfiler::DUMP_SECONDS << "seconds of CPU zones to" << path;
+      else
+        qDebug() << "Save error: could not write" << path;
+      break;}
     default:
       keys_pressed.insert(event->key());
       break;
@@ -1,7 +1,6 @@
 #include <QApplication>
 #include <QMainWindow>
 #include <QElapsedTimer>
-#include <QTimer>
 #include <QKeyEvent>
 #include <QEvent>
 #include <QGroupBox>
@@ -14,12 +13,14 @@
 #include <vector>
 
 #include "OpenGLWindow.h"
+#include "utility/FramePacer.h"
+#include "utility/InputCapture.h"
 
 class MainWindow : public QMainWindow {
   Q_OBJECT
 
 public:
-  MainWindow(QWidget *parent=nullptr);
+  MainWindow(const FramePacer& frame_pacer=FramePacer(), QWidget *parent=nullptr);
   ~MainWindow();
   void create_pause_menu();
 
@@ -44,11 +45,10 @@ protected:
   QToolButton* settings_button;
   QToolButton* movement_button;
 
-  int delta_time;
-  QElapsedTimer frame_time;
-  std::vector<int> previous_frame_times;
-  unsigned int current_pft_index;
-  QTimer *timer;
+  float delta_time; // ms, with sub-millisecond precision
+  FramePacer frame_pacer; // mainLoop runs once per presented frame (QOpenGLWidget::frameSwapped)
+  unsigned int frames_since_report = 0;
+  InputCapture input_capture; // Records or replays delta_time, mouse_movement and keys_pressed (see InputCapture)
 
   QPoint previous_mouse_position; // Set to NULL if the mouse is not pressed
   QPoint mouse_down_position; // Relative position where the left mouse button is first pressed (set to NULL when mouse button is released)
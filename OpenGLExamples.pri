@@ -0,0 +1,27 @@
+# Everything but the entry points, shared by the app (OpenGLExamples.pro) and the offscreen benchmark (benchmark/Benchmark.pro)
+
+QT += core gui widgets concurrent
+
+INCLUDEPATH += $$PWD
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+HEADERS += $$PWD/OpenGLWindow.h $$PWD/Simulation.h \
+					 $$PWD/rendering/Scene.h $$PWD/rendering/Shader.h $$PWD/rendering/Camera.h $$PWD/rendering/TextureRegistry.h $$PWD/rendering/TextureCache.h $$PWD/rendering/MaterialBuffer.h $$PWD/rendering/BonePalette.h $$PWD/rendering/GpuProfiler.h \
+					 $$PWD/rendering/post_processing/GaussianBlur.h \
+					 $$PWD/utility/Settings.h $$PWD/utility/Utility.h $$PWD/utility/AnimationBenchmark.h $$PWD/utility/FramePacer.h $$PWD/utility/CpuProfiler.h $$PWD/utility/InputCapture.h \
+					 $$PWD/entities/nodes/Node.h $$PWD/entities/nodes/RootNode.h $$PWD/entities/nodes/NodeAnimation.h $$PWD/entities/nodes/Model.h $$PWD/entities/nodes/ModelData.h $$PWD/entities/nodes/ModelCache.h $$PWD/entities/nodes/Crowd.h $$PWD/entities/nodes/LocalPose.h $$PWD/entities/nodes/ClipCompression.h \
+					 $$PWD/entities/lights/Light.h $$PWD/entities/lights/DirectionalLight.h $$PWD/entities/lights/PointLight.h \
+					 $$PWD/entities/meshes/Mesh.h $$PWD/entities/meshes/DynamicMesh.h $$PWD/entities/meshes/Material.h $$PWD/entities/meshes/MeshOptimizer.h \
+					 $$PWD/entities/meshes/shapes/Tesseract.h
+
+SOURCES += $$PWD/OpenGLWindow.cpp $$PWD/Simulation.cpp \
+           $$PWD/rendering/Scene.cpp $$PWD/rendering/Shader.cpp $$PWD/rendering/Camera.cpp $$PWD/rendering/TextureRegistry.cpp $$PWD/rendering/TextureCache.cpp $$PWD/rendering/MaterialBuffer.cpp $$PWD/rendering/BonePalette.cpp $$PWD/rendering/GpuProfiler.cpp \
+					 $$PWD/rendering/post_processing/GaussianBlur.cpp $$PWD/rendering/post_processing/helpful_framebuffer_functions.cpp \
+					 $$PWD/utility/Settings.cpp $$PWD/utility/Utility.cpp $$PWD/utility/AnimationBenchmark.cpp $$PWD/utility/FramePacer.cpp $$PWD/utility/CpuProfiler.cpp $$PWD/utility/InputCapture.cpp \
+					 $$PWD/entities/nodes/Node.cpp $$PWD/entities/nodes/RootNode.cpp $$PWD/entities/nodes/NodeAnimation.cpp $$PWD/entities/nodes/Model.cpp $$PWD/entities/nodes/ModelCache.cpp $$PWD/entities/nodes/Crowd.cpp $$PWD/entities/nodes/LocalPose.cpp $$PWD/entities/nodes/ClipCompression.cpp \
+					 $$PWD/entities/lights/Light.cpp $$PWD/entities/lights/DirectionalLight.cpp $$PWD/entities/lights/PointLight.cpp \
+					 $$PWD/entities/meshes/Mesh.cpp $$PWD/entities/meshes/DynamicMesh.cpp $$PWD/entities/meshes/Material.cpp $$PWD/entities/meshes/MeshOptimizer.cpp \
+					 $$PWD/entities/meshes/shapes/Tesseract.cpp $$PWD/entities/meshes/shapes/rotations_4d.cpp \
+
+LIBS += -lassimp
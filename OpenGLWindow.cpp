@@ -1,7 +1,10 @@
 #include <string>
 #include <vector>
+#include <cmath>
+#include <algorithm>
 
 #include <QDebug>
+#include <QCoreApplication>
 #include <QString>
 #include <QFile>
 #include <QImage>
@@ -10,6 +13,8 @@
 #include <QOpenGLDebugLogger>
 
 #include "OpenGLWindow.h"
+#include "utility/AnimationBenchmark.h"
+#include "utility/CpuProfiler.h"
 
 #include "rendering/post_processing/helpful_framebuffer_functions.cpp"
 
@@ -18,13 +23,14 @@ OpenGLWindow::OpenGLWindow(QWidget *parent) : QOpenGLWidget(parent) {
   fov = 45.0f;
 }
 
-void OpenGLWindow::set_inputs(const std::unordered_set<int>* keys_pressed, const QPoint* mouse_movement, const int* delta_time) {
+void OpenGLWindow::set_inputs(const std::unordered_set<int>* keys_pressed, const QPoint* mouse_movement, const float* delta_time) {
   this->keys_pressed = keys_pressed;
   this->delta_time = delta_time;
   this->mouse_movement = mouse_movement;
 }
 
 OpenGLWindow::~OpenGLWindow() {
+  delete simulation; // Stops the thread before the scene goes away
   delete scene;
 
   delete framebuffer_quad;
@@ -39,6 +45,8 @@ OpenGLWindow::~OpenGLWindow() {
   delete scene_shader;
   delete post_processing_shader;
   delete antialiasing_shader;
+  Mesh::skinning_shader = nullptr;
+  delete skinning_shader;
 }
 
 void OpenGLWindow::initializeGL() {
@@ -69,6 +77,11 @@ void OpenGLWindow::initializeGL() {
 
   qDebug() << "GL Version:" << QString((const char*)glGetString(GL_VERSION));
 
+  // Models are read and decoded on the thread pool while the rest of the scene is set up
+  TextureCache::initialize();
+  GpuProfiler::initialize();
+  QFuture<ModelImport> bird_import = Model::start_import("assets/models/bird/bird_complex.fbx");
+
   settings->setWindowFlags(Qt::Window);
   settings->setWindowTitle(tr("Settings"));
 
@@ -131,7 +144,7 @@ void OpenGLWindow::initializeGL() {
   // Model* nanosuit = new Model("models/material_test/sphere.fbx");
   // Model* nanosuit = new Model("models/lightray_test/wall2.fbx");
   // Model* nanosuit = new Model("models/bone_test/bone_test.fbx", "bone_test");
-  Model* nanosuit = new Model("assets/models/bird/bird_complex.fbx", "bird");
+  Model* nanosuit = new Model(bird_import, "bird");
   nanosuit->set_scale(glm::vec3(0.3f));
   nanosuit->set_rotation(glm::vec3(180.0f,270.0f,0.0f));
   nanosuit->set_position(glm::vec3(0.0f,2.5f,-1.5f));
@@ -141,6 +154,31 @@ void OpenGLWindow::initializeGL() {
   nanosuit->set_current_animation("Armature|ArmatureAction");
   nanosuit->start_animation();
 
+  if (QCoreApplication::arguments().contains("--animation-benchmark")) {
+    AnimationBenchmark::run(bird_import, "Armature|ArmatureAction");
+    AnimationBenchmark::run_blend(bird_import, "Armature|ArmatureAction", "Armature|CubeAction");
+  }
+
+  int crowd_argument = QCoreApplication::arguments().indexOf("--crowd");
+  if (crowd_argument >= 0 && crowd_argument+1 < QCoreApplication::arguments().size()) {
+    // A grid of birds flapping out of step; however many there are, it's one draw call per mesh and pass
+    int crowd_size = QCoreApplication::arguments()[crowd_argument+1].toInt();
+    std::shared_ptr<Crowd> crowd = std::make_shared<Crowd>(std::make_shared<Model>(bird_import, "crowd bird"));
+    unsigned int flying = crowd->animation_index("Armature|ArmatureAction");
+    int row_length = std::max(1, int(std::ceil(std::sqrt(float(crowd_size)))));
+
+    std::vector<Crowd::Instance> instances(crowd_size);
+    for (int i=0; i<crowd_size; i++) {
+      glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3((i%row_length - row_length/2)*2.0f, 6.0f, (i/row_length)*2.0f - 10.0f));
+      instances[i].model = glm::scale(glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f,1.0f,0.0f)), glm::vec3(0.3f));
+      instances[i].animation = flying;
+      instances[i].time_offset = (i*7919 % 1000) / 1000.0f;
+      instances[i].speed = 0.8f + (i*104729 % 400) / 1000.0f;
+    }
+    crowd->set_instances(instances);
+    scene->add_crowd(crowd);
+  }
+
   std::shared_ptr<Mesh> cube = std::make_shared<Mesh>();
   cube->name = "default cube";
   cube->initialize_cube();
@@ -268,6 +306,12 @@ void OpenGLWindow::initializeGL() {
   scene->add_node(std::shared_ptr<RootNode>(floor));
   settings->set_node(floor);
 
+  if (!replaying && !QCoreApplication::arguments().contains("--no-simulation-thread")) {
+    simulation = new Simulation(scene, 1.0/60.0, this);
+    simulation->start();
+  }
+  scene_clock.start();
+
   framebuffer_quad = new Mesh();
   framebuffer_quad->initialize_plane(false);
 
@@ -290,6 +334,8 @@ void OpenGLWindow::initializeGL() {
 }
 
 void OpenGLWindow::load_shaders() {
+  MaterialBuffer::initialize();
+
   depth_shaders.dirlight.opaque = new Shader();
   depth_shaders.dirlight.full_transparency = new Shader();
   depth_shaders.dirlight.partial_transparency = new Shader();
@@ -313,8 +359,12 @@ void OpenGLWindow::load_shaders() {
   depth_shaders.dirlight.full_transparency->loadShaders("shaders/dirlight_shaders/dirlight_depth.vs", "shaders/dirlight_shaders/dirlight_depth_full_transparency.fs");
   depth_shaders.dirlight.partial_transparency->loadShaders("shaders/dirlight_shaders/dirlight_depth.vs", "shaders/dirlight_shaders/dirlight_depth_partial_transparency.fs");
 
-  depth_shaders.dirlight.full_transparency->initialize_placeholder_textures(Image_Type::OPACITY_MAP);
-  depth_shaders.dirlight.partial_transparency->initialize_placeholder_textures(Image_Type::OPACITY_MAP);
+  MaterialBuffer::initialize_shader(depth_shaders.dirlight.full_transparency);
+  MaterialBuffer::initialize_shader(depth_shaders.dirlight.partial_transparency);
+
+  Crowd::initialize_shader(depth_shaders.dirlight.opaque);
+  Crowd::initialize_shader(depth_shaders.dirlight.full_transparency);
+  Crowd::initialize_shader(depth_shaders.dirlight.partial_transparency);
 
   depth_shaders.dirlight.validate_shader_programs();
 
@@ -322,8 +372,12 @@ void OpenGLWindow::load_shaders() {
   depth_shaders.pointlight.full_transparency->loadShaders("shaders/pointlight_shaders/pointlight_depth.vs", "shaders/pointlight_shaders/pointlight_depth_full_transparency.fs", "shaders/pointlight_shaders/pointlight_depth.gs");
   depth_shaders.pointlight.partial_transparency->loadShaders("shaders/pointlight_shaders/pointlight_depth.vs", "shaders/pointlight_shaders/pointlight_depth_partial_transparency.fs", "shaders/pointlight_shaders/pointlight_depth.gs");
 
-  depth_shaders.pointlight.full_transparency->initialize_placeholder_textures(Image_Type::OPACITY_MAP);
-  depth_shaders.pointlight.partial_transparency->initialize_placeholder_textures(Image_Type::OPACITY_MAP);
+  MaterialBuffer::initialize_shader(depth_shaders.pointlight.full_transparency);
+  MaterialBuffer::initialize_shader(depth_shaders.pointlight.partial_transparency);
+
+  Crowd::initialize_shader(depth_shaders.pointlight.opaque);
+  Crowd::initialize_shader(depth_shaders.pointlight.full_transparency);
+  Crowd::initialize_shader(depth_shaders.pointlight.partial_transparency);
 
   depth_shaders.pointlight.validate_shader_programs();
 
@@ -332,22 +386,24 @@ void OpenGLWindow::load_shaders() {
   object_shaders.full_transparency->loadShaders("shaders/object_shaders/object.vs", "shaders/object_shaders/object_full_transparency.fs");
   object_shaders.partial_transparency->loadShaders("shaders/object_shaders/object.vs", "shaders/object_shaders/object_partial_transparency.fs");
 
-  object_shaders.opaque->initialize_placeholder_textures(Image_Type::ALBEDO_MAP | Image_Type::AMBIENT_OCCLUSION_MAP | Image_Type::ROUGHNESS_MAP | Image_Type::METALNESS_MAP);
+  MaterialBuffer::initialize_shader(object_shaders.opaque);
   // object_shaders.opaque->initialize_placeholder_2D_textures(std::vector<const char*>{"dirlights[0].shadow_map"});
-  object_shaders.full_transparency->initialize_placeholder_textures(Image_Type::ALBEDO_MAP | Image_Type::AMBIENT_OCCLUSION_MAP | Image_Type::ROUGHNESS_MAP | Image_Type::METALNESS_MAP | Image_Type::OPACITY_MAP);
+  MaterialBuffer::initialize_shader(object_shaders.full_transparency);
   // object_shaders.full_transparency->initialize_placeholder_2D_textures(std::vector<const char*>{"dirlights[0].shadow_map"});
-  object_shaders.partial_transparency->initialize_placeholder_textures(Image_Type::ALBEDO_MAP | Image_Type::AMBIENT_OCCLUSION_MAP | Image_Type::ROUGHNESS_MAP | Image_Type::METALNESS_MAP | Image_Type::OPACITY_MAP);
+  MaterialBuffer::initialize_shader(object_shaders.partial_transparency);
   // object_shaders.partial_transparency->initialize_placeholder_2D_textures(std::vector<const char*>{"dirlights[0].shadow_map"});
 
+  Crowd::initialize_shader(object_shaders.opaque);
+  Crowd::initialize_shader(object_shaders.full_transparency);
+  Crowd::initialize_shader(object_shaders.partial_transparency);
+
   object_shaders.validate_shader_programs();
 
-  unsigned int armature_ubo_id;
-  glGenBuffers(1, &armature_ubo_id);
-  glBindBuffer(GL_UNIFORM_BUFFER, armature_ubo_id);
-  glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4)*10, NULL, GL_DYNAMIC_DRAW);
-  glBindBuffer(GL_UNIFORM_BUFFER, 0);
-  glBindBufferBase(GL_UNIFORM_BUFFER, 0, armature_ubo_id);
-  Shader::uniform_block_buffers["Armature"] = armature_ubo_id;
+  BonePalette::initialize();
+  skinning_shader = new Shader();
+  skinning_shader->loadComputeShader("shaders/skinning.comp");
+  skinning_shader->validate_program();
+  Mesh::skinning_shader = skinning_shader;
 
   light_shader->loadShaders("shaders/light_vertex.shader", "shaders/light_fragment.shader");
   light_shader->validate_program();
@@ -405,15 +461,20 @@ void OpenGLWindow::create_post_processing_framebuffer() {
 }
 
 void OpenGLWindow::update_scene() {
-  scene->update_scene();
+  PROFILE_ZONE("OpenGLWindow::update_scene");
+  scene_time = replaying ? scene_time + *delta_time / 1000.0 : scene_clock.elapsed() / 1000.0;
+  if (simulation == nullptr) scene->update_scene(scene_time);
+  scene->set_crowd_time(scene_time);
   tesseract->project_to_3d();
   camera.update_cam();
-  settings->update_settings();
+  settings->update_settings(*delta_time);
   update();
 }
 
 void OpenGLWindow::paintGL() {
   // Note: never call this function directly--call update() instead.
+  PROFILE_ZONE("OpenGLWindow::paintGL");
+  GpuProfiler::begin_frame();
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
   // Get QT's default framebuffer binding
@@ -422,11 +483,18 @@ void OpenGLWindow::paintGL() {
 
   glEnable(GL_DEPTH_TEST);
 
+  if (simulation != nullptr) scene->apply_snapshot(*simulation->latest_snapshot());
+  scene->set_lod_view(camera.position, fov, height());
+
   // Draw the scene to the sunlight's depth buffer to create the sunlight's depth map
+  GpuProfiler::begin(GpuProfiler::Pass::DIRLIGHT_SHADOWS);
   scene->render_dirlights_shadow_map(depth_shaders.dirlight);
+  GpuProfiler::end();
 
   // Draw the scene to the pointlight's depth buffer
+  GpuProfiler::begin(GpuProfiler::Pass::POINTLIGHT_SHADOWS);
   scene->render_pointlights_shadow_map(depth_shaders.pointlight);
+  GpuProfiler::end();
 
   // Draw the scene to our framebuffer
   //glBindFramebuffer(GL_FRAMEBUFFER, qt_framebuffer);
@@ -440,6 +508,7 @@ void OpenGLWindow::paintGL() {
 
 
   if (scene->display_type == POINTLIGHT_DEPTH) {
+    GpuProfiler::begin(GpuProfiler::Pass::SKYBOX);
     glDepthMask(GL_FALSE);
 
     // Draw the skybox
@@ -452,8 +521,10 @@ void OpenGLWindow::paintGL() {
     scene->skybox->simple_draw();
 
     glDepthMask(GL_TRUE);
+    GpuProfiler::end();
 
   } else if (scene->display_type != SUNLIGHT_DEPTH) {
+    GpuProfiler::begin(GpuProfiler::Pass::SKYBOX);
     glDepthMask(GL_FALSE);
 
     // Draw the skybox
@@ -469,34 +540,39 @@ void OpenGLWindow::paintGL() {
     light_shader->setMat4("view", view);
     scene->draw_dirlight(light_shader);
     scene->draw_light(light_shader);
+    GpuProfiler::end();
 
     // Draw the objects
-    object_shaders.setFloat("skybox_multiplier", scene->skybox_multiplier);
-    object_shaders.setVec3("camera_position", camera.position);
-    object_shaders.setMat4("view", view);
-
-    int texture_unit = 1;
-    object_shaders.opaque->use();
-    texture_unit = scene->set_skybox_settings("skybox", object_shaders.opaque, texture_unit);
-    texture_unit = scene->set_dirlight_settings("dirlights", object_shaders.opaque, texture_unit);
-    texture_unit = scene->set_light_settings("lights", object_shaders.opaque, texture_unit);
-
-    texture_unit = 1;
-    object_shaders.full_transparency->use();
-    texture_unit = scene->set_skybox_settings("skybox", object_shaders.full_transparency, texture_unit);
-    texture_unit = scene->set_dirlight_settings("dirlights", object_shaders.full_transparency, texture_unit);
-    texture_unit = scene->set_light_settings("lights", object_shaders.full_transparency, texture_unit);
-
-    texture_unit = 1;
-    object_shaders.partial_transparency->use();
-    texture_unit = scene->set_skybox_settings("skybox", object_shaders.partial_transparency, texture_unit);
-    texture_unit = scene->set_dirlight_settings("dirlights", object_shaders.partial_transparency, texture_unit);
-    texture_unit = scene->set_light_settings("lights", object_shaders.partial_transparency, texture_unit);
-
-    scene->draw_objects(object_shaders, Shader::DrawType::COLOR, texture_unit, camera.position);
+    {
+      PROFILE_ZONE("Upload object uniforms");
+      object_shaders.setFloat("skybox_multiplier", scene->skybox_multiplier);
+      object_shaders.setVec3("camera_position", camera.position);
+      object_shaders.setMat4("view", view);
+
+      int texture_unit = 1;
+      object_shaders.opaque->use();
+      texture_unit = scene->set_skybox_settings("skybox", object_shaders.opaque, texture_unit);
+      texture_unit = scene->set_dirlight_settings("dirlights", object_shaders.opaque, texture_unit);
+      texture_unit = scene->set_light_settings("lights", object_shaders.opaque, texture_unit);
+
+      texture_unit = 1;
+      object_shaders.full_transparency->use();
+      texture_unit = scene->set_skybox_settings("skybox", object_shaders.full_transparency, texture_unit);
+      texture_unit = scene->set_dirlight_settings("dirlights", object_shaders.full_transparency, texture_unit);
+      texture_unit = scene->set_light_settings("lights", object_shaders.full_transparency, texture_unit);
+
+      texture_unit = 1;
+      object_shaders.partial_transparency->use();
+      texture_unit = scene->set_skybox_settings("skybox", object_shaders.partial_transparency, texture_unit);
+      texture_unit = scene->set_dirlight_settings("dirlights", object_shaders.partial_transparency, texture_unit);
+      texture_unit = scene->set_light_settings("lights", object_shaders.partial_transparency, texture_unit);
+    }
+
+    scene->draw_objects(object_shaders, Shader::DrawType::COLOR, camera.position);
   }
 
   // Combine the scene into the scene framebuffer (so post-processing can be done on the entire scene)
+  GpuProfiler::begin(GpuProfiler::Pass::COMPOSITE);
   glDisable(GL_DEPTH_TEST);
   glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
   glClear(GL_COLOR_BUFFER_BIT);
@@ -553,9 +629,13 @@ void OpenGLWindow::paintGL() {
   }
 
   framebuffer_quad->simple_draw();
+  GpuProfiler::end();
 
+  GpuProfiler::begin(GpuProfiler::Pass::BLUR);
   unsigned int blurred = gaussian_blur.apply_blur(scene_colorbuffers[1], 4, width(), height());
+  GpuProfiler::end();
 
+  GpuProfiler::begin(GpuProfiler::Pass::POST_PROCESSING);
   glViewport(0, 0, width(), height());
   glBindFramebuffer(GL_FRAMEBUFFER, scene->antialiasing==FXAA ? post_processing_framebuffer : qt_framebuffer);
   glClear(GL_COLOR_BUFFER_BIT);
@@ -610,8 +690,10 @@ void OpenGLWindow::paintGL() {
   }
 
   framebuffer_quad->simple_draw();
+  GpuProfiler::end();
 
   if (scene->antialiasing == FXAA) {
+    GpuProfiler::begin(GpuProfiler::Pass::FXAA);
     glBindFramebuffer(GL_FRAMEBUFFER, qt_framebuffer);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
@@ -621,6 +703,7 @@ void OpenGLWindow::paintGL() {
     antialiasing_shader->setInt("screen_texture", 0);
 
     framebuffer_quad->simple_draw();
+    GpuProfiler::end();
   }
 
   glBindTexture(GL_TEXTURE_2D, 0);
@@ -4,6 +4,7 @@
 #include <QOpenGLFunctions_4_5_Core>
 #include <QOpenGLWidget>
 #include <QWheelEvent>
+#include <QElapsedTimer>
 
 #include <unordered_set>
 
@@ -14,6 +15,7 @@
 #include "rendering/Shader.h"
 #include "rendering/Camera.h"
 #include "rendering/Scene.h"
+#include "rendering/GpuProfiler.h"
 #include "rendering/post_processing/GaussianBlur.h"
 #include "entities/nodes/Node.h"
 #include "entities/nodes/Model.h"
@@ -21,15 +23,20 @@
 #include "entities/meshes/Mesh.h"
 #include "entities/meshes/shapes/Tesseract.h"
 #include "utility/Settings.h"
+#include "Simulation.h"
 
 class OpenGLWindow : public QOpenGLWidget, protected QOpenGLFunctions_4_5_Core {
   Q_OBJECT
+  friend class RenderBenchmark; // Drives initializeGL/resizeGL/paintGL on its own offscreen context
 
 public:
   OpenGLWindow(QWidget* parent=nullptr);
   ~OpenGLWindow();
 
-  void set_inputs(const std::unordered_set<int>* keys_pressed, const QPoint* mouse_movement, const int* delta_time);
+  void set_inputs(const std::unordered_set<int>* keys_pressed, const QPoint* mouse_movement, const float* delta_time);
+  // Poses the scene on the render thread (as with --no-simulation-thread) and advances the animations and crowds by
+  // delta_time instead of the wall clock, so every replay of a recording shows identical frames. Call before showing the window
+  void set_replaying(bool replaying) {this->replaying = replaying;}
   void update_scene();
 
   void update_perspective_matrix();
@@ -38,6 +45,10 @@ public:
 
   Settings *settings = nullptr;
   Scene *scene = nullptr;
+  Simulation *simulation = nullptr; // Null with --no-simulation-thread, in which case the scene is posed in update_scene
+  QElapsedTimer scene_clock; // Wall clock for the crowds, and for the nodes without the simulation thread
+  bool replaying = false;
+  double scene_time = 0.0; // Seconds; what update_scene poses the nodes and draws the crowds at
 
   float fov;
 
@@ -81,10 +92,11 @@ protected:
 
   Shader *post_processing_shader = nullptr;
   Shader *antialiasing_shader = nullptr;
+  Shader *skinning_shader = nullptr;
 
   const std::unordered_set<int>* keys_pressed = nullptr;
   const QPoint* mouse_movement = nullptr;
-  const int* delta_time = nullptr;
+  const float* delta_time = nullptr;
 };
 
 #endif
@@ -0,0 +1,71 @@
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include "Simulation.h"
+#include "rendering/Scene.h"
+
+Simulation::Simulation(Scene* scene, double step, QObject* parent) : QThread(parent), scene(scene), step(step), running(false) {
+  buffers[0] = std::make_shared<FrameSnapshot>();
+  buffers[1] = std::make_shared<FrameSnapshot>();
+  latest = buffers[1];
+  setObjectName("Simulation");
+}
+
+Simulation::~Simulation() {
+  stop();
+}
+
+void Simulation::stop() {
+  running = false;
+  wait();
+}
+
+std::shared_ptr<const FrameSnapshot> Simulation::latest_snapshot() {
+  QMutexLocker lock(&snapshot_mutex);
+  return latest;
+}
+
+std::shared_ptr<FrameSnapshot> Simulation::acquire_buffer() {
+  // A buffer only referenced by this array is neither published nor held by the renderer
+  for (auto& buffer : buffers) {
+    if (buffer.use_count() == 1) return buffer;
+  }
+  // The renderer still holds the older snapshot; replace that buffer rather than wait
+  QMutexLocker lock(&snapshot_mutex);
+  std::shared_ptr<FrameSnapshot>& stale = buffers[0] == latest ? buffers[1] : buffers[0];
+  stale = std::make_shared<FrameSnapshot>();
+  return stale;
+}
+
+void Simulation::run() {
+  running = true;
+  const qint64 step_ns = qint64(step * 1e9);
+  quint64 tick = 0;
+
+  QElapsedTimer clock;
+  clock.start();
+  qint64 next_step = 0;
+
+  while (running) {
+    qint64 now = clock.nsecsElapsed();
+    if (now < next_step) {
+      QThread::usleep((next_step - now) / 1000);
+      continue;
+    }
+    // After a long stall, skip the missed steps instead of running them back to back (the animations lose that time, since
+    // they are posed at tick * step)
+    if (now - next_step > 4*step_ns) {
+      qDebug() << "Simulation fell behind by" << (now - next_step) / 1000000 << "ms";
+      next_step = now;
+    }
+    next_step += step_ns;
+
+    std::shared_ptr<FrameSnapshot> snapshot = acquire_buffer();
+    snapshot->tick = ++tick;
+    snapshot->time = tick * step;
+    scene->simulate(*snapshot);
+
+    QMutexLocker lock(&snapshot_mutex);
+    latest = snapshot;
+  }
+}
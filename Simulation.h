@@ -0,0 +1,56 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <QThread>
+#include <QMutex>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+class Scene;
+class RootNode;
+
+// What the renderer needs from one simulation step. Never changed once published
+struct FrameSnapshot {
+  quint64 tick = 0; // Starts at 1; 0 means nothing was simulated yet
+  double time = 0.0; // Simulated seconds (tick * step), the time the nodes were posed at
+  std::vector<glm::mat4> bone_palette; // Every skinned RootNode's bones (BonePalette layout)
+  std::unordered_map<const RootNode*, unsigned int> bone_offsets;
+};
+
+// Steps the scene's animations at a fixed rate on its own thread and publishes each step as a FrameSnapshot
+// The render thread draws with the latest snapshot, so posing and rendering overlap and neither waits for a slow frame of the other
+// The camera, Tesseract and Settings stay on the GUI thread: they either follow input directly or touch GL and widgets
+class Simulation : public QThread {
+  Q_OBJECT;
+
+public:
+  Simulation(Scene* scene, double step=1.0/60.0, QObject* parent=nullptr);
+  ~Simulation();
+
+  void stop(); // Finishes the current step and waits for the thread
+
+  // The most recent complete step (an empty snapshot before the first one)
+  std::shared_ptr<const FrameSnapshot> latest_snapshot();
+
+  double get_step() const {return step;}
+
+protected:
+  void run() override;
+  // A snapshot the renderer no longer holds, so it can be overwritten
+  std::shared_ptr<FrameSnapshot> acquire_buffer();
+
+  Scene* scene;
+  const double step; // Seconds
+  std::atomic<bool> running;
+
+  QMutex snapshot_mutex;
+  std::shared_ptr<FrameSnapshot> buffers[2]; // Double buffered: one is being written while the other is published
+  std::shared_ptr<const FrameSnapshot> latest;
+};
+
+#endif
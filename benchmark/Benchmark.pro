@@ -0,0 +1,11 @@
+# Headless rendering benchmark; see RenderBenchmark.h. Run it from the repository root so the shaders and assets are found
+
+TEMPLATE = app
+TARGET = RenderBenchmark
+CONFIG += release # No debug context, GL message logging or CPU profiler zones in the timings
+
+include(../OpenGLExamples.pri)
+
+HEADERS += RenderBenchmark.h
+
+SOURCES += main.cpp RenderBenchmark.cpp
@@ -0,0 +1,279 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "RenderBenchmark.h"
+
+RenderBenchmark::Options RenderBenchmark::Options::from_arguments(const QStringList& arguments) {
+  Options options;
+  for (int i=1; i+1<arguments.size(); i++) {
+    const QString& value = arguments[i+1];
+    if (arguments[i] == "--frames") {
+      options.frames = std::max(1u, value.toUInt());
+    } else if (arguments[i] == "--warmup") {
+      options.warmup_frames = value.toUInt();
+    } else if (arguments[i] == "--size") {
+      QStringList size = value.split('x');
+      if (size.size() == 2 && size[0].toInt() > 0 && size[1].toInt() > 0) {
+        options.width = size[0].toInt();
+        options.height = size[1].toInt();
+      } else {
+        qDebug() << "Ignoring bad --size" << value;
+      }
+    } else if (arguments[i] == "--camera-path") {
+      options.camera_path = value;
+    } else if (arguments[i] == "--model") {
+      options.model = value;
+    } else if (arguments[i] == "--output") {
+      options.output = value;
+    }
+  }
+  return options;
+}
+
+RenderBenchmark::RenderBenchmark(const Options& options) : options(options) {
+  surface.setFormat(QSurfaceFormat::defaultFormat());
+  surface.create();
+  context.setFormat(QSurfaceFormat::defaultFormat());
+  context.create();
+}
+
+RenderBenchmark::~RenderBenchmark() {
+  // The window's GL objects have to go while the context is still current
+  if (context.makeCurrent(&surface)) {
+    window.reset();
+    target.reset();
+    context.doneCurrent();
+  }
+}
+
+std::vector<RenderBenchmark::CameraKey> RenderBenchmark::default_path() {
+  // Around the demo scene: past the bird, over the cubes and back along the windows and grass
+  return {
+    {glm::vec3( 0.0f, 1.0f, -6.0f), glm::vec3( 0.0f, 1.0f,  2.0f)},
+    {glm::vec3( 7.0f, 2.0f,  0.0f), glm::vec3( 0.0f, 0.0f,  4.0f)},
+    {glm::vec3( 6.0f, 0.5f, 12.0f), glm::vec3( 0.0f, 0.0f,  6.0f)},
+    {glm::vec3( 0.0f, 5.0f, 20.0f), glm::vec3( 0.0f, 0.0f,  8.0f)},
+    {glm::vec3(-6.0f, 3.0f, 14.0f), glm::vec3( 0.0f,-1.0f,  5.0f)},
+    {glm::vec3(-7.0f,-1.0f,  1.0f), glm::vec3( 2.0f,-2.5f,  2.0f)}
+  };
+}
+
+bool RenderBenchmark::load_path(const QString& path, std::vector<CameraKey>& keys) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+
+  std::vector<CameraKey> loaded;
+  QTextStream in(&file);
+  while (!in.atEnd()) {
+    QString line = in.readLine().section('#', 0, 0).trimmed();
+    if (line.isEmpty()) continue;
+    QStringList values = line.simplified().split(' ');
+    if (values.size() != 6) return false;
+
+    float v[6];
+    for (int i=0; i<6; i++) {
+      bool ok;
+      v[i] = values[i].toFloat(&ok);
+      if (!ok) return false;
+    }
+    loaded.push_back({glm::vec3(v[0], v[1], v[2]), glm::vec3(v[3], v[4], v[5])});
+  }
+  if (loaded.size() < 2) return false;
+
+  keys = std::move(loaded);
+  return true;
+}
+
+RenderBenchmark::CameraKey RenderBenchmark::sample_path(const std::vector<CameraKey>& keys, float t) {
+  int count = keys.size();
+  float segment = (t - std::floor(t)) * count;
+  int i = std::min(int(segment), count-1);
+  float u = segment - i;
+
+  auto point = [&keys, count](int index) -> const CameraKey& {return keys[(index%count + count) % count];};
+  auto catmull_rom = [u](const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) {
+    return 0.5f * (2.0f*p1 + (p2-p0)*u + (2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3)*u*u + (3.0f*p1 - p0 - 3.0f*p2 + p3)*u*u*u);
+  };
+
+  const CameraKey& k0 = point(i-1);
+  const CameraKey& k1 = point(i);
+  const CameraKey& k2 = point(i+1);
+  const CameraKey& k3 = point(i+2);
+  return {catmull_rom(k0.position, k1.position, k2.position, k3.position), catmull_rom(k0.target, k1.target, k2.target, k3.target)};
+}
+
+bool RenderBenchmark::run() {
+  if (!context.isValid() || !context.makeCurrent(&surface)) {
+    qDebug() << "Could not create an offscreen" << QSurfaceFormat::defaultFormat().majorVersion() << '.' << QSurfaceFormat::defaultFormat().minorVersion() << "context";
+    return false;
+  }
+
+  std::vector<CameraKey> path = default_path();
+  if (!options.camera_path.isEmpty() && !load_path(options.camera_path, path)) {
+    qDebug() << "Could not read the camera path" << options.camera_path;
+    return false;
+  }
+
+  // paintGL draws its last pass into whichever framebuffer is bound when it starts, like QOpenGLWidget's own
+  target.reset(new QOpenGLFramebufferObject(options.width, options.height, QOpenGLFramebufferObject::CombinedDepthStencil));
+
+  window.reset(new OpenGLWindow());
+  window->resize(options.width, options.height); // Never shown; the size is only read back by paintGL
+  window->set_inputs(&keys_pressed, &mouse_movement, &delta_time);
+  window->initializeGL();
+  window->resizeGL(options.width, options.height);
+
+  if (!options.model.isEmpty()) {
+    for (auto& node : window->scene->get_nodes()) node->set_visibility(false);
+    Model* model = new Model(Model::start_import(options.model.toStdString()), "benchmark model");
+    window->scene->add_node(std::shared_ptr<RootNode>(model));
+    // Plays the first animation by name so runs are comparable
+    if (!model->get_animation().empty()) {
+      std::string first = model->get_animation().begin()->first;
+      for (auto& animation : model->get_animation()) first = std::min(first, animation.first);
+      model->set_current_animation(first);
+      model->start_animation();
+    }
+  }
+
+  QOpenGLFunctions_4_5_Core* gl_functions = context.versionFunctions<QOpenGLFunctions_4_5_Core>();
+  qDebug() << "Benchmarking" << options.frames << "frames at" << options.width << 'x' << options.height << "on"
+           << QString((const char*)gl_functions->glGetString(GL_RENDERER));
+
+  std::vector<Frame> frames;
+  frames.reserve(options.frames);
+  std::vector<GpuProfiler::Frame_Times> gpu_frames;
+  unsigned long long first_collected = GpuProfiler::frames_collected();
+  auto collect_gpu_times = [&gpu_frames, first_collected]() {
+    while (first_collected + gpu_frames.size() < GpuProfiler::frames_collected()) gpu_frames.push_back(GpuProfiler::latest());
+  };
+
+  QElapsedTimer timer;
+  unsigned int total_frames = options.warmup_frames + options.frames;
+  for (unsigned int i=0; i<total_frames; i++) {
+    float t = i < options.warmup_frames ? 0.0f : float(i - options.warmup_frames) / options.frames;
+    CameraKey key = sample_path(path, t);
+
+    Mesh::draw_statistics = Mesh::DrawStatistics();
+    timer.start();
+    window->update_scene();
+    window->camera.look_at(key.position, key.target);
+    target->bind();
+    window->paintGL();
+    qint64 cpu_ns = timer.nsecsElapsed();
+    gl_functions->glFinish();
+    qint64 frame_ns = timer.nsecsElapsed();
+    collect_gpu_times();
+
+    if (i >= options.warmup_frames) {
+      Frame frame;
+      frame.cpu_ms = cpu_ns / 1e6;
+      frame.frame_ms = frame_ns / 1e6;
+      frame.gpu_ms.fill(-1.0f);
+      frame.draw_calls = Mesh::draw_statistics.draw_calls;
+      frame.triangles = Mesh::draw_statistics.triangles;
+      frames.push_back(frame);
+    }
+  }
+
+  // GPU times are collected when their query set is reused; cycling through the sets collects the last frames as well
+  for (unsigned int i=0; i<GpuProfiler::BUFFERS; i++) {
+    GpuProfiler::begin_frame();
+    collect_gpu_times();
+  }
+  for (unsigned int i=0; i<frames.size(); i++) {
+    unsigned int gpu_frame = options.warmup_frames + i;
+    if (gpu_frame < gpu_frames.size()) frames[i].gpu_ms = gpu_frames[gpu_frame];
+  }
+
+  target->release();
+  return write_results(frames);
+}
+
+bool RenderBenchmark::write_results(const std::vector<Frame>& frames) {
+  auto summary = [&frames](std::function<double(const Frame&)> value) {
+    std::vector<double> values;
+    for (auto& frame : frames) {
+      double v = value(frame);
+      if (v >= 0.0) values.push_back(v);
+    }
+    QJsonObject object;
+    if (values.empty()) return object;
+    std::sort(values.begin(), values.end());
+    double total = 0.0;
+    for (double v : values) total += v;
+    object["mean"] = total / values.size();
+    object["p50"] = values[values.size()/2];
+    object["p95"] = values[std::min(values.size()-1, values.size()*95/100)];
+    object["p99"] = values[std::min(values.size()-1, values.size()*99/100)];
+    object["max"] = values.back();
+    return object;
+  };
+  // Passes that didn't run count as 0; a frame whose queries weren't available has no GPU time at all
+  auto gpu_total = [](const Frame& frame) {
+    double total = 0.0;
+    bool any = false;
+    for (float pass : frame.gpu_ms) {
+      if (pass >= 0.0f) {
+        total += pass;
+        any = true;
+      }
+    }
+    return any ? total : -1.0;
+  };
+
+  QJsonArray frame_array;
+  for (auto& frame : frames) {
+    QJsonObject passes;
+    for (unsigned int pass=0; pass<GpuProfiler::PASS_COUNT; pass++) {
+      if (frame.gpu_ms[pass] >= 0.0f) passes[GpuProfiler::pass_name(GpuProfiler::Pass(pass))] = frame.gpu_ms[pass];
+    }
+    QJsonObject object;
+    object["cpu_ms"] = frame.cpu_ms;
+    object["frame_ms"] = frame.frame_ms;
+    object["gpu_ms"] = gpu_total(frame);
+    object["gpu_passes_ms"] = passes;
+    object["draw_calls"] = int(frame.draw_calls);
+    object["triangles"] = double(frame.triangles);
+    frame_array.append(object);
+  }
+
+  QOpenGLFunctions_4_5_Core* gl_functions = context.versionFunctions<QOpenGLFunctions_4_5_Core>();
+  QJsonObject results;
+  results["renderer"] = QString((const char*)gl_functions->glGetString(GL_RENDERER));
+  results["gl_version"] = QString((const char*)gl_functions->glGetString(GL_VERSION));
+  results["width"] = options.width;
+  results["height"] = options.height;
+  results["frames"] = int(frames.size());
+  results["warmup_frames"] = int(options.warmup_frames);
+  results["camera_path"] = options.camera_path.isEmpty() ? QString("default") : options.camera_path;
+  results["model"] = options.model.isEmpty() ? QString("demo scene") : options.model;
+  results["cpu_ms"] = summary([](const Frame& frame) {return frame.cpu_ms;});
+  results["frame_ms"] = summary([](const Frame& frame) {return frame.frame_ms;});
+  results["gpu_ms"] = summary(gpu_total);
+  results["draw_calls"] = summary([](const Frame& frame) {return double(frame.draw_calls);});
+  results["triangles"] = summary([](const Frame& frame) {return double(frame.triangles);});
+  results["per_frame"] = frame_array;
+
+  QSaveFile file(options.output);
+  if (!file.open(QIODevice::WriteOnly)) {
+    qDebug() << "Could not write" << options.output;
+    return false;
+  }
+  file.write(QJsonDocument(results).toJson());
+  if (!file.commit()) return false;
+
+  qDebug() << "Wrote" << options.output;
+  return true;
+}
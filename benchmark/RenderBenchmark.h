@@ -0,0 +1,79 @@
+#ifndef RENDER_BENCHMARK_H
+#define RENDER_BENCHMARK_H
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QStringList>
+#include <QString>
+
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "OpenGLWindow.h"
+#include "rendering/GpuProfiler.h"
+
+// Renders the scene OpenGLWindow::initializeGL builds into an offscreen framebuffer at a fixed resolution while flying the
+// camera along a closed Catmull-Rom spline, then writes every frame's CPU/GPU times, draw calls and triangles as JSON
+// Only needs a QOffscreenSurface, so it runs without a display or GPU on Mesa's llvmpipe (LIBGL_ALWAYS_SOFTWARE=1)
+// OpenGLExamples' own arguments (--crowd, --no-simulation-thread, ...) apply as well
+class RenderBenchmark {
+public:
+  struct Options {
+    unsigned int frames = 600;
+    unsigned int warmup_frames = 60; // Rendered at the start of the path and left out of the results
+    int width = 1280;
+    int height = 720;
+    QString camera_path; // Control point file (see load_path); the built-in path around the demo scene when empty
+    QString model; // A model file drawn instead of the demo scene's nodes (which are hidden)
+    QString output = "benchmark.json";
+
+    // --frames <n> --warmup <n> --size <w>x<h> --camera-path <file> --model <file> --output <file>
+    static Options from_arguments(const QStringList& arguments);
+  };
+
+  struct CameraKey {
+    glm::vec3 position;
+    glm::vec3 target;
+  };
+
+  struct Frame {
+    double cpu_ms; // OpenGLWindow::update_scene and paintGL, i.e. until every command is submitted
+    double frame_ms; // Until the GPU finished the frame (glFinish)
+    GpuProfiler::Frame_Times gpu_ms;
+    unsigned int draw_calls;
+    unsigned long long triangles;
+  };
+
+  RenderBenchmark(const Options& options);
+  ~RenderBenchmark();
+
+  // Returns false if no context could be created or the results couldn't be written
+  bool run();
+
+  static std::vector<CameraKey> default_path();
+  // One control point per line: "px py pz tx ty tz" (position, then the point looked at). Blank lines and # comments are skipped
+  static bool load_path(const QString& path, std::vector<CameraKey>& keys);
+  // t in [0, 1) goes once around the closed path
+  static CameraKey sample_path(const std::vector<CameraKey>& keys, float t);
+
+protected:
+  bool write_results(const std::vector<Frame>& frames);
+
+  Options options;
+
+  QOffscreenSurface surface;
+  QOpenGLContext context;
+  std::unique_ptr<QOpenGLFramebufferObject> target;
+  std::unique_ptr<OpenGLWindow> window;
+
+  // The window's camera is driven by the path, not by input
+  std::unordered_set<int> keys_pressed;
+  QPoint mouse_movement;
+  float delta_time = 1000.0f/60.0f;
+};
+
+#endif
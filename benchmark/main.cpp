@@ -0,0 +1,19 @@
+#include <QApplication>
+#include <QSurfaceFormat>
+
+#include "RenderBenchmark.h"
+
+int main(int argc, char *argv[]) {
+  // Nothing is ever shown, so no display is needed unless the platform is overridden
+  if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+
+  QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+  format.setProfile(QSurfaceFormat::CoreProfile);
+  format.setVersion(4, 5);
+  format.setSwapInterval(0);
+  QSurfaceFormat::setDefaultFormat(format);
+
+  RenderBenchmark benchmark(RenderBenchmark::Options::from_arguments(app.arguments()));
+  return benchmark.run() ? 0 : 1;
+}
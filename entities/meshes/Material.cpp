@@ -1,7 +1,13 @@
 #include <QDebug>
 
+#include <cmath>
+#include <algorithm>
+
 #include "Material.h"
 #include "../../rendering/Scene.h"
+#include "../../rendering/TextureRegistry.h"
+#include "../../rendering/TextureCache.h"
+#include "../../rendering/MaterialBuffer.h"
 
 int Material::nr_materials_created = 0;
 
@@ -27,112 +33,41 @@ void Material::init() {
   roughness = 1.0f;
   metalness = 0.0f;
 
-  opacity_map = {0, OPACITY_MAP, "", QImage()};
+  opacity_map = {0, OPACITY_MAP, "", QImage(), nullptr};
 
   initializeOpenGLFunctions();
 }
 
 Material::~Material() {
+  MaterialBuffer::remove(this);
 }
 
-int Material::draw(Shader* shader, int texture_unit) {
+void Material::draw(Shader* shader) {
+  Q_ASSERT_X(index >= 0, "Material::draw", "material is not in the material buffer (see Scene::is_material_loaded)");
   shader->use();
-  set_textures(shader, texture_unit);
-
-  shader->setVec3("material.color", color);
-  shader->setFloat("material.ambient", ambient);
-  shader->setFloat("material.diffuse", diffuse);
-  shader->setFloat("material.specular", specular);
-  shader->setFloat("material.roughness", roughness);
-  shader->setFloat("material.metalness", metalness);
-
-  shader->setBool("material.simple", false);
-  return texture_unit;
+  // Parameters and textures are read from the material buffer
+  shader->setInt("material_index", index);
+  shader->setBool("simple", false);
 }
 
-void Material::set_textures(Shader* shader, int& texture_unit) {
-  int number_albedo_maps = 0;
-  int number_ambient_occlusion_maps = 0;
-  int number_roughness_maps = 0;
-  int number_metalness_maps = 0;
-
-  // Set "Texture not found" texture
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, Shader::placeholder_texture);
-
-  for (unsigned int i=0; i<textures.size(); i++) {
-    glActiveTexture(GL_TEXTURE0+texture_unit);
-    switch (textures[i].type) {
-      case ALBEDO_MAP:
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        shader->setInt("material.albedo_map", texture_unit);
-        number_albedo_maps++;
-        break;
-      case AMBIENT_OCCLUSION_MAP:
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        shader->setInt("material.ambient_occlusion_map", texture_unit);
-        number_ambient_occlusion_maps++;
-        break;
-      case ROUGHNESS_MAP:
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        shader->setInt("material.roughness_map", texture_unit);
-        number_roughness_maps++;
-        break;
-      case METALNESS_MAP:
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        shader->setInt("material.metalness_map", texture_unit);
-        number_metalness_maps++;
-        break;
-      case CUBE_MAP:
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textures[i].id);
-        shader->setInt("skybox", 0);
-        break;
-      case OPACITY_MAP:{
-        #ifdef QT_DEBUG
-          qDebug() << "Opacity maps should not be put in textures\n";
-          qDebug() << "Materials have a special opacity map variable\n";
-        #endif
-        break;}
-      default:
-        break;
-    }
-    texture_unit++;
-  }
-
-  shader->setInt("material.use_albedo_map", (number_albedo_maps>=1));
-  shader->setBool("material.use_ambient_occlusion_map", (number_ambient_occlusion_maps>=1));
-  shader->setBool("material.use_roughness_map", (number_roughness_maps>=1));
-  shader->setBool("material.use_metalness_map", (number_metalness_maps>=1));
-}
-
-void Material::set_opacity(Shader* shader, int& texture_unit) {
-  shader->setFloat("material.opacity", opacity);
-  if (opacity_map.id == 0) {
-    shader->setBool("material.use_opacity_map", false);
-    return;
-  }
-
-  glActiveTexture(GL_TEXTURE0+texture_unit);
-  glBindTexture(GL_TEXTURE_2D, opacity_map.id);
-  shader->setInt("material.opacity_map", texture_unit);
-  shader->setBool("material.use_opacity_map", true);
-  texture_unit++;
+void Material::set_opacity(Shader* shader) {
+  shader->setInt("material_index", index);
 }
 
-Texture Material::load_texture(const char *path, Image_Type type, ImageLoading::Options options) {
-  Texture texture = Material::static_load_texture(path, type, options);
+Texture Material::load_texture(const char *path, Image_Type type, ImageLoading::Options options, const PreparedTexture* prepared) {
+  Texture texture = Material::static_load_texture(path, type, options, prepared);
 
   textures.push_back(texture);
 
   return texture;
 }
 
-Texture Material::static_load_texture(const char *path, Image_Type type, ImageLoading::Options options) {
+Texture Material::static_load_texture(const char *path, Image_Type type, ImageLoading::Options options, const PreparedTexture* prepared) {
   QOpenGLFunctions_4_5_Core* gl_functions = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_5_Core>();
   Q_ASSERT_X(gl_functions, "static_load_texture", "Could not get GL functions");
 
-  Texture texture = Scene::is_texture_loaded(path);
-  texture.type = type;
+  std::string key = TextureRegistry::make_key(path, type, options);
+  Texture texture = TextureRegistry::find(key);
 
   if (texture.id == 0) {
     texture.path = path;
@@ -149,62 +84,94 @@ Texture Material::static_load_texture(const char *path, Image_Type type, ImageLo
       gl_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     }
 
-    gl_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // Every 2D texture gets a full mip chain (uploaded or loaded from the texture cache)
+    gl_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     gl_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    qDebug() << "Loading" << path;
-    QImage img = QImage(path);
-    texture.image = img;
-    if (options & ImageLoading::Options::TRANSPARENCY) {
-      img = img.convertToFormat(QImage::Format_RGBA8888);
-    } else {
-      img = img.convertToFormat(QImage::Format_RGB888);
-    }
-    if (options & ImageLoading::Options::FLIP_ON_LOAD) {
-      img = img.mirrored(false, true);
-    }
+    GLenum internal_format = prepared ? prepared->internal_format : TextureCache::internal_format(type, options);
+    std::string hash = prepared ? prepared->hash : TextureCache::source_hash({path}, internal_format, options);
+    size_t gpu_bytes = 0;
 
-    Q_ASSERT_X(img.isNull()==false, "image loading", path);
-    if (type == ALBEDO_MAP) { // Convert gamma (SRGB) space into linear (RGB) space
-      if (options & ImageLoading::Options::TRANSPARENCY) {
-        gl_functions->glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, img.width(), img.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
-      } else {
-        gl_functions->glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, img.width(), img.height(), 0, GL_RGB, GL_UNSIGNED_BYTE, img.bits());
+    if (TextureCache::load(hash, GL_TEXTURE_2D, gl_functions, gpu_bytes)) {
+      qDebug() << "Loading" << path << "from the texture cache";
+      if (options & ImageLoading::Options::KEEP_IMAGE) {
+        texture.image = QImage(path);
+      }
+    } else if (prepared && !prepared->levels.empty() && !(options & ImageLoading::Options::KEEP_IMAGE)) {
+      qDebug() << "Loading" << path << "(decoded ahead of time)";
+      gpu_bytes = TextureCache::upload(prepared->levels, GL_TEXTURE_2D, internal_format, gl_functions);
+      TextureCache::store(hash, GL_TEXTURE_2D, gl_functions);
+    } else {
+      qDebug() << "Loading" << path;
+      QImage img = QImage(path);
+      if (options & ImageLoading::Options::KEEP_IMAGE) {
+        texture.image = img;
       }
-    } else { // Non-albedo maps should already be in linear space
       if (options & ImageLoading::Options::TRANSPARENCY) {
-        gl_functions->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.width(), img.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
+        img = img.convertToFormat(QImage::Format_RGBA8888);
       } else {
-        gl_functions->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img.width(), img.height(), 0, GL_RGB, GL_UNSIGNED_BYTE, img.bits());
+        img = img.convertToFormat(QImage::Format_RGB888);
       }
+      if (options & ImageLoading::Options::FLIP_ON_LOAD) {
+        img = img.mirrored(false, true);
+      }
+
+      Q_ASSERT_X(img.isNull()==false, "image loading", path);
+      // Albedo maps are in gamma (SRGB) space and get an SRGB format so they are converted into linear (RGB) space when sampled
+      // Non-albedo maps should already be in linear space
+      gpu_bytes = TextureCache::upload(img, GL_TEXTURE_2D, internal_format, true, gl_functions);
+      TextureCache::store(hash, GL_TEXTURE_2D, gl_functions);
     }
-    gl_functions->glGenerateMipmap(GL_TEXTURE_2D);
 
-    Scene::loaded_textures.push_back(texture);
+    // The decoded pixels are dropped here (unless KEEP_IMAGE was set)
+    texture = TextureRegistry::add(key, texture, gpu_bytes);
+  } else if ((options & ImageLoading::Options::KEEP_IMAGE) && texture.image.isNull()) {
+    texture.image = QImage(path);
+    TextureRegistry::set_image(key, texture.image);
   }
 
+  texture.path = path;
+  texture.type = type;
   return texture;
 }
 
 Texture Material::load_cubemap(const std::vector<std::string>& faces, bool add_to_material) {
-  Texture texture;
+  std::string key = "cubemap";
+  for (auto& face : faces) {
+    key += '|' + TextureRegistry::make_key(face, CUBE_MAP, ImageLoading::Options::NONE);
+  }
+  Texture texture = TextureRegistry::find(key);
   texture.path = faces[0];
   texture.type = CUBE_MAP;
 
+  if (texture.id != 0) {
+    if (add_to_material)
+      textures.push_back(texture);
+    return texture;
+  }
+
   glGenTextures(1, &texture.id);
   glBindTexture(GL_TEXTURE_CUBE_MAP, texture.id);
 
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // Only level 0 is uploaded (the skybox is never minified much)
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-  for (unsigned int i=0; i<faces.size(); i++) {
-    QImage img = QImage(faces[i].c_str()).convertToFormat(QImage::Format_RGB888);
-    if (img.isNull()) qDebug() << "Could not load cubemap texture:" << faces[i].c_str();
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X+i, 0, GL_SRGB, img.width(), img.height(), 0, GL_RGB, GL_UNSIGNED_BYTE, img.bits());
+  GLenum internal_format = TextureCache::internal_format(CUBE_MAP, ImageLoading::Options::NONE);
+  std::string hash = TextureCache::source_hash(faces, internal_format, ImageLoading::Options::NONE);
+  size_t gpu_bytes = 0;
+
+  if (!TextureCache::load(hash, GL_TEXTURE_CUBE_MAP, this, gpu_bytes)) {
+    for (unsigned int i=0; i<faces.size(); i++) {
+      QImage img = QImage(faces[i].c_str()).convertToFormat(QImage::Format_RGB888);
+      if (img.isNull()) qDebug() << "Could not load cubemap texture:" << faces[i].c_str();
+      gpu_bytes += TextureCache::upload(img, GL_TEXTURE_CUBE_MAP_POSITIVE_X+i, internal_format, false, this);
+    }
+    TextureCache::store(hash, GL_TEXTURE_CUBE_MAP, this);
   }
+  texture = TextureRegistry::add(key, texture, gpu_bytes);
 
   if (add_to_material)
     textures.push_back(texture);
@@ -212,40 +179,34 @@ Texture Material::load_cubemap(const std::vector<std::string>& faces, bool add_t
   return texture;
 }
 
-inline bool compare_floats(float a, float b, float error=0.001) {
-  return (glm::abs(a-b) <= error);
+// Scalars are rounded to the same 0.001 resolution the old pairwise comparison used as its tolerance
+inline long quantize(float value) {
+  return std::lround(value * 1000.0f);
 }
 
-inline bool compare_vec3(glm::vec3 a, glm::vec3 b, float error=0.001) {
-  return compare_floats(a.x, b.x, error) &&
-         compare_floats(a.y, b.y, error) &&
-         compare_floats(a.z, b.z, error);
+std::string Material::dedup_key() const {
+  std::string key;
+  for (float value : {color.r, color.g, color.b, opacity, ambient, diffuse, specular, roughness, metalness}) {
+    key += std::to_string(quantize(value));
+    key += ',';
+  }
+
+  // Texture order doesn't matter so the (type, texture) pairs are sorted
+  std::vector<std::string> texture_keys;
+  for (auto& texture : textures) {
+    texture_keys.push_back(std::to_string(texture.type) + ':' + (texture.handle ? texture.handle->key : texture.path));
+  }
+  std::sort(texture_keys.begin(), texture_keys.end());
+  for (auto& texture_key : texture_keys) {
+    key += '|' + texture_key;
+  }
+
+  if (opacity_map.id != 0) {
+    key += "|opacity:" + (opacity_map.handle ? opacity_map.handle->key : opacity_map.path);
+  }
+  return key;
 }
 
 bool Material::operator==(const Material& other_material) {
-  // Check if values match
-  if (compare_vec3(color, other_material.color) &&
-    compare_floats(ambient, other_material.ambient) &&
-    compare_floats(diffuse, other_material.diffuse) &&
-    compare_floats(specular, other_material.specular) &&
-    compare_floats(roughness, other_material.roughness) &&
-    compare_floats(metalness, other_material.metalness)) {
-    // Check if there are the same # of textures
-    if (textures.size() == other_material.textures.size()) {
-      // Check if all the textures match
-      for (unsigned int i=0; i<textures.size(); i++) {
-        bool other_material_has_texture_i = false;
-        for (unsigned int j=0; j<textures.size(); j++) {
-          if (textures[i].path == other_material.textures[j].path &&
-          textures[i].type == other_material.textures[j].type) {
-            other_material_has_texture_i = true;
-            break;
-          }
-        }
-        if (other_material_has_texture_i == false) return false;
-      }
-      return true;
-    }
-  }
-  return false;
+  return dedup_key() == other_material.dedup_key();
 }
@@ -6,6 +6,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -24,6 +25,7 @@ namespace ImageLoading {
     TRANSPARENCY    = 1 << 0,
     FLIP_ON_LOAD    = 1 << 1,
     CLAMPED         = 1 << 2,
+    KEEP_IMAGE      = 1 << 3, // Keep a CPU copy of the decoded image after it has been uploaded
   };
   inline constexpr Options operator|(Options a, Options b) {
     return a = static_cast<Options> (int(a) | int(b));
@@ -33,11 +35,15 @@ namespace ImageLoading {
   }
 }
 
+struct TextureHandle;
+struct PreparedTexture;
+
 struct Texture {
   unsigned int id;
   Image_Type type;
   std::string path;
-  QImage image;
+  QImage image; // Null unless the texture was loaded with ImageLoading::Options::KEEP_IMAGE
+  std::shared_ptr<TextureHandle> handle; // Keeps the texture registered (and on the GPU) while any copy of it is alive
 };
 
 class Material : public QObject, protected QOpenGLFunctions_4_5_Core {
@@ -50,7 +56,10 @@ public:
   std::vector<Texture> textures;
   Texture opacity_map;
 
+  int index = -1; // Position in the MaterialBuffer. Set once the material is registered (Scene::is_material_loaded)
+
   // Defaults are in comments
+  // Call MaterialBuffer::set_changed after changing these on a registered material
   glm::vec3 color;
   float opacity;
   float ambient;
@@ -63,19 +72,22 @@ public:
   Material();
   ~Material();
 
-  int draw(Shader* shader, int texture_unit);
-  void set_opacity(Shader* shader, int& texture_unit); // Assumes shader is already in use
+  void draw(Shader* shader);
+  void set_opacity(Shader* shader); // Assumes shader is already in use
 
-  Texture load_texture(const char *path, Image_Type type, ImageLoading::Options options=ImageLoading::Options::NONE);
-  static Texture static_load_texture(const char *path, Image_Type type, ImageLoading::Options options=ImageLoading::Options::NONE);
+  // `prepared` (from TextureCache::prepare with the same path, type and options) skips the hashing and decoding
+  Texture load_texture(const char *path, Image_Type type, ImageLoading::Options options=ImageLoading::Options::NONE, const PreparedTexture* prepared=nullptr);
+  static Texture static_load_texture(const char *path, Image_Type type, ImageLoading::Options options=ImageLoading::Options::NONE, const PreparedTexture* prepared=nullptr);
   Texture load_cubemap(const std::vector<std::string>& faces, bool add_to_material=true);
 
+  // Canonical description of the material: quantized scalars plus the sorted texture identities
+  // Materials with the same key look the same and can be shared (see Scene::is_material_loaded)
+  std::string dedup_key() const;
   bool operator==(const Material& other_material);
 
 protected:
   // Helper functions
   void init();
-  void set_textures(Shader* shader, int& texture_unit);
 };
 
 #endif
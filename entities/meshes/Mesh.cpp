@@ -1,8 +1,17 @@
 #include <QDebug>
 
+#include <algorithm>
+
+#include <glm/gtc/packing.hpp>
+
 #include "Mesh.h"
+#include "../../rendering/BonePalette.h"
 
 int Mesh::nr_meshes_created = 0;
+Mesh::LodSelection Mesh::lod_selection;
+int Mesh::bone_offset = 0;
+Mesh::DrawStatistics Mesh::draw_statistics;
+Shader* Mesh::skinning_shader = nullptr;
 
 Mesh::Mesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, Material *material) :
   material(material),
@@ -13,6 +22,16 @@ Mesh::Mesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, Ma
   initialize_buffers();
 }
 
+Mesh::Mesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, Material *material, const std::vector<MeshLod>& lods) :
+  material(material),
+  vertices(vertices),
+  indices(indices),
+  lods(lods)
+{
+  init();
+  initialize_buffers();
+}
+
 Mesh::Mesh() {
   init();
 }
@@ -25,23 +44,122 @@ void Mesh::init() {
 Mesh::~Mesh() {
 }
 
-void Mesh::draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4& model, int texture_unit) {
+void Mesh::draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4& model) {
+  bool pre_skinned = pre_skin(model);
+
   shader->use();
-  shader->setMat4("model", model);
+  // Pre-skinned vertices already have the bone and model transforms applied
+  shader->setMat4("model", pre_skinned ? glm::mat4(1.0f) : model);
+  shader->setBool("skinned", skinned && !pre_skinned);
+  if (skinned && !pre_skinned) shader->setInt("bone_offset", bone_offset);
   if (draw_type == Shader::DrawType::COLOR) {
-    material->draw(shader, texture_unit);
+    material->draw(shader);
   }
   if (transparency != Transparency::OPAQUE) {
-    material->set_opacity(shader, texture_unit);
+    material->set_opacity(shader);
   }
 
   // Draw Mesh
-  simple_draw();
+  draw_elements(pre_skinned ? skinned_vao : vao, select_lod(model));
 }
 
 void Mesh::simple_draw() {
+  simple_draw(0);
+}
+
+void Mesh::simple_draw(unsigned int lod) {
+  draw_elements(vao, lod);
+}
+
+void Mesh::draw_instanced(Shader* shader, Shader::DrawType draw_type, unsigned int instance_count) {
+  shader->use();
+  shader->setBool("skinned", skinned);
+  if (draw_type == Shader::DrawType::COLOR) {
+    material->draw(shader);
+  }
+  if (transparency != Transparency::OPAQUE) {
+    material->set_opacity(shader);
+  }
+
+  unsigned int index_count = lods.empty() ? indices.size() : lods[0].index_count;
   glBindVertexArray(vao);
-  glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)0);
+  glDrawElementsInstanced(GL_TRIANGLES, index_count, index_type, (void*)0, instance_count);
+  draw_statistics.draw_calls++;
+  draw_statistics.triangles += (unsigned long long)(index_count/3) * instance_count;
+}
+
+void Mesh::draw_elements(unsigned int vertex_array, unsigned int lod) {
+  glBindVertexArray(vertex_array);
+  if (lods.empty()) {
+    glDrawElements(GL_TRIANGLES, indices.size(), index_type, (void*)0);
+    draw_statistics.triangles += indices.size()/3;
+  } else {
+    size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    glDrawElements(GL_TRIANGLES, lods[lod].index_count, index_type, (void*)(lods[lod].first_index*index_size));
+    draw_statistics.triangles += lods[lod].index_count/3;
+  }
+  draw_statistics.draw_calls++;
+}
+
+bool Mesh::pre_skin(const glm::mat4& model) {
+  if (!skinned || skinning_shader == nullptr || vertices.empty()) return false;
+
+  if (skinned_vertex_count != vertices.size()) {
+    if (skinned_vao == 0) {
+      glGenVertexArrays(1, &skinned_vao);
+      glGenBuffers(1, &skinned_vbo);
+    }
+    skinned_vertex_count = vertices.size();
+    skinned_bone_offset = -1;
+
+    glBindVertexArray(skinned_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, skinned_vbo);
+    glBufferData(GL_ARRAY_BUFFER, skinned_vertex_count*sizeof(StaticVertex), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, normal));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, texture_coordinate));
+    glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+  }
+
+  // Later passes in the same frame reuse the result
+  if (skinned_generation == BonePalette::generation() && skinned_bone_offset == bone_offset && skinned_model == model) return true;
+  skinned_generation = BonePalette::generation();
+  skinned_bone_offset = bone_offset;
+  skinned_model = model;
+
+  skinning_shader->use();
+  skinning_shader->setMat4("model", model);
+  skinning_shader->setBool("skinned", true);
+  skinning_shader->setInt("bone_offset", bone_offset);
+  skinning_shader->setInt("vertex_count", skinned_vertex_count);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SKINNING_SOURCE_BINDING, vbo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SKINNING_TARGET_BINDING, skinned_vbo);
+  glDispatchCompute((skinned_vertex_count+63)/64, 1, 1);
+  glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+  return true;
+}
+
+unsigned int Mesh::select_lod(const glm::mat4& model) const {
+  if (lods.size() <= 1 || lod_selection.pixels_per_unit <= 0.0f) return 0;
+
+  float scale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))});
+  glm::vec3 center = glm::vec3(model * glm::vec4(bounds_center, 1.0f));
+  float distance = glm::length(center - lod_selection.view_position) - bounds_radius*scale;
+
+  int lod = 0;
+  if (distance > 0.0f) {
+    // Levels are ordered by increasing error, so stop at the first one that would be visible
+    float pixels_per_object_unit = scale * lod_selection.pixels_per_unit / distance;
+    while (lod+1 < int(lods.size()) && lods[lod+1].error * pixels_per_object_unit <= lod_selection.pixel_error) {
+      lod++;
+    }
+  }
+  return std::min(std::max(lod + lod_selection.bias, 0), int(lods.size())-1);
 }
 
 void Mesh::initialize_cube(float texture_scale) {
@@ -127,8 +245,54 @@ void Mesh::initialize_plane(bool horizontal, float texture_scale) {
 }
 
 void Mesh::initialize_buffers() {
+  create_buffers(GL_STATIC_DRAW);
+}
+
+StaticVertex Mesh::pack_static(const Vertex& vertex) {
+  float length = glm::length(vertex.normal);
+  glm::vec3 normal = length > 0.0f ? vertex.normal/length : glm::vec3(0.0f);
+  return StaticVertex{
+    vertex.position,
+    glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f)),
+    glm::packHalf2x16(vertex.texture_coordinate)
+  };
+}
+
+SkinnedVertex Mesh::pack_skinned(const Vertex& vertex) {
+  StaticVertex base = pack_static(vertex);
+  Q_ASSERT_X(glm::all(glm::lessThan(vertex.bone_ids, glm::ivec4(256))), "Mesh::pack_skinned", "bone ids must fit in a byte");
+  glm::uvec4 bone_ids(vertex.bone_ids);
+  return SkinnedVertex{
+    base.position,
+    base.normal,
+    base.texture_coordinate,
+    bone_ids.x | (bone_ids.y << 8) | (bone_ids.z << 16) | (bone_ids.w << 24),
+    glm::packUnorm4x8(vertex.bone_weights) // The shaders renormalize the weights so the rounding doesn't matter
+  };
+}
+
+void Mesh::create_buffers(GLenum usage) {
   initializeOpenGLFunctions();
 
+  skinned = std::any_of(vertices.begin(), vertices.end(), [](const Vertex& vertex) {
+    return vertex.bone_weights != glm::vec4(0.0f);
+  });
+
+  // Bounding sphere (around the box's center) for level of detail selection
+  if (!vertices.empty()) {
+    glm::vec3 minimum = vertices[0].position;
+    glm::vec3 maximum = vertices[0].position;
+    for (auto& vertex : vertices) {
+      minimum = glm::min(minimum, vertex.position);
+      maximum = glm::max(maximum, vertex.position);
+    }
+    bounds_center = (minimum + maximum) * 0.5f;
+    bounds_radius = 0.0f;
+    for (auto& vertex : vertices) {
+      bounds_radius = std::max(bounds_radius, glm::length(vertex.position - bounds_center));
+    }
+  }
+
   glGenVertexArrays(1, &vao);
   glGenBuffers(1, &vbo);
   glGenBuffers(1, &ebo);
@@ -136,27 +300,65 @@ void Mesh::initialize_buffers() {
   glBindVertexArray(vao);
 
   glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+  upload_vertices(usage, true);
 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+  upload_indices(usage, true);
 
+  GLsizei stride = skinned ? sizeof(SkinnedVertex) : sizeof(StaticVertex);
   // Position
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(StaticVertex, position));
   glEnableVertexAttribArray(0);
   // Normal
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+  glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(StaticVertex, normal));
   glEnableVertexAttribArray(1);
   // Texture Coordinate
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texture_coordinate));
+  glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(StaticVertex, texture_coordinate));
   glEnableVertexAttribArray(2);
-  // Bone IDs
-  glVertexAttribIPointer(3, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, bone_ids));
-  glEnableVertexAttribArray(3);
-  // Bone Weights
-  glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, bone_weights));
-  glEnableVertexAttribArray(4);
+  // Static meshes leave the bone attributes disabled (the shaders skip skinning when the skinned uniform is false)
+  if (skinned) {
+    // Bone IDs
+    glVertexAttribIPointer(3, 4, GL_UNSIGNED_BYTE, stride, (void*)offsetof(SkinnedVertex, bone_ids));
+    glEnableVertexAttribArray(3);
+    // Bone Weights
+    glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(SkinnedVertex, bone_weights));
+    glEnableVertexAttribArray(4);
+  }
 
   // Unbind vertex array
   glBindVertexArray(0);
 }
+
+template <typename T>
+static void buffer_data(QOpenGLFunctions_4_5_Core* gl_functions, GLenum target, const std::vector<T>& data, GLenum usage, bool size_changed) {
+  if (size_changed) {
+    gl_functions->glBufferData(target, data.size()*sizeof(T), data.data(), usage);
+  } else {
+    gl_functions->glBufferSubData(target, 0, data.size()*sizeof(T), data.data());
+  }
+}
+
+void Mesh::upload_vertices(GLenum usage, bool size_changed) {
+  if (skinned) {
+    std::vector<SkinnedVertex> packed(vertices.size());
+    std::transform(vertices.begin(), vertices.end(), packed.begin(), pack_skinned);
+    buffer_data(this, GL_ARRAY_BUFFER, packed, usage, size_changed);
+  } else {
+    std::vector<StaticVertex> packed(vertices.size());
+    std::transform(vertices.begin(), vertices.end(), packed.begin(), pack_static);
+    buffer_data(this, GL_ARRAY_BUFFER, packed, usage, size_changed);
+  }
+}
+
+void Mesh::upload_indices(GLenum usage, bool size_changed) {
+  GLenum new_index_type = vertices.size() < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  size_changed = size_changed || new_index_type != index_type;
+  index_type = new_index_type;
+
+  if (index_type == GL_UNSIGNED_SHORT) {
+    std::vector<unsigned short> short_indices(indices.begin(), indices.end());
+    buffer_data(this, GL_ELEMENT_ARRAY_BUFFER, short_indices, usage, size_changed);
+  } else {
+    buffer_data(this, GL_ELEMENT_ARRAY_BUFFER, indices, usage, size_changed);
+  }
+}
@@ -6,6 +6,7 @@
 
 #include <vector>
 #include <string>
+#include <cstddef>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -13,6 +14,8 @@
 #include "Material.h"
 #include "../../rendering/Shader.h"
 
+// Full precision vertex that meshes are built, edited and cached in
+// What's uploaded is one of the packed layouts below: StaticVertex, or SkinnedVertex if any vertex has bone weights
 struct Vertex {
   glm::vec3 position;
   glm::vec3 normal;
@@ -21,11 +24,38 @@ struct Vertex {
   glm::vec4 bone_weights;
 };
 
+struct StaticVertex {
+  glm::vec3 position;
+  unsigned int normal; // Signed normalized 2_10_10_10 (GL_INT_2_10_10_10_REV)
+  unsigned int texture_coordinate; // Two half floats
+};
+
+struct SkinnedVertex {
+  glm::vec3 position;
+  unsigned int normal;
+  unsigned int texture_coordinate;
+  unsigned int bone_ids; // Four unsigned bytes
+  unsigned int bone_weights; // Four unsigned normalized bytes
+};
+
+static_assert(sizeof(StaticVertex) == 20 && sizeof(SkinnedVertex) == 28, "packed vertex layouts must not have padding");
+static_assert(offsetof(StaticVertex, normal) == offsetof(SkinnedVertex, normal) && offsetof(StaticVertex, texture_coordinate) == offsetof(SkinnedVertex, texture_coordinate),
+              "the layouts share their first attributes");
+
+// A level of detail is a range of the mesh's index buffer; every level shares the same vertices
+struct MeshLod {
+  unsigned int first_index;
+  unsigned int index_count;
+  float error; // How far (in object space) the simplified surface may be from the full detail one
+};
+
 class Mesh : public QObject, protected QOpenGLFunctions_4_5_Core {
   Q_OBJECT;
 
 public:
   Mesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, Material *material);
+  // indices holds every level back to back; lods[0] is the full detail level
+  Mesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, Material *material, const std::vector<MeshLod>& lods);
   Mesh();
   virtual ~Mesh();
 
@@ -36,17 +66,63 @@ public:
   void initialize_plane(bool horizontal=true, float texture_scale=1.0f);
   virtual void initialize_buffers();
 
-  virtual void draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4& model, int texture_unit=0);
+  virtual void draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4& model);
+  // Draws instance_count instances at full detail. Where each one goes is up to the shader (see Crowd)
+  void draw_instanced(Shader* shader, Shader::DrawType draw_type, unsigned int instance_count);
   virtual void simple_draw(); // Just draws the object to the screen. The shader should be set before calling this.
+  void simple_draw(unsigned int lod);
+
+  // What levels of detail are picked from. Set by Scene::draw_objects for every pass
+  struct LodSelection {
+    glm::vec3 view_position = glm::vec3(0.0f);
+    float pixels_per_unit = 0.0f; // Viewport height / (2 tan(fov/2)): the size in pixels of 1 unit at distance 1. 0 keeps full detail
+    float pixel_error = 1.0f; // The coarsest level whose error covers at most this many pixels is used
+    int bias = 0; // Levels added to the selected one (coarser shadow passes)
+  };
+  static LodSelection lod_selection;
+  // Where the bones of the model being drawn start in the BonePalette. Set by RootNode::draw
+  static int bone_offset;
+  // Counted by every draw since the last reset (RenderBenchmark resets it each frame)
+  struct DrawStatistics {
+    unsigned int draw_calls = 0;
+    unsigned long long triangles = 0;
+  };
+  static DrawStatistics draw_statistics;
+
+  // Compute shader (shaders/skinning.comp) that skins each skinned mesh once per bone palette update into a buffer of static vertices
+  // that every pass then draws from. When null the vertex shaders skin skinned meshes in every pass
+  static Shader* skinning_shader;
+  static constexpr unsigned int SKINNING_SOURCE_BINDING = 3; // Shader storage bindings used by skinning.comp
+  static constexpr unsigned int SKINNING_TARGET_BINDING = 4;
+
+  // The level of detail to draw with the given model matrix
+  unsigned int select_lod(const glm::mat4& model) const;
+  unsigned int lod_count() const {return lods.empty() ? 1 : lods.size();}
 
   Transparency get_transparency() {return transparency;};
   void set_transparency(Transparency new_transparency) {transparency=new_transparency;};
 
+  bool is_skinned() {return skinned;}
+
+  static StaticVertex pack_static(const Vertex& vertex);
+  static SkinnedVertex pack_skinned(const Vertex& vertex);
+
 
   Material* material = nullptr;
 
 protected:
   void init();
+  // Creates the buffers and the vertex array for the current vertices and indices, picking the packed layout
+  void create_buffers(GLenum usage);
+  // Packs the vertices into the vertex buffer (which must be bound to GL_ARRAY_BUFFER)
+  void upload_vertices(GLenum usage, bool size_changed);
+  // Same for the indices and GL_ELEMENT_ARRAY_BUFFER. Meshes with fewer than 65536 vertices use 16 bit indices
+  void upload_indices(GLenum usage, bool size_changed);
+
+  void draw_elements(unsigned int vertex_array, unsigned int lod);
+  // Makes sure skinned_vbo holds this mesh skinned with the current bone palette and model. Returns false if the mesh
+  // should be skinned in the vertex shader instead
+  bool pre_skin(const glm::mat4& model);
 
   std::vector<Vertex> vertices;
   std::vector<unsigned int> indices;
@@ -57,6 +133,21 @@ protected:
   unsigned int vbo;
   unsigned int ebo;
 
+  bool skinned = false; // Set by create_buffers; uploaded vertices are SkinnedVertex instead of StaticVertex
+  GLenum index_type = GL_UNSIGNED_INT; // Set by upload_indices
+
+  // Output of pre_skin (StaticVertex layout sharing ebo) and what it was last computed with
+  unsigned int skinned_vao = 0;
+  unsigned int skinned_vbo = 0;
+  unsigned int skinned_vertex_count = 0;
+  unsigned int skinned_generation = 0;
+  int skinned_bone_offset = -1;
+  glm::mat4 skinned_model = glm::mat4(0.0f);
+
+  std::vector<MeshLod> lods; // Empty if the mesh only has its full detail level (which is then all of indices)
+  glm::vec3 bounds_center = glm::vec3(0.0f);
+  float bounds_radius = 0.0f;
+
   Transparency transparency;
 };
 
@@ -0,0 +1,460 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <unordered_map>
+
+#include "MeshOptimizer.h"
+
+MeshOptimizer::Statistics MeshOptimizer::optimize(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+  Statistics statistics;
+  statistics.original_vertices = vertices.size();
+  statistics.acmr_before = acmr(indices, vertices.size());
+
+  deduplicate_vertices(vertices, indices);
+  optimize_vertex_cache(indices, vertices.size());
+  optimize_overdraw(indices, vertices);
+  optimize_vertex_fetch(vertices, indices);
+
+  statistics.optimized_vertices = vertices.size();
+  statistics.acmr_after = acmr(indices, vertices.size());
+  return statistics;
+}
+
+unsigned int MeshOptimizer::deduplicate_vertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+  static_assert(sizeof(Vertex) == 16*sizeof(float), "Vertex must not have padding to be compared bytewise");
+
+  std::unordered_map<std::string, unsigned int> unique_vertices;
+  std::vector<unsigned int> remap(vertices.size());
+  std::vector<Vertex> unique;
+  for (unsigned int i=0; i<vertices.size(); i++) {
+    std::string key(reinterpret_cast<const char*>(&vertices[i]), sizeof(Vertex));
+    auto inserted = unique_vertices.emplace(key, unique.size());
+    if (inserted.second) unique.push_back(vertices[i]);
+    remap[i] = inserted.first->second;
+  }
+
+  for (auto& index : indices) index = remap[index];
+  vertices = std::move(unique);
+  return vertices.size();
+}
+
+// Scoring constants from Tom Forsyth, "Linear-Speed Vertex Cache Optimisation"
+namespace forsyth {
+  const int CACHE_SIZE = 32;
+  const float CACHE_DECAY_POWER = 1.5f;
+  const float LAST_TRIANGLE_SCORE = 0.75f;
+  const float VALENCE_BOOST_SCALE = 2.0f;
+  const float VALENCE_BOOST_POWER = 0.5f;
+
+  float vertex_score(int cache_position, unsigned int remaining_triangles) {
+    if (remaining_triangles == 0) return -1.0f; // Nothing left to draw with this vertex
+
+    float score = 0.0f;
+    if (cache_position >= 0) {
+      if (cache_position < 3) {
+        // It was used by the last triangle; don't favour it too much or strips end up too long
+        score = LAST_TRIANGLE_SCORE;
+      } else {
+        score = std::pow(1.0f - float(cache_position-3)/(CACHE_SIZE-3), CACHE_DECAY_POWER);
+      }
+    }
+    // Vertices with few triangles left are picked first so they can leave the cache for good
+    return score + VALENCE_BOOST_SCALE * std::pow(float(remaining_triangles), -VALENCE_BOOST_POWER);
+  }
+}
+
+void MeshOptimizer::optimize_vertex_cache(std::vector<unsigned int>& indices, unsigned int vertex_count) {
+  unsigned int triangle_count = indices.size()/3;
+  if (triangle_count == 0) return;
+
+  // Triangles using each vertex (compressed adjacency lists); the first remaining[v] entries of a list are still to be drawn
+  std::vector<unsigned int> remaining(vertex_count, 0);
+  for (auto index : indices) remaining[index]++;
+  std::vector<unsigned int> offsets(vertex_count+1, 0);
+  for (unsigned int v=0; v<vertex_count; v++) offsets[v+1] = offsets[v] + remaining[v];
+  std::vector<unsigned int> adjacency(indices.size());
+  std::vector<unsigned int> filled(vertex_count, 0);
+  for (unsigned int t=0; t<triangle_count; t++) {
+    for (int k=0; k<3; k++) {
+      unsigned int v = indices[t*3+k];
+      adjacency[offsets[v] + filled[v]++] = t;
+    }
+  }
+
+  std::vector<int> cache_position(vertex_count, -1);
+  std::vector<float> vertex_scores(vertex_count);
+  for (unsigned int v=0; v<vertex_count; v++) vertex_scores[v] = forsyth::vertex_score(-1, remaining[v]);
+
+  std::vector<float> triangle_scores(triangle_count);
+  std::vector<bool> drawn(triangle_count, false);
+  for (unsigned int t=0; t<triangle_count; t++) {
+    triangle_scores[t] = vertex_scores[indices[t*3]] + vertex_scores[indices[t*3+1]] + vertex_scores[indices[t*3+2]];
+  }
+
+  std::vector<unsigned int> output;
+  output.reserve(indices.size());
+  std::vector<unsigned int> cache, new_cache;
+  unsigned int scan_position = 0; // Fallback linear scan resumes here when no cached vertex has triangles left
+
+  int best_triangle = std::max_element(triangle_scores.begin(), triangle_scores.end()) - triangle_scores.begin();
+  while (output.size() < indices.size()) {
+    if (best_triangle < 0) {
+      while (drawn[scan_position]) scan_position++;
+      best_triangle = scan_position;
+    }
+
+    // Draw the triangle and put its vertices at the front of the cache
+    drawn[best_triangle] = true;
+    new_cache.clear();
+    for (int k=0; k<3; k++) {
+      unsigned int v = indices[best_triangle*3+k];
+      output.push_back(v);
+      new_cache.push_back(v);
+
+      // Remove the triangle from the vertex's remaining triangles
+      unsigned int* list = &adjacency[offsets[v]];
+      unsigned int* position = std::find(list, list+remaining[v], (unsigned int)best_triangle);
+      std::swap(*position, list[--remaining[v]]);
+    }
+    for (auto v : cache) {
+      if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end()) new_cache.push_back(v);
+    }
+
+    // Rescore everything that was in or just left the cache, then the triangles touching those vertices
+    for (unsigned int i=0; i<new_cache.size(); i++) {
+      unsigned int v = new_cache[i];
+      cache_position[v] = int(i) < forsyth::CACHE_SIZE ? int(i) : -1;
+      vertex_scores[v] = forsyth::vertex_score(cache_position[v], remaining[v]);
+    }
+    best_triangle = -1;
+    float best_score = -1.0f;
+    for (unsigned int i=0; i<new_cache.size(); i++) {
+      unsigned int v = new_cache[i];
+      for (unsigned int a=0; a<remaining[v]; a++) {
+        unsigned int t = adjacency[offsets[v]+a];
+        triangle_scores[t] = vertex_scores[indices[t*3]] + vertex_scores[indices[t*3+1]] + vertex_scores[indices[t*3+2]];
+        if (triangle_scores[t] > best_score) {
+          best_score = triangle_scores[t];
+          best_triangle = t;
+        }
+      }
+    }
+
+    if (int(new_cache.size()) > forsyth::CACHE_SIZE) new_cache.resize(forsyth::CACHE_SIZE);
+    std::swap(cache, new_cache);
+  }
+
+  indices = std::move(output);
+}
+
+void MeshOptimizer::optimize_overdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold) {
+  unsigned int triangle_count = indices.size()/3;
+  if (triangle_count == 0) return;
+
+  // A cluster starts wherever all three vertices of a triangle miss the cache; reordering at those points is almost free
+  std::vector<unsigned int> cluster_starts;
+  std::vector<unsigned int> timestamps(vertices.size(), 0);
+  unsigned int time = CACHE_SIZE+1;
+  for (unsigned int t=0; t<triangle_count; t++) {
+    int misses = 0;
+    for (int k=0; k<3; k++) {
+      unsigned int v = indices[t*3+k];
+      if (time - timestamps[v] > CACHE_SIZE) {
+        timestamps[v] = time++;
+        misses++;
+      }
+    }
+    if (t == 0 || misses == 3) cluster_starts.push_back(t);
+  }
+  cluster_starts.push_back(triangle_count);
+  unsigned int cluster_count = cluster_starts.size()-1;
+  if (cluster_count < 2) return;
+
+  auto position = [&](unsigned int t, int k) {return vertices[indices[t*3+k]].position;};
+
+  glm::vec3 mesh_centroid(0.0f);
+  float mesh_area = 0.0f;
+  std::vector<glm::vec3> centroids(cluster_count);
+  std::vector<glm::vec3> normals(cluster_count);
+  for (unsigned int c=0; c<cluster_count; c++) {
+    glm::vec3 centroid(0.0f);
+    glm::vec3 normal(0.0f);
+    float area = 0.0f;
+    for (unsigned int t=cluster_starts[c]; t<cluster_starts[c+1]; t++) {
+      glm::vec3 face_normal = glm::cross(position(t, 1)-position(t, 0), position(t, 2)-position(t, 0));
+      float face_area = glm::length(face_normal);
+      centroid += (position(t, 0)+position(t, 1)+position(t, 2)) / 3.0f * face_area;
+      normal += face_normal;
+      area += face_area;
+    }
+    mesh_centroid += centroid;
+    mesh_area += area;
+
+    float length = glm::length(normal);
+    centroids[c] = area > 0.0f ? centroid/area : centroid;
+    normals[c] = length > 0.0f ? normal/length : normal;
+  }
+  if (mesh_area > 0.0f) mesh_centroid /= mesh_area;
+
+  // Clusters facing away from the middle of the mesh are drawn first since they tend to occlude the rest
+  std::vector<float> sort_keys(cluster_count);
+  for (unsigned int c=0; c<cluster_count; c++) {
+    sort_keys[c] = glm::dot(centroids[c]-mesh_centroid, normals[c]);
+  }
+
+  std::vector<unsigned int> order(cluster_count);
+  for (unsigned int c=0; c<cluster_count; c++) order[c] = c;
+  std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {return sort_keys[a] > sort_keys[b];});
+
+  std::vector<unsigned int> reordered;
+  reordered.reserve(indices.size());
+  for (auto c : order) {
+    reordered.insert(reordered.end(), indices.begin()+cluster_starts[c]*3, indices.begin()+cluster_starts[c+1]*3);
+  }
+
+  if (acmr(reordered, vertices.size()) <= threshold * acmr(indices, vertices.size())) {
+    indices = std::move(reordered);
+  }
+}
+
+void MeshOptimizer::optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(vertices.size(), unused);
+  std::vector<Vertex> reordered;
+  reordered.reserve(vertices.size());
+  for (auto& index : indices) {
+    if (remap[index] == unused) {
+      remap[index] = reordered.size();
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices = std::move(reordered);
+}
+
+// Symmetric 4x4 matrix of a sum of squared plane distances (Garland & Heckbert)
+// The planes are weighted (by triangle area); the summed weight turns the error back into a distance
+namespace {
+  struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+    double weight = 0;
+
+    static Quadric plane(glm::vec3 normal, float d, double weight) {
+      Quadric q;
+      q.a00 = weight*normal.x*normal.x; q.a01 = weight*normal.x*normal.y; q.a02 = weight*normal.x*normal.z; q.a03 = weight*normal.x*d;
+      q.a11 = weight*normal.y*normal.y; q.a12 = weight*normal.y*normal.z; q.a13 = weight*normal.y*d;
+      q.a22 = weight*normal.z*normal.z; q.a23 = weight*normal.z*d;
+      q.a33 = weight*d*d;
+      q.weight = weight;
+      return q;
+    }
+    Quadric& operator+=(const Quadric& o) {
+      a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+      a11 += o.a11; a12 += o.a12; a13 += o.a13;
+      a22 += o.a22; a23 += o.a23;
+      a33 += o.a33;
+      weight += o.weight;
+      return *this;
+    }
+    double error(glm::vec3 p) const {
+      double x = p.x, y = p.y, z = p.z;
+      return a00*x*x + 2*a01*x*y + 2*a02*x*z + 2*a03*x
+           + a11*y*y + 2*a12*y*z + 2*a13*y
+           + a22*z*z + 2*a23*z
+           + a33;
+    }
+    // Weighted root mean square distance from p to the planes, in object space
+    double distance(glm::vec3 p) const {
+      return weight > 0.0 ? std::sqrt(std::max(0.0, error(p)) / weight) : 0.0;
+    }
+  };
+
+  int main_bone(const Vertex& vertex) {
+    if (vertex.bone_weights == glm::vec4(0.0f)) return -1;
+    int bone = 0;
+    for (int i=1; i<4; i++) {
+      if (vertex.bone_weights[i] > vertex.bone_weights[bone]) bone = i;
+    }
+    return vertex.bone_ids[bone];
+  }
+}
+
+std::vector<unsigned int> MeshOptimizer::simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, unsigned int target_index_count, float& error) {
+  unsigned int vertex_count = vertices.size();
+  error = 0.0f;
+
+  // Vertices at the same position (seams) share a position class, which is what quadrics and borders are tracked on
+  std::vector<unsigned int> position_class(vertex_count);
+  std::vector<unsigned int> class_size(vertex_count, 0);
+  {
+    std::unordered_map<std::string, unsigned int> classes;
+    for (unsigned int v=0; v<vertex_count; v++) {
+      std::string key(reinterpret_cast<const char*>(&vertices[v].position), sizeof(glm::vec3));
+      position_class[v] = classes.emplace(key, v).first->second;
+      class_size[position_class[v]]++;
+    }
+  }
+
+  std::vector<bool> locked(vertex_count, false);
+  std::vector<Quadric> quadrics(vertex_count);
+  {
+    // An edge (between position classes) used by only one triangle is an open border
+    std::unordered_map<unsigned long long, unsigned int> edge_uses;
+    auto edge_key = [&](unsigned int a, unsigned int b) {
+      a = position_class[a];
+      b = position_class[b];
+      return (unsigned long long)std::min(a, b) << 32 | std::max(a, b);
+    };
+    for (unsigned int i=0; i<indices.size(); i+=3) {
+      for (int k=0; k<3; k++) edge_uses[edge_key(indices[i+k], indices[i+(k+1)%3])]++;
+
+      glm::vec3 p0 = vertices[indices[i]].position;
+      glm::vec3 normal = glm::cross(vertices[indices[i+1]].position-p0, vertices[indices[i+2]].position-p0);
+      float area = glm::length(normal);
+      if (area <= 0.0f) continue;
+      normal /= area;
+      Quadric q = Quadric::plane(normal, -glm::dot(normal, p0), area);
+      for (int k=0; k<3; k++) quadrics[position_class[indices[i+k]]] += q;
+    }
+    for (unsigned int i=0; i<indices.size(); i+=3) {
+      for (int k=0; k<3; k++) {
+        unsigned int a = indices[i+k], b = indices[i+(k+1)%3];
+        if (edge_uses[edge_key(a, b)] == 1) locked[a] = locked[b] = true;
+      }
+    }
+    for (unsigned int v=0; v<vertex_count; v++) {
+      if (class_size[position_class[v]] > 1) locked[v] = true;
+    }
+  }
+
+  struct Collapse {
+    unsigned int from, to;
+    double cost; // Area weighted, so large flat regions go first
+    double distance;
+  };
+
+  std::vector<unsigned int> current = indices;
+  std::vector<bool> touched(vertex_count);
+  std::vector<unsigned int> remap(vertex_count);
+  while (current.size() > target_index_count) {
+    // Every directed edge whose start may move is a candidate
+    std::vector<Collapse> collapses;
+    for (unsigned int i=0; i<current.size(); i+=3) {
+      for (int k=0; k<3; k++) {
+        for (int direction=0; direction<2; direction++) {
+          unsigned int from = current[i+(direction ? k : (k+1)%3)];
+          unsigned int to = current[i+(direction ? (k+1)%3 : k)];
+          if (locked[from] || main_bone(vertices[from]) != main_bone(vertices[to])) continue;
+          Quadric q = quadrics[position_class[from]];
+          q += quadrics[position_class[to]];
+          collapses.push_back(Collapse{from, to, std::max(0.0, q.error(vertices[to].position)), q.distance(vertices[to].position)});
+        }
+      }
+    }
+    if (collapses.empty()) break;
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {return a.cost < b.cost;});
+
+    // Triangles around each vertex, for the flip test
+    std::vector<unsigned int> offsets(vertex_count+1, 0);
+    for (auto index : current) offsets[index+1]++;
+    for (unsigned int v=0; v<vertex_count; v++) offsets[v+1] += offsets[v];
+    std::vector<unsigned int> adjacency(current.size());
+    std::vector<unsigned int> filled(offsets.begin(), offsets.end()-1);
+    for (unsigned int i=0; i<current.size(); i++) adjacency[filled[current[i]]++] = i/3;
+
+    std::fill(touched.begin(), touched.end(), false);
+    for (unsigned int v=0; v<vertex_count; v++) remap[v] = v;
+
+    // Each collapse removes about two triangles; don't overshoot the target by much in one pass
+    unsigned int triangles_to_remove = (current.size() - target_index_count) / 3;
+    unsigned int removed = 0;
+    for (auto& collapse : collapses) {
+      if (removed >= triangles_to_remove) break;
+      if (touched[collapse.from] || touched[collapse.to]) continue;
+
+      // Reject collapses that flip a remaining triangle around `from`
+      bool flips = false;
+      unsigned int collapsed_triangles = 0;
+      for (unsigned int a=offsets[collapse.from]; a<offsets[collapse.from+1] && !flips; a++) {
+        unsigned int t = adjacency[a];
+        unsigned int* triangle = &current[t*3];
+        if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+          collapsed_triangles++;
+          continue;
+        }
+        glm::vec3 before[3], after[3];
+        for (int k=0; k<3; k++) {
+          before[k] = vertices[triangle[k]].position;
+          after[k] = triangle[k] == collapse.from ? vertices[collapse.to].position : before[k];
+        }
+        glm::vec3 normal_before = glm::cross(before[1]-before[0], before[2]-before[0]);
+        glm::vec3 normal_after = glm::cross(after[1]-after[0], after[2]-after[0]);
+        flips = glm::dot(normal_before, normal_after) <= 0.0f;
+      }
+      if (flips) continue;
+
+      remap[collapse.from] = collapse.to;
+      quadrics[position_class[collapse.to]] += quadrics[position_class[collapse.from]];
+      error = std::max(error, float(collapse.distance));
+      removed += collapsed_triangles;
+
+      // Vertices around the collapse have stale costs and adjacency until the next pass
+      for (unsigned int a=offsets[collapse.from]; a<offsets[collapse.from+1]; a++) {
+        for (int k=0; k<3; k++) touched[current[adjacency[a]*3+k]] = true;
+      }
+    }
+    if (removed == 0) break;
+
+    std::vector<unsigned int> next;
+    next.reserve(current.size());
+    for (unsigned int i=0; i<current.size(); i+=3) {
+      unsigned int a = remap[current[i]], b = remap[current[i+1]], c = remap[current[i+2]];
+      if (a == b || b == c || a == c) continue;
+      next.push_back(a);
+      next.push_back(b);
+      next.push_back(c);
+    }
+    current = std::move(next);
+  }
+
+  return current;
+}
+
+std::vector<MeshLod> MeshOptimizer::build_lods(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, unsigned int max_levels) {
+  std::vector<MeshLod> lods{MeshLod{0, (unsigned int)indices.size(), 0.0f}};
+
+  std::vector<unsigned int> previous(indices);
+  while (lods.size() < max_levels) {
+    unsigned int target = previous.size()/2 / 3 * 3;
+    float level_error;
+    std::vector<unsigned int> level = simplify(vertices, previous, target, level_error);
+    if (level.empty() || level.size() > previous.size()*3/4) break; // Not worth another level
+
+    optimize_vertex_cache(level, vertices.size());
+    lods.push_back(MeshLod{(unsigned int)indices.size(), (unsigned int)level.size(), lods.back().error + level_error}); // Errors add up since each level is simplified from the previous one
+    indices.insert(indices.end(), level.begin(), level.end());
+    previous = std::move(level);
+  }
+
+  return lods;
+}
+
+float MeshOptimizer::acmr(const std::vector<unsigned int>& indices, unsigned int vertex_count) {
+  unsigned int triangle_count = indices.size()/3;
+  if (triangle_count == 0) return 0.0f;
+
+  // A vertex is in the FIFO if fewer than CACHE_SIZE misses happened since it was last loaded
+  std::vector<unsigned int> timestamps(vertex_count, 0);
+  unsigned int time = CACHE_SIZE+1;
+  unsigned int misses = 0;
+  for (auto index : indices) {
+    if (time - timestamps[index] > CACHE_SIZE) {
+      timestamps[index] = time++;
+      misses++;
+    }
+  }
+  return float(misses) / triangle_count;
+}
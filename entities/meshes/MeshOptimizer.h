@@ -0,0 +1,47 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <vector>
+
+#include "Mesh.h"
+
+// Reorders imported triangle lists for the GPU: identical vertices are merged, triangles are ordered for the post-transform
+// vertex cache and then (in clusters) to reduce overdraw, and vertices are laid out in the order they are first fetched
+// Works on plain vectors so it can run on the import worker threads
+class MeshOptimizer {
+public:
+  static constexpr unsigned int CACHE_SIZE = 16; // FIFO size used for the ACMR measurements (a conservative guess at current hardware)
+
+  struct Statistics {
+    unsigned int original_vertices;
+    unsigned int optimized_vertices;
+    float acmr_before;
+    float acmr_after;
+  };
+
+  // Runs every stage below in order
+  static Statistics optimize(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+  // Merges bitwise identical vertices and returns the new vertex count
+  static unsigned int deduplicate_vertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+  // Forsyth's linear-speed vertex cache optimization
+  static void optimize_vertex_cache(std::vector<unsigned int>& indices, unsigned int vertex_count);
+  // Splits the cache-ordered triangles into clusters wherever the cache would start over anyway and sorts the clusters so
+  // outward facing ones (likely occluders) come first. The new order is dropped if its ACMR is over `threshold` times the old one
+  static void optimize_overdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold=1.05f);
+  // Renumbers vertices in the order the index buffer first uses them; unreferenced vertices are dropped
+  static void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+  // Quadric error metric edge collapse down to about target_index_count indices, reusing the existing vertices
+  // Vertices on UV/normal seams (several vertices at one position) and open borders never move, and vertices only collapse
+  // onto neighbours driven by the same main bone so skin weights stay intact. error is set to the largest collapse error
+  static std::vector<unsigned int> simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, unsigned int target_index_count, float& error);
+  // Appends up to max_levels-1 simplified levels (each about half the previous one) to indices and returns every level
+  // Stops early once simplification no longer removes a meaningful number of triangles
+  static std::vector<MeshLod> build_lods(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, unsigned int max_levels=4);
+
+  // Average cache miss ratio: transformed vertices per triangle with a FIFO cache of CACHE_SIZE (0.5 is ideal, 3 is worst)
+  static float acmr(const std::vector<unsigned int>& indices, unsigned int vertex_count);
+};
+
+#endif
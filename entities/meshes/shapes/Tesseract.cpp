@@ -176,9 +176,10 @@ void Tesseract::project_to_3d() {
   update_vertex_buffer(false);
 }
 
-void Tesseract::draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4& model, int texture_unit) {
+void Tesseract::draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4& model) {
   shader->use();
   shader->setMat4("model", model);
+  shader->setBool("skinned", false);
 
   GLint src_rgb;
   GLint dst_rgb;
@@ -189,18 +190,18 @@ void Tesseract::draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4
   glGetIntegerv(GL_BLEND_SRC_ALPHA, &src_a);
   glGetIntegerv(GL_BLEND_DST_ALPHA, &dst_a);
   if (draw_type == Shader::DrawType::COLOR) {
-    shader->setBool("material.simple", true);
-    shader->setVec3("material.color", glm::vec3(1.0f));
+    shader->setBool("simple", true);
+    shader->setVec3("simple_color", glm::vec3(1.0f));
     glBlendFunc(GL_ONE, GL_ZERO);
     outline_draw();
     points_draw();
-    material->draw(shader, texture_unit);
+    material->draw(shader);
     glBlendFuncSeparate(GL_ONE, GL_SRC1_ALPHA, GL_ONE, GL_ZERO); // SRC is already multiplied by SRC_ALPHA in the shader
   }
   if (transparency != Transparency::OPAQUE) {
-    material->set_opacity(shader, texture_unit);
+    material->set_opacity(shader);
   }
-  // Mesh::draw(shader, draw_type, model, texture_unit);
+  // Mesh::draw(shader, draw_type, model);
   glDepthMask(GL_FALSE);
   simple_draw();
   glDepthMask(GL_TRUE);
@@ -212,6 +213,7 @@ void Tesseract::draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4
 void Tesseract::points_draw() {
   glBindVertexArray(vao);
   glDrawArrays(GL_POINTS, 0, vertices.size());
+  draw_statistics.draw_calls++;
 }
 
 void Tesseract::outline_draw() {
@@ -219,4 +221,5 @@ void Tesseract::outline_draw() {
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, outline_ebo);
   glDrawElements(GL_LINES, outline_indices.size(), GL_UNSIGNED_INT, (void*)0);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  draw_statistics.draw_calls++;
 }
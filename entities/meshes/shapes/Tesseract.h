@@ -26,7 +26,7 @@ public:
   void rotate(float angle, rotation_4D::RotationPlane rotation_plane);
   void project_to_3d();
 
-  virtual void draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4& model, int texture_unit) override;
+  virtual void draw(Shader* shader, Shader::DrawType draw_type, const glm::mat4& model) override;
   virtual void points_draw();
   virtual void outline_draw();
 
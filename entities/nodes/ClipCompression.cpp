@@ -0,0 +1,234 @@
+#include <QtGlobal>
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/quaternion.hpp>
+
+#include "ClipCompression.h"
+
+namespace {
+  constexpr unsigned int MAX_SEGMENT_FRAMES = 64; // Bounds the work of the frame reduction
+  constexpr float QUANTIZED_MAX = 65535.0f;
+  constexpr float ROTATION_QUANTIZED_MAX = 32767.0f;
+
+  glm::vec3 get_position(const LocalPose& pose, unsigned int i) {return glm::vec3(pose.position[0][i], pose.position[1][i], pose.position[2][i]);}
+  glm::vec3 get_scale(const LocalPose& pose, unsigned int i) {return glm::vec3(pose.scale[0][i], pose.scale[1][i], pose.scale[2][i]);}
+  glm::quat get_rotation(const LocalPose& pose, unsigned int i) {return glm::quat(pose.rotation[3][i], pose.rotation[0][i], pose.rotation[1][i], pose.rotation[2][i]);}
+
+  glm::quat nlerp(const glm::quat& a, glm::quat b, float factor) {
+    if (glm::dot(a, b) < 0.0f) b = -b;
+    return glm::normalize(a + (b - a) * factor);
+  }
+
+  uint16_t quantize(float value, float minimum, float extent) {
+    if (extent <= 0.0f) return 0;
+    return uint16_t(std::round(glm::clamp((value - minimum) / extent, 0.0f, 1.0f) * QUANTIZED_MAX));
+  }
+
+  // The channels whose track differs from the first frame by more than tolerance somewhere
+  // Frame f of channel i is at index f*channel_count + i of frames
+  template <typename Difference>
+  std::vector<unsigned int> animated_tracks(const LocalPose& frames, unsigned int frame_count, float tolerance, Difference difference) {
+    const unsigned int channel_count = frames.size() / frame_count;
+    std::vector<unsigned int> channels;
+    for (unsigned int i=0; i<channel_count; i++) {
+      for (unsigned int frame=1; frame<frame_count; frame++) {
+        if (difference(frames, i, frame*channel_count + i) > tolerance) {
+          channels.push_back(i);
+          break;
+        }
+      }
+    }
+    return channels;
+  }
+
+  // The range of a vector track over the kept frames
+  void track_range(const LocalPose& frames, unsigned int channel_count, const std::vector<unsigned int>& kept, unsigned int channel,
+                   glm::vec3 (*get)(const LocalPose&, unsigned int), glm::vec3& minimum, glm::vec3& extent) {
+    minimum = glm::vec3(INFINITY);
+    glm::vec3 maximum(-INFINITY);
+    for (unsigned int frame : kept) {
+      glm::vec3 value = get(frames, frame*channel_count + channel);
+      minimum = glm::min(minimum, value);
+      maximum = glm::max(maximum, value);
+    }
+    extent = maximum - minimum;
+  }
+}
+
+size_t CompressedClip::bytes() const {
+  return frame_times.size()*sizeof(float) + constant.size()*10*sizeof(float)
+       + (position_channels.size() + rotation_channels.size() + scale_channels.size())*sizeof(unsigned int)
+       + (position_minimum.size() + position_extent.size() + scale_minimum.size() + scale_extent.size())*sizeof(glm::vec3)
+       + (positions.size() + rotations.size() + scales.size())*sizeof(uint16_t);
+}
+
+float ClipCompression::angle_between(const glm::quat& a, glm::quat b) {
+  // Through the chord rather than acos(dot), which has no precision left for the tiny angles measured here
+  if (glm::dot(a, b) < 0.0f) b = -b;
+  glm::quat difference = a - b;
+  return 4.0f * std::asin(std::min(std::sqrt(glm::dot(difference, difference)) * 0.5f, 1.0f));
+}
+
+void ClipCompression::encode_rotation(const glm::quat& rotation, uint16_t* out) {
+  float components[4] = {rotation.x, rotation.y, rotation.z, rotation.w};
+  int largest = 0;
+  for (int i=1; i<4; i++) {
+    if (std::abs(components[i]) > std::abs(components[largest])) largest = i;
+  }
+  // q and -q are the same rotation, so the largest component is made positive and left out
+  float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+  // The other three are within +-1/sqrt(2)
+  uint64_t bits = largest;
+  for (int i=0; i<4; i++) {
+    if (i == largest) continue;
+    float value = glm::clamp(components[i] * sign * float(M_SQRT2), -1.0f, 1.0f);
+    bits = (bits << 15) | uint64_t(std::round((value * 0.5f + 0.5f) * ROTATION_QUANTIZED_MAX));
+  }
+  out[0] = bits & 0xffff;
+  out[1] = (bits >> 16) & 0xffff;
+  out[2] = (bits >> 32) & 0xffff;
+}
+
+glm::quat ClipCompression::decode_rotation(const uint16_t* in) {
+  uint64_t bits = uint64_t(in[0]) | (uint64_t(in[1]) << 16) | (uint64_t(in[2]) << 32);
+  int largest = (bits >> 45) & 3;
+
+  float components[4];
+  float sum = 0.0f;
+  for (int i=3; i>=0; i--) {
+    if (i == largest) continue;
+    components[i] = ((bits & 0x7fff) / ROTATION_QUANTIZED_MAX * 2.0f - 1.0f) * float(M_SQRT1_2);
+    sum += components[i] * components[i];
+    bits >>= 15;
+  }
+  components[largest] = std::sqrt(std::max(1.0f - sum, 0.0f));
+  return glm::quat(components[3], components[0], components[1], components[2]);
+}
+
+void ClipCompression::compress(const LocalPose& frames, const std::vector<float>& frame_times, float tolerance, CompressedClip& clip) {
+  Q_ASSERT_X(!frame_times.empty(), "Compressing clip", "Nothing to compress");
+  const unsigned int frame_count = frame_times.size();
+  const unsigned int channel_count = frames.size() / frame_count;
+  Q_ASSERT_X(channel_count*frame_count == frames.size(), "Compressing clip", "frames must hold every channel of every frame");
+  auto at = [channel_count](unsigned int frame, unsigned int i) {return frame*channel_count + i;};
+
+  clip = CompressedClip();
+  clip.constant.resize(channel_count);
+  for (unsigned int i=0; i<channel_count; i++) clip.constant.copy(i, frames, i);
+
+  clip.position_channels = animated_tracks(frames, frame_count, tolerance, [](const LocalPose& pose, unsigned int first, unsigned int other) {
+    return glm::distance(get_position(pose, first), get_position(pose, other));
+  });
+  clip.rotation_channels = animated_tracks(frames, frame_count, tolerance, [](const LocalPose& pose, unsigned int first, unsigned int other) {
+    return angle_between(get_rotation(pose, first), get_rotation(pose, other));
+  });
+  clip.scale_channels = animated_tracks(frames, frame_count, tolerance, [](const LocalPose& pose, unsigned int first, unsigned int other) {
+    return glm::distance(get_scale(pose, first), get_scale(pose, other));
+  });
+
+  // Greedily grows each segment while interpolating its ends reproduces every frame in between
+  auto reproduces = [&](unsigned int start, unsigned int end, unsigned int frame) {
+    float factor = (frame_times[frame] - frame_times[start]) / (frame_times[end] - frame_times[start]);
+    for (unsigned int i : clip.position_channels) {
+      if (glm::distance(glm::mix(get_position(frames, at(start, i)), get_position(frames, at(end, i)), factor), get_position(frames, at(frame, i))) > tolerance) return false;
+    }
+    for (unsigned int i : clip.rotation_channels) {
+      if (angle_between(nlerp(get_rotation(frames, at(start, i)), get_rotation(frames, at(end, i)), factor), get_rotation(frames, at(frame, i))) > tolerance) return false;
+    }
+    for (unsigned int i : clip.scale_channels) {
+      if (glm::distance(glm::mix(get_scale(frames, at(start, i)), get_scale(frames, at(end, i)), factor), get_scale(frames, at(frame, i))) > tolerance) return false;
+    }
+    return true;
+  };
+
+  bool animated = !clip.position_channels.empty() || !clip.rotation_channels.empty() || !clip.scale_channels.empty();
+  std::vector<unsigned int> kept{0};
+  if (animated) {
+    unsigned int start = 0;
+    for (unsigned int end=2; end<frame_count; end++) {
+      bool fits = end - start <= MAX_SEGMENT_FRAMES;
+      for (unsigned int frame=start+1; frame<end && fits; frame++) {
+        fits = reproduces(start, end, frame);
+      }
+      if (!fits) {
+        start = end-1;
+        kept.push_back(start);
+      }
+    }
+    if (frame_count > 1) kept.push_back(frame_count-1);
+  }
+  for (unsigned int frame : kept) clip.frame_times.push_back(frame_times[frame]);
+
+  clip.position_minimum.resize(clip.position_channels.size());
+  clip.position_extent.resize(clip.position_channels.size());
+  for (unsigned int k=0; k<clip.position_channels.size(); k++) {
+    track_range(frames, channel_count, kept, clip.position_channels[k], get_position, clip.position_minimum[k], clip.position_extent[k]);
+  }
+  clip.scale_minimum.resize(clip.scale_channels.size());
+  clip.scale_extent.resize(clip.scale_channels.size());
+  for (unsigned int k=0; k<clip.scale_channels.size(); k++) {
+    track_range(frames, channel_count, kept, clip.scale_channels[k], get_scale, clip.scale_minimum[k], clip.scale_extent[k]);
+  }
+
+  for (unsigned int frame : kept) {
+    for (unsigned int k=0; k<clip.position_channels.size(); k++) {
+      for (int c=0; c<3; c++) {
+        clip.positions.push_back(quantize(frames.position[c][at(frame, clip.position_channels[k])], clip.position_minimum[k][c], clip.position_extent[k][c]));
+      }
+    }
+    for (unsigned int k=0; k<clip.rotation_channels.size(); k++) {
+      uint16_t encoded[3];
+      encode_rotation(get_rotation(frames, at(frame, clip.rotation_channels[k])), encoded);
+      clip.rotations.insert(clip.rotations.end(), encoded, encoded+3);
+    }
+    for (unsigned int k=0; k<clip.scale_channels.size(); k++) {
+      for (int c=0; c<3; c++) {
+        clip.scales.push_back(quantize(frames.scale[c][at(frame, clip.scale_channels[k])], clip.scale_minimum[k][c], clip.scale_extent[k][c]));
+      }
+    }
+  }
+}
+
+void ClipCompression::sample(const CompressedClip& clip, float animation_time, LocalPose& pose) {
+  pose = clip.constant;
+  if (clip.frame_times.size() < 2) return; // Nothing is animated
+
+  unsigned int index = std::upper_bound(clip.frame_times.begin(), clip.frame_times.end(), animation_time) - clip.frame_times.begin();
+  index = std::min(std::max(index, 1u), unsigned(clip.frame_times.size()-1)) - 1;
+  float factor = glm::clamp((animation_time - clip.frame_times[index]) / (clip.frame_times[index+1] - clip.frame_times[index]), 0.0f, 1.0f);
+
+  // Quantized values are interpolated before being scaled back to their range
+  const unsigned int position_count = clip.position_channels.size();
+  const uint16_t* positions = clip.positions.data() + index*position_count*3;
+  for (unsigned int k=0; k<position_count; k++) {
+    for (int c=0; c<3; c++) {
+      float a = positions[k*3+c];
+      float b = positions[(position_count+k)*3+c];
+      pose.position[c][clip.position_channels[k]] = clip.position_minimum[k][c] + (a + (b-a)*factor) / QUANTIZED_MAX * clip.position_extent[k][c];
+    }
+  }
+
+  const unsigned int rotation_count = clip.rotation_channels.size();
+  const uint16_t* rotations = clip.rotations.data() + index*rotation_count*3;
+  for (unsigned int k=0; k<rotation_count; k++) {
+    glm::quat rotation = nlerp(decode_rotation(rotations + k*3), decode_rotation(rotations + (rotation_count+k)*3), factor);
+    unsigned int channel = clip.rotation_channels[k];
+    pose.rotation[0][channel] = rotation.x;
+    pose.rotation[1][channel] = rotation.y;
+    pose.rotation[2][channel] = rotation.z;
+    pose.rotation[3][channel] = rotation.w;
+  }
+
+  const unsigned int scale_count = clip.scale_channels.size();
+  const uint16_t* scales = clip.scales.data() + index*scale_count*3;
+  for (unsigned int k=0; k<scale_count; k++) {
+    for (int c=0; c<3; c++) {
+      float a = scales[k*3+c];
+      float b = scales[(scale_count+k)*3+c];
+      pose.scale[c][clip.scale_channels[k]] = clip.scale_minimum[k][c] + (a + (b-a)*factor) / QUANTIZED_MAX * clip.scale_extent[k][c];
+    }
+  }
+}
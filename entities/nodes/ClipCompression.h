@@ -0,0 +1,55 @@
+#ifndef CLIP_COMPRESSION_H
+#define CLIP_COMPRESSION_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "LocalPose.h"
+
+// A packed clip (see NodeAnimation::pack) with the frames that interpolation reproduces within a tolerance removed,
+// tracks that never change stored once, and the rest quantized: positions and scales to 16 bits per component over
+// the track's range, rotations to 48 bits (the three smallest components at 15 bits and the index of the largest)
+struct CompressedClip {
+  std::vector<float> frame_times; // Ticks of the frames that were kept
+  LocalPose constant; // Every channel; the animated tracks are overwritten when sampling
+
+  // Animated tracks (channel indices). Values are stored frame by frame, 3 components per track
+  std::vector<unsigned int> position_channels;
+  std::vector<unsigned int> rotation_channels;
+  std::vector<unsigned int> scale_channels;
+  std::vector<glm::vec3> position_minimum, position_extent;
+  std::vector<glm::vec3> scale_minimum, scale_extent;
+  std::vector<uint16_t> positions;
+  std::vector<uint16_t> rotations;
+  std::vector<uint16_t> scales;
+
+  size_t bytes() const;
+};
+
+class ClipCompression {
+public:
+  // Largest difference between a packed or compressed clip and the source keys (see NodeAnimation::pack)
+  struct Error {
+    float position = 0.0f; // Distance
+    float rotation = 0.0f; // Radians
+    float scale = 0.0f;
+  };
+
+  // frames holds every channel of frame f at f*channel count (like NodeAnimation's packed frames), frame f being at
+  // frame_times[f] ticks. Positions and scales may be off by tolerance and rotations by tolerance radians before
+  // quantization (which adds up to about 1e-4 radians and 1/65535 of each track's range)
+  static void compress(const LocalPose& frames, const std::vector<float>& frame_times, float tolerance, CompressedClip& clip);
+  static void sample(const CompressedClip& clip, float animation_time, LocalPose& pose);
+
+  // Angle (radians) of the rotation between a and b
+  static float angle_between(const glm::quat& a, glm::quat b);
+
+  // Smallest three quaternion encoding
+  static void encode_rotation(const glm::quat& rotation, uint16_t* out);
+  static glm::quat decode_rotation(const uint16_t* in);
+};
+
+#endif
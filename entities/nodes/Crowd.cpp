@@ -0,0 +1,143 @@
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+#include "Crowd.h"
+
+Crowd::Crowd(std::shared_ptr<RootNode> model, float sample_rate) : model(model) {
+  initializeOpenGLFunctions();
+  name = model->name + " crowd";
+
+  collect_meshes(model.get(), glm::mat4(1.0f));
+  bake(sample_rate);
+
+  glCreateBuffers(1, &instance_buffer);
+}
+
+Crowd::~Crowd() {
+  glDeleteTextures(1, &bone_texture);
+  glDeleteBuffers(1, &instance_buffer);
+  glDeleteBuffers(1, &clip_buffer);
+}
+
+void Crowd::initialize_shader(Shader* shader) {
+  shader->use();
+  shader->setInt("crowd_bones", BONE_TEXTURE_UNIT);
+}
+
+void Crowd::collect_meshes(Node* node, glm::mat4 transform) {
+  if (!node->get_visibility()) return;
+
+  // Same order as Node::draw, except that the instance's model matrix takes the place of the root's
+  if (node != model.get()) transform *= node->get_model_matrix();
+  for (auto& mesh : node->get_meshes()) {
+    meshes.push_back(Crowd_Mesh{mesh.get(), transform});
+  }
+  for (auto& child : node->get_child_nodes()) {
+    collect_meshes(child.get(), transform);
+  }
+}
+
+void Crowd::bake(float sample_rate) {
+  const std::unordered_map<std::string, NodeAnimation*>& animations = model->get_animation();
+  std::vector<std::string> animation_names{""};
+  for (auto& it : animations) animation_names.push_back(it.first);
+  std::sort(animation_names.begin()+1, animation_names.end());
+
+  const unsigned int bone_count = std::max<size_t>(model->get_armature_offsets().size(), 1);
+
+  std::vector<glm::mat4> frames; // bone_count matrices per row
+  std::vector<glm::mat4> bones;
+  std::vector<Clip> clips;
+  for (auto& animation_name : animation_names) {
+    NodeAnimation* animation = animation_name.empty() ? nullptr : animations.at(animation_name);
+    float duration = animation && animation->tps > 0.0f ? animation->duration / animation->tps : 0.0f; // Seconds
+
+    Clip clip;
+    clip.first_row = frames.size() / bone_count;
+    clip.frame_count = std::max(1, int(std::ceil(duration * sample_rate)));
+    clip.frames_per_second = sample_rate;
+    clip.padding = 0.0f;
+
+    for (unsigned int frame=0; frame<clip.frame_count; frame++) {
+      float animation_time = animation ? frame / sample_rate * animation->tps : 0.0f;
+      model->sample_bones(animation, animation_time, bones);
+      bones.resize(bone_count, glm::mat4(1.0f));
+      frames.insert(frames.end(), bones.begin(), bones.end());
+    }
+
+    animation_indices[animation_name] = clips.size();
+    clips.push_back(clip);
+  }
+
+  const int width = bone_count * 4;
+  const int height = frames.size() / bone_count;
+  int max_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  Q_ASSERT_X(width <= max_size && height <= max_size, "Baking crowd", "Too many bones or frames for one texture; lower the sample rate");
+
+  // Each matrix is four RGBA texels, one per column
+  glCreateTextures(GL_TEXTURE_2D, 1, &bone_texture);
+  glTextureStorage2D(bone_texture, 1, GL_RGBA32F, width, height);
+  glTextureSubImage2D(bone_texture, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, frames.data());
+  glTextureParameteri(bone_texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTextureParameteri(bone_texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glCreateBuffers(1, &clip_buffer);
+  glNamedBufferStorage(clip_buffer, clips.size()*sizeof(Clip), clips.data(), 0);
+
+  qDebug() << "Baked" << clips.size() << "clips of" << name.c_str() << "into" << width << "x" << height << "texels ("
+           << frames.size()*sizeof(glm::mat4) / 1024 << "KiB)";
+}
+
+unsigned int Crowd::animation_index(const std::string& animation_name) const {
+  auto it = animation_indices.find(animation_name);
+  Q_ASSERT_X(it != animation_indices.end(), "Crowd::animation_index", "Could not find specified animation");
+  return it->second;
+}
+
+void Crowd::set_instances(const std::vector<Instance>& new_instances) {
+  instances = new_instances;
+  if (instances.empty()) return;
+
+  if (instances.size() > instance_capacity) {
+    instance_capacity = instances.size();
+    glNamedBufferData(instance_buffer, instance_capacity*sizeof(Instance), instances.data(), GL_DYNAMIC_DRAW);
+  } else {
+    glNamedBufferSubData(instance_buffer, 0, instances.size()*sizeof(Instance), instances.data());
+  }
+}
+
+void Crowd::draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, bool partial_transparency_pass) {
+  if (instances.empty()) return;
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BINDING, instance_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLIP_BINDING, clip_buffer);
+  glBindTextureUnit(BONE_TEXTURE_UNIT, bone_texture);
+
+  Shader* triplet[3] = {shaders.opaque, shaders.full_transparency, shaders.partial_transparency};
+  for (Shader* shader : triplet) {
+    shader->use();
+    shader->setBool("crowd", true);
+    shader->setFloat("crowd_time", float(time));
+  }
+
+  for (auto& crowd_mesh : meshes) {
+    Transparency transparency = crowd_mesh.mesh->get_transparency();
+    // Only the color pass defers partially transparent meshes until after everything else
+    bool deferred = draw_type == Shader::DrawType::COLOR && transparency == PARTIAL_TRANSPARENCY;
+    if (deferred != partial_transparency_pass) continue;
+
+    Shader* shader = transparency == OPAQUE ? shaders.opaque : transparency == FULL_TRANSPARENCY ? shaders.full_transparency : shaders.partial_transparency;
+    shader->use();
+    shader->setMat4("crowd_mesh_transform", crowd_mesh.transform);
+    crowd_mesh.mesh->draw_instanced(shader, draw_type, instances.size());
+  }
+
+  // Everything else drawn with these shaders is not part of a crowd
+  for (Shader* shader : triplet) {
+    shader->use();
+    shader->setBool("crowd", false);
+  }
+}
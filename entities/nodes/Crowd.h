@@ -0,0 +1,91 @@
+#ifndef CROWD_H
+#define CROWD_H
+
+#include <QObject>
+#include <QOpenGLFunctions_4_5_Core>
+
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <memory>
+
+#include <glm/glm.hpp>
+
+#include "../../rendering/Shader.h"
+#include "../meshes/Mesh.h"
+#include "RootNode.h"
+
+// Many copies of one animated model drawn with one instanced draw call per mesh
+// Every animation of the model is baked once into a bone matrix texture, so an instance is just a model matrix, an animation
+// and a time offset: the vertex shaders (see crowd.glsl) pick and blend the baked frames and nothing is posed on the CPU
+class Crowd : public QObject, protected QOpenGLFunctions_4_5_Core {
+  Q_OBJECT;
+
+public:
+  static constexpr unsigned int INSTANCE_BINDING = 5; // Shader storage buffer binding points (see crowd.glsl)
+  static constexpr unsigned int CLIP_BINDING = 6;
+  static constexpr int BONE_TEXTURE_UNIT = 40; // Right after MaterialBuffer's texture arrays
+
+  // Must match CrowdInstance in crowd.glsl
+  struct Instance {
+    glm::mat4 model;
+    unsigned int animation = 0; // From animation_index
+    float time_offset = 0.0f; // Seconds
+    float speed = 1.0f;
+    float padding = 0.0f;
+  };
+  // Must match CrowdClip in crowd.glsl
+  struct Clip {
+    unsigned int first_row;
+    unsigned int frame_count;
+    float frames_per_second;
+    float padding;
+  };
+
+  // Bakes the rest pose and every animation of model at sample_rate frames per second. model is only a template: baking poses it,
+  // so it shouldn't also be in the scene. Nested RootNodes are drawn rigidly
+  Crowd(std::shared_ptr<RootNode> model, float sample_rate=30.0f);
+  virtual ~Crowd();
+
+  std::string name;
+
+  // Points the shader's crowd_bones sampler at BONE_TEXTURE_UNIT. Needed by every shader that includes crowd.glsl
+  static void initialize_shader(Shader* shader);
+
+  // Index of the named animation for Instance::animation. The empty name is the rest pose
+  unsigned int animation_index(const std::string& animation_name) const;
+
+  const std::vector<Instance>& get_instances() const {return instances;}
+  void set_instances(const std::vector<Instance>& new_instances);
+
+  // Seconds on the scene's clock that every instance's animation is drawn at (see Scene::set_crowd_time)
+  void set_time(double seconds) {time = seconds;}
+
+  // Draws every instance. Partially transparent meshes are left for the partial_transparency_pass in the color pass (see Scene::draw_objects)
+  // and are not sorted between instances
+  void draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, bool partial_transparency_pass=false);
+
+protected:
+  void bake(float sample_rate);
+  void collect_meshes(Node* node, glm::mat4 transform);
+
+  std::shared_ptr<RootNode> model;
+
+  struct Crowd_Mesh {
+    Mesh* mesh;
+    glm::mat4 transform; // Relative to the model's root
+  };
+  std::vector<Crowd_Mesh> meshes;
+
+  std::unordered_map<std::string, unsigned int> animation_indices;
+  std::vector<Instance> instances;
+
+  unsigned int bone_texture = 0;
+  unsigned int instance_buffer = 0;
+  size_t instance_capacity = 0;
+  unsigned int clip_buffer = 0;
+
+  double time = 0.0; // Drives every instance's animation
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include <QtGlobal>
+
+#include <cmath>
+#include <initializer_list>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "LocalPose.h"
+
+void LocalPose::resize(unsigned int size) {
+  for (auto& component : position) component.resize(size, 0.0f);
+  for (int i=0; i<3; i++) rotation[i].resize(size, 0.0f);
+  rotation[3].resize(size, 1.0f);
+  for (auto& component : scale) component.resize(size, 1.0f);
+}
+
+void LocalPose::set(unsigned int index, const glm::vec3& translation, const glm::quat& orientation, const glm::vec3& scaling) {
+  for (int c=0; c<3; c++) {
+    position[c][index] = translation[c];
+    scale[c][index] = scaling[c];
+  }
+  rotation[0][index] = orientation.x;
+  rotation[1][index] = orientation.y;
+  rotation[2][index] = orientation.z;
+  rotation[3][index] = orientation.w;
+}
+
+void LocalPose::copy(unsigned int index, const LocalPose& from, unsigned int from_index) {
+  for (int c=0; c<3; c++) {
+    position[c][index] = from.position[c][from_index];
+    scale[c][index] = from.scale[c][from_index];
+  }
+  for (int c=0; c<4; c++) rotation[c][index] = from.rotation[c][from_index];
+}
+
+glm::mat4 LocalPose::matrix(unsigned int index) const {
+  glm::mat4 transformation = glm::translate(glm::mat4(1.0f), glm::vec3(position[0][index], position[1][index], position[2][index]));
+  transformation *= glm::mat4_cast(glm::quat(rotation[3][index], rotation[0][index], rotation[1][index], rotation[2][index]));
+  return glm::scale(transformation, glm::vec3(scale[0][index], scale[1][index], scale[2][index]));
+}
+
+namespace {
+  glm::quat load_rotation(const LocalPose& pose, unsigned int i) {
+    return glm::quat(pose.rotation[3][i], pose.rotation[0][i], pose.rotation[1][i], pose.rotation[2][i]);
+  }
+
+  void store_rotation(LocalPose& pose, unsigned int i, const glm::quat& q) {
+    pose.rotation[0][i] = q.x;
+    pose.rotation[1][i] = q.y;
+    pose.rotation[2][i] = q.z;
+    pose.rotation[3][i] = q.w;
+  }
+
+#ifdef __SSE2__
+  // Four quaternions per register set: q[0] holds the x of each, q[1] the y...
+  void load_rotations(const LocalPose& pose, unsigned int i, __m128 q[4]) {
+    for (int c=0; c<4; c++) q[c] = _mm_loadu_ps(&pose.rotation[c][i]);
+  }
+
+  void store_rotations(LocalPose& pose, unsigned int i, const __m128 q[4]) {
+    for (int c=0; c<4; c++) _mm_storeu_ps(&pose.rotation[c][i], q[c]);
+  }
+
+  __m128 dot(const __m128 a[4], const __m128 b[4]) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+  }
+
+  void normalize(__m128 q[4]) {
+    __m128 inverse_length = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(dot(q, q)));
+    for (int c=0; c<4; c++) q[c] = _mm_mul_ps(q[c], inverse_length);
+  }
+
+  // p * q
+  void multiply(const __m128 p[4], const __m128 q[4], __m128 out[4]) {
+    __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p[3], q[0]), _mm_mul_ps(p[0], q[3])), _mm_sub_ps(_mm_mul_ps(p[1], q[2]), _mm_mul_ps(p[2], q[1])));
+    __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p[3], q[1]), _mm_mul_ps(p[1], q[3])), _mm_sub_ps(_mm_mul_ps(p[2], q[0]), _mm_mul_ps(p[0], q[2])));
+    __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p[3], q[2]), _mm_mul_ps(p[2], q[3])), _mm_sub_ps(_mm_mul_ps(p[0], q[1]), _mm_mul_ps(p[1], q[0])));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(p[3], q[3]), _mm_add_ps(_mm_add_ps(_mm_mul_ps(p[0], q[0]), _mm_mul_ps(p[1], q[1])), _mm_mul_ps(p[2], q[2])));
+    out[0] = x; out[1] = y; out[2] = z; out[3] = w;
+  }
+
+  // Lanes of value whose mask is negative get their sign flipped
+  __m128 negate_where_negative(__m128 value, __m128 mask) {
+    return _mm_xor_ps(value, _mm_and_ps(_mm_cmplt_ps(mask, _mm_setzero_ps()), _mm_set1_ps(-0.0f)));
+  }
+#endif
+
+  // Pointers to the components of a run of nodes: position x, y, z, rotation x, y, z, w, scale x, y, z
+  constexpr int COMPONENTS = 10;
+
+  void components(const LocalPose& pose, unsigned int offset, const float* out[COMPONENTS]) {
+    for (int c=0; c<3; c++) out[c] = pose.position[c].data() + offset;
+    for (int c=0; c<4; c++) out[3+c] = pose.rotation[c].data() + offset;
+    for (int c=0; c<3; c++) out[7+c] = pose.scale[c].data() + offset;
+  }
+
+  void components(LocalPose& pose, float* out[COMPONENTS]) {
+    for (int c=0; c<3; c++) out[c] = pose.position[c].data();
+    for (int c=0; c<4; c++) out[3+c] = pose.rotation[c].data();
+    for (int c=0; c<3; c++) out[7+c] = pose.scale[c].data();
+  }
+
+  // out may alias a or b, node for node
+  void blend_components(const float* const a[COMPONENTS], const float* const b[COMPONENTS], float* const out[COMPONENTS], unsigned int count, float weight) {
+    unsigned int i = 0;
+#ifdef __SSE2__
+    const __m128 w = _mm_set1_ps(weight);
+    for (; i+4<=count; i+=4) {
+      for (int c : {0, 1, 2, 7, 8, 9}) { // Positions and scales
+        __m128 value_a = _mm_loadu_ps(a[c]+i);
+        _mm_storeu_ps(out[c]+i, _mm_add_ps(value_a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b[c]+i), value_a), w)));
+      }
+
+      __m128 qa[4], qb[4], q[4];
+      for (int c=0; c<4; c++) {
+        qa[c] = _mm_loadu_ps(a[3+c]+i);
+        qb[c] = _mm_loadu_ps(b[3+c]+i);
+      }
+      __m128 cosine = dot(qa, qb);
+      for (int c=0; c<4; c++) {
+        q[c] = _mm_add_ps(qa[c], _mm_mul_ps(_mm_sub_ps(negate_where_negative(qb[c], cosine), qa[c]), w));
+      }
+      normalize(q);
+      for (int c=0; c<4; c++) _mm_storeu_ps(out[3+c]+i, q[c]);
+    }
+#endif
+    // The remainder (or everything without SSE2)
+    for (; i<count; i++) {
+      for (int c : {0, 1, 2, 7, 8, 9}) {
+        out[c][i] = a[c][i] + (b[c][i] - a[c][i]) * weight;
+      }
+      glm::quat qa(a[6][i], a[3][i], a[4][i], a[5][i]);
+      glm::quat qb(b[6][i], b[3][i], b[4][i], b[5][i]);
+      if (glm::dot(qa, qb) < 0.0f) qb = -qb;
+      glm::quat q = glm::normalize(qa + (qb - qa) * weight);
+      out[3][i] = q.x;
+      out[4][i] = q.y;
+      out[5][i] = q.z;
+      out[6][i] = q.w;
+    }
+  }
+}
+
+void PoseBlending::blend(const LocalPose& a, const LocalPose& b, float weight, LocalPose& out) {
+  const unsigned int count = a.size();
+  Q_ASSERT_X(b.size() == count, "Blending poses", "Poses are for different skeletons");
+  out.resize(count);
+
+  const float* a_components[COMPONENTS];
+  const float* b_components[COMPONENTS];
+  float* out_components[COMPONENTS];
+  components(a, 0, a_components);
+  components(b, 0, b_components);
+  components(out, out_components);
+  blend_components(a_components, b_components, out_components, count, weight);
+}
+
+void PoseBlending::blend(const LocalPose& frames, unsigned int a_offset, unsigned int b_offset, unsigned int count, float weight, LocalPose& out) {
+  Q_ASSERT_X(a_offset+count <= frames.size() && b_offset+count <= frames.size(), "Blending poses", "Frame out of range");
+  Q_ASSERT_X(&out != &frames, "Blending poses", "Can't blend into the frames");
+  out.resize(count);
+
+  const float* a_components[COMPONENTS];
+  const float* b_components[COMPONENTS];
+  float* out_components[COMPONENTS];
+  components(frames, a_offset, a_components);
+  components(frames, b_offset, b_components);
+  components(out, out_components);
+  blend_components(a_components, b_components, out_components, count, weight);
+}
+
+void PoseBlending::add(LocalPose& pose, const LocalPose& additive, const LocalPose& reference, float weight) {
+  const unsigned int count = pose.size();
+  Q_ASSERT_X(additive.size() == count && reference.size() == count, "Adding poses", "Poses are for different skeletons");
+
+  // The rotation added is conjugate(reference) * additive, scaled by nlerping it from the identity
+  unsigned int i = 0;
+#ifdef __SSE2__
+  const __m128 w = _mm_set1_ps(weight);
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (; i+4<=count; i+=4) {
+    for (int c=0; c<3; c++) {
+      __m128 position = _mm_sub_ps(_mm_loadu_ps(&additive.position[c][i]), _mm_loadu_ps(&reference.position[c][i]));
+      __m128 scale = _mm_sub_ps(_mm_loadu_ps(&additive.scale[c][i]), _mm_loadu_ps(&reference.scale[c][i]));
+      _mm_storeu_ps(&pose.position[c][i], _mm_add_ps(_mm_loadu_ps(&pose.position[c][i]), _mm_mul_ps(position, w)));
+      _mm_storeu_ps(&pose.scale[c][i], _mm_add_ps(_mm_loadu_ps(&pose.scale[c][i]), _mm_mul_ps(scale, w)));
+    }
+
+    __m128 q[4], r[4], delta[4], base[4];
+    load_rotations(additive, i, q);
+    load_rotations(reference, i, r);
+    for (int c=0; c<3; c++) r[c] = _mm_xor_ps(r[c], _mm_set1_ps(-0.0f));
+    multiply(r, q, delta);
+    __m128 sign = delta[3];
+    for (int c=0; c<3; c++) delta[c] = _mm_mul_ps(negate_where_negative(delta[c], sign), w);
+    delta[3] = _mm_add_ps(one, _mm_mul_ps(_mm_sub_ps(negate_where_negative(delta[3], sign), one), w));
+    normalize(delta);
+
+    load_rotations(pose, i, base);
+    multiply(base, delta, q);
+    normalize(q);
+    store_rotations(pose, i, q);
+  }
+#endif
+  for (; i<count; i++) {
+    for (int c=0; c<3; c++) {
+      pose.position[c][i] += (additive.position[c][i] - reference.position[c][i]) * weight;
+      pose.scale[c][i] += (additive.scale[c][i] - reference.scale[c][i]) * weight;
+    }
+    glm::quat delta = glm::conjugate(load_rotation(reference, i)) * load_rotation(additive, i);
+    if (delta.w < 0.0f) delta = -delta;
+    glm::quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+    delta = glm::normalize(identity + (delta - identity) * weight);
+    store_rotation(pose, i, glm::normalize(load_rotation(pose, i) * delta));
+  }
+}
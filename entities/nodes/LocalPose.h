@@ -0,0 +1,38 @@
+#ifndef LOCAL_POSE_H
+#define LOCAL_POSE_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Local (parent relative) transforms of every node of a skeleton in structure-of-arrays form: each component of every node
+// is contiguous, so PoseBlending works on four nodes per SSE instruction
+struct LocalPose {
+  std::vector<float> position[3];
+  std::vector<float> rotation[4]; // x, y, z, w
+  std::vector<float> scale[3];
+
+  void resize(unsigned int size);
+  unsigned int size() const {return position[0].size();}
+
+  void set(unsigned int index, const glm::vec3& translation, const glm::quat& orientation, const glm::vec3& scaling);
+  void copy(unsigned int index, const LocalPose& from, unsigned int from_index);
+  // Translation * rotation * scale
+  glm::mat4 matrix(unsigned int index) const;
+};
+
+// Blends whole poses at once. Rotations use nlerp (normalized linear interpolation) along the shorter arc, which is close
+// enough to slerp for the small angles between blended poses and needs no trigonometry
+class PoseBlending {
+public:
+  // out = a blended towards b by weight (0 is a, 1 is b). out may be a or b
+  static void blend(const LocalPose& a, const LocalPose& b, float weight, LocalPose& out);
+  // Same for two runs of count nodes stored in one pose (like the frames of a packed clip), starting at a_offset and b_offset
+  // out must not be frames
+  static void blend(const LocalPose& frames, unsigned int a_offset, unsigned int b_offset, unsigned int count, float weight, LocalPose& out);
+  // Adds weight times the difference between additive and reference (usually the additive clip's first frame) on top of pose
+  static void add(LocalPose& pose, const LocalPose& additive, const LocalPose& reference, float weight);
+};
+
+#endif
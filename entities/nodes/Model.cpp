@@ -1,9 +1,18 @@
+#include <QtConcurrent>
 #include <QImage>
 #include <QDebug>
 
+#include <numeric>
+
 #include "Model.h"
+#include "ModelCache.h"
+#include "../meshes/MeshOptimizer.h"
+#include "../../utility/CpuProfiler.h"
 #include "../../rendering/Scene.h"
 
+float Model::animation_resample_step = 0.0f;
+float Model::animation_compression_tolerance = 0.001f;
+bool Model::verbose_import = false;
 
 inline glm::mat4 aiMat_to_glmMat(const aiMatrix4x4& from) {
   glm::mat4 to(
@@ -23,63 +32,151 @@ inline glm::quat aiQuaternion_to_glm_quat(const aiQuaternion& from) {
   return glm::quat(from.w, from.x, from.y, from.z);
 }
 
-Model::Model(const char* path) {
-  name = path;
-  load_model(path);
+Model::Model(const char* path) : Model(start_import(path), path) {
+}
+
+Model::Model(const char* path, const char* name) : Model(start_import(path), name) {
 }
 
-Model::Model(const char* path, const char* name) {
+Model::Model(QFuture<ModelImport> import, const char* name) {
   this->name = name;
-  load_model(path);
+  finish_import(import.result());
 }
 
 Model::~Model() {
 }
 
-void Model::load_model(std::string path) {
+QFuture<ModelImport> Model::start_import(const std::string& path) {
+  return QtConcurrent::run([path]() {
+    PROFILE_ZONE("Model::start_import");
+    ModelImport import;
+    import.path = path;
+    import.timer.start();
+
+    QElapsedTimer stage_timer;
+    stage_timer.start();
+    std::string hash = ModelCache::source_hash(path);
+    import.from_cache = ModelCache::load(hash, import.data);
+    import.read_time = stage_timer.elapsed();
+
+    if (import.from_cache) {
+      import.ok = true;
+    } else if (import_model(import)) {
+      ModelCache::store(hash, import.data);
+      import.ok = true;
+    }
+
+    if (import.ok) prepare_textures(import);
+    return import;
+  });
+}
+
+void Model::finish_import(const ModelImport& import) {
+  if (!import.ok) return;
+  directory = import.path.substr(0, import.path.find_last_of('/'));
+
+  QElapsedTimer build_timer;
+  build_timer.start();
+  build_model(import);
+
+  qDebug() << "Imported" << import.path.c_str() << (import.from_cache ? "from the model cache" : "with Assimp") << "in" << import.timer.elapsed() << "ms:"
+           << "read" << import.read_time << "ms, meshes" << import.mesh_time << "ms, animations" << import.animation_time
+           << "ms, textures" << import.texture_time << "ms, GL objects" << build_timer.elapsed() << "ms";
+}
+
+bool Model::import_model(ModelImport& import) {
+  PROFILE_ZONE("Model::import_model");
+  QElapsedTimer stage_timer;
+  stage_timer.start();
+
   Assimp::Importer importer;
-  const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_RemoveRedundantMaterials);
+  const aiScene* scene = importer.ReadFile(import.path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_RemoveRedundantMaterials);
   // Check if the model loaded correctly
   if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
     qDebug() << "ERROR::ASSIMP::" << importer.GetErrorString();
-    return;
+    return false;
   }
+  import.read_time += stage_timer.restart();
 
-  directory = path.substr(0, path.find_last_of('/'));
+  ModelData& data = import.data;
+  std::string directory = import.path.substr(0, import.path.find_last_of('/'));
 
-  process_node(scene->mRootNode, scene, true);
-  load_armature(this);
-  load_animations(scene);
+  for (unsigned int i=0; i < scene->mNumMaterials; i++) {
+    import_material(scene->mMaterials[i], directory, data);
+  }
+  import_node(scene->mRootNode, -1, data);
+
+  // Bone indices are handed out up front, in mesh order, so the meshes can then be converted independently
+  std::unordered_map<std::string, unsigned int> bone_indices;
+  for (unsigned int i=0; i < scene->mNumMeshes; i++) {
+    for (unsigned int j=0; j < scene->mMeshes[i]->mNumBones; j++) {
+      const aiBone* bone = scene->mMeshes[i]->mBones[j];
+      if (bone_indices.count(bone->mName.C_Str())) continue;
+      bone_indices[bone->mName.C_Str()] = data.armature_offsets.size();
+      data.bone_names.push_back(bone->mName.C_Str());
+      data.armature_offsets.push_back(aiMat_to_glmMat(bone->mOffsetMatrix));
+    }
+  }
+
+  std::vector<unsigned int> mesh_indices(scene->mNumMeshes);
+  std::iota(mesh_indices.begin(), mesh_indices.end(), 0);
+  data.meshes.resize(scene->mNumMeshes);
+  QtConcurrent::blockingMap(mesh_indices, [&](unsigned int i) {
+    import_mesh(scene->mMeshes[i], bone_indices, data.meshes[i]);
+  });
+  import.mesh_time = stage_timer.restart();
+
+  std::vector<unsigned int> animation_indices(scene->mNumAnimations);
+  std::iota(animation_indices.begin(), animation_indices.end(), 0);
+  data.animations.resize(scene->mNumAnimations);
+  QtConcurrent::blockingMap(animation_indices, [&](unsigned int i) {
+    import_animation(scene->mAnimations[i], data.animations[i]);
+  });
+  import.animation_time = stage_timer.restart();
+
+  return true;
 }
 
-Node* Model::process_node(aiNode* node, const aiScene* scene, bool root) {
-  Node* my_node;
-  if (root) {
-    my_node = this;
-  } else {
-    my_node = new Node();
-    my_node->name = node->mName.C_Str();
+void Model::prepare_textures(ModelImport& import) {
+  PROFILE_ZONE("Model::prepare_textures");
+  QElapsedTimer stage_timer;
+  stage_timer.start();
+
+  std::vector<ModelData::TextureData> textures;
+  for (auto& material : import.data.materials) {
+    for (auto& texture : material.textures) {
+      if (import.textures.count(ModelImport::texture_key(texture))) continue;
+      import.textures[ModelImport::texture_key(texture)] = PreparedTexture();
+      textures.push_back(texture);
+    }
   }
-  // Create a map from the node's ORIGINAL name to the node itself
-  loaded_nodes[std::string(node->mName.C_Str())] = my_node;
-
-  my_node->set_transformation(aiMat_to_glmMat(node->mTransformation));
 
-  // Process the node's mesh (might be none)
-  for (unsigned int i=0; i < node->mNumMeshes; i++) {
-    aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-    my_node->add_mesh(std::shared_ptr<Mesh>(process_mesh(mesh, scene)));
+  std::vector<PreparedTexture> prepared = QtConcurrent::blockingMapped<std::vector<PreparedTexture>>(textures, [](const ModelData::TextureData& texture) {
+    return TextureCache::prepare(texture.path, Image_Type(texture.type), ImageLoading::Options::NONE);
+  });
+  for (unsigned int i=0; i<textures.size(); i++) {
+    import.textures[ModelImport::texture_key(textures[i])] = std::move(prepared[i]);
   }
 
+  import.texture_time = stage_timer.elapsed();
+}
+
+void Model::import_node(aiNode* node, int parent, ModelData& data) {
+  int index = data.nodes.size();
+  data.nodes.push_back(ModelData::NodeData{
+    node->mName.C_Str(),
+    aiMat_to_glmMat(node->mTransformation),
+    parent,
+    std::vector<unsigned int>(node->mMeshes, node->mMeshes+node->mNumMeshes)
+  });
+
   // Process the node's children (might be none)
   for (unsigned int i=0; i < node->mNumChildren; i++) {
-    my_node->add_child_node(std::shared_ptr<Node>(process_node(node->mChildren[i], scene)));
+    import_node(node->mChildren[i], index, data);
   }
-
-  return my_node;
 }
 
-Mesh* Model::process_mesh(aiMesh *mesh, const aiScene *scene) {
+void Model::import_mesh(aiMesh* mesh, const std::unordered_map<std::string, unsigned int>& bone_indices, ModelData::MeshData& my_mesh) {
   std::vector<Vertex> vertices;
   std::vector<unsigned int> indices;
 
@@ -119,35 +216,10 @@ Mesh* Model::process_mesh(aiMesh *mesh, const aiScene *scene) {
       indices.push_back(face.mIndices[j]);
     }
   }
-  // Load material
-  Material* mesh_colors = new Material();
-  aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-
-  load_material_textures(material, mesh_colors);
-
-  // Load colors
-  aiColor3D color(0.0f,0.0f,0.0f);
-  material->Get(AI_MATKEY_COLOR_DIFFUSE, color);
-  mesh_colors->color = glm::vec3(color.r,color.g,color.b);
 
-  mesh_colors->metalness = 1.0f;
-
-  mesh_colors = Scene::is_material_loaded(mesh_colors);
-
-  // Create bones list
+  // Assign bone weights (the armature belongs to the whole model, not the mesh's direct parent node)
   for (unsigned int i=0; i<mesh->mNumBones; i++) {
-    int bone_index;
-    auto it = loaded_bones.find(std::string(mesh->mBones[i]->mName.C_Str()));
-    if (it == loaded_bones.end()) {
-      // The  is contained be the root node
-      // Not the mesh's direct parent node (that is why I specifically use this-> even though it's unnecessary)
-      bone_index = this->armature_offsets.size();
-      loaded_bones[std::string(mesh->mBones[i]->mName.C_Str())] = bone_index;
-      this->armature_offsets.push_back(aiMat_to_glmMat(mesh->mBones[i]->mOffsetMatrix));
-      this->armature_final_transforms.push_back(glm::mat4(1.0f));
-    } else {
-      bone_index = (int) it->second;
-    }
+    int bone_index = (int) bone_indices.at(std::string(mesh->mBones[i]->mName.C_Str()));
     for (unsigned int j=0; j<mesh->mBones[i]->mNumWeights; j++) {
       unsigned int vertex_id = mesh->mBones[i]->mWeights[j].mVertexId;
       float vertex_weight = mesh->mBones[i]->mWeights[j].mWeight;
@@ -162,87 +234,169 @@ Mesh* Model::process_mesh(aiMesh *mesh, const aiScene *scene) {
     }
   }
 
-  Mesh *my_mesh = new Mesh(vertices, indices, mesh_colors);
-  my_mesh->name = mesh->mName.C_Str();
-  return my_mesh;
+  MeshOptimizer::Statistics statistics = MeshOptimizer::optimize(vertices, indices);
+  std::vector<MeshLod> lods = MeshOptimizer::build_lods(vertices, indices);
+
+  if (verbose_import) {
+    qDebug() << "Optimized mesh" << mesh->mName.C_Str() << "-" << statistics.original_vertices << "->" << statistics.optimized_vertices
+             << "vertices, ACMR" << statistics.acmr_before << "->" << statistics.acmr_after;
+    QDebug lod_debug = qDebug() << "Mesh" << mesh->mName.C_Str() << "has" << lods.size() << "levels of detail (triangles, error):";
+    for (auto& lod : lods) lod_debug << lod.index_count/3 << lod.error;
+  }
+
+  my_mesh = ModelData::MeshData{mesh->mName.C_Str(), std::move(vertices), std::move(indices), std::move(lods), mesh->mMaterialIndex};
 }
 
-void Model::load_material_textures(aiMaterial *mat, Material *mesh_material) {
+void Model::import_material(aiMaterial* material, const std::string& directory, ModelData& data) {
+  ModelData::MaterialData my_material;
+
   aiString str;
   // Load diffuse maps
-  for (unsigned int i=0; i < mat->GetTextureCount(aiTextureType_DIFFUSE); i++) {
-    mat->GetTexture(aiTextureType_DIFFUSE, i, &str);
-    std::string path = std::string(directory) + '/' + str.C_Str();
-
-    mesh_material->load_texture(path.c_str(), ALBEDO_MAP);
+  for (unsigned int i=0; i < material->GetTextureCount(aiTextureType_DIFFUSE); i++) {
+    material->GetTexture(aiTextureType_DIFFUSE, i, &str);
+    my_material.textures.push_back(ModelData::TextureData{ALBEDO_MAP, directory + '/' + str.C_Str()});
   }
   // Load specular maps (can only load one atm--otherwise it should be the same as albedo maps)
-  if (mat->GetTextureCount(aiTextureType_SPECULAR) >= 1) {
-    mat->GetTexture(aiTextureType_SPECULAR, 0, &str);
-    std::string path = std::string(directory) + '/' + str.C_Str();
-
-    mesh_material->load_texture(path.c_str(), ROUGHNESS_MAP);
+  if (material->GetTextureCount(aiTextureType_SPECULAR) >= 1) {
+    material->GetTexture(aiTextureType_SPECULAR, 0, &str);
+    my_material.textures.push_back(ModelData::TextureData{ROUGHNESS_MAP, directory + '/' + str.C_Str()});
   }
   // Cannot load any other type of map atm
-}
 
-void Model::load_armature(Node* node) {
-  auto it = this->loaded_bones.find(node->name);
-  if (it != this->loaded_bones.end()) {
-    node->set_bone_id(it->second);
-  }
+  // Load colors
+  aiColor3D color(0.0f,0.0f,0.0f);
+  material->Get(AI_MATKEY_COLOR_DIFFUSE, color);
+  my_material.color = glm::vec3(color.r,color.g,color.b);
 
-  for (auto child_node : node->get_child_nodes()) {
-    load_armature(child_node.get());
+  data.materials.push_back(my_material);
+}
+
+void Model::import_animation(aiAnimation* animation, ModelData::AnimationData& my_animation) {
+  my_animation.tps = animation->mTicksPerSecond >= 0.0001 ? animation->mTicksPerSecond : 24.0f;
+  my_animation.duration = animation->mDuration;
+  my_animation.name = animation->mName.C_Str();
+
+  for (unsigned int j=0; j<animation->mNumChannels; j++) {
+    const aiNodeAnim* ai_animation = animation->mChannels[j];
+
+    ModelData::ChannelData my_channel;
+    my_channel.node_name = ai_animation->mNodeName.C_Str();
+    for (unsigned int n=0; n<ai_animation->mNumPositionKeys; n++) {
+      my_channel.position_keys.push_back(
+        VectorKey{
+          (float) ai_animation->mPositionKeys[n].mTime,
+          aiVector3D_to_glm_vec3(ai_animation->mPositionKeys[n].mValue)
+        }
+      );
+    }
+    for (unsigned int n=0; n<ai_animation->mNumRotationKeys; n++) {
+      my_channel.rotation_keys.push_back(
+        QuaternionKey{
+          (float) ai_animation->mRotationKeys[n].mTime,
+          aiQuaternion_to_glm_quat(ai_animation->mRotationKeys[n].mValue)
+        }
+      );
+    }
+    for (unsigned int n=0; n<ai_animation->mNumScalingKeys; n++) {
+      my_channel.scale_keys.push_back(
+        VectorKey{
+          (float) ai_animation->mScalingKeys[n].mTime,
+          aiVector3D_to_glm_vec3(ai_animation->mScalingKeys[n].mValue)
+        }
+      );
+    }
+    my_animation.channels.push_back(std::move(my_channel));
   }
 }
 
-void Model::load_animations(const aiScene* scene) {
-  qDebug() << scene->mNumAnimations << "animations found for" << name.c_str();
-  for (unsigned int i=0; i<scene->mNumAnimations; i++) {
-    float tps = scene->mAnimations[i]->mTicksPerSecond >= 0.0001 ? scene->mAnimations[i]->mTicksPerSecond : 24.0f;
-    unsigned int duration = scene->mAnimations[i]->mDuration;
-    std::string animation_name(scene->mAnimations[i]->mName.C_Str());
+void Model::build_model(const ModelImport& import) {
+  PROFILE_ZONE("Model::build_model");
+  const ModelData& data = import.data;
+
+  // Materials are created per mesh (as Assimp reports them) and deduplicated by the scene
+  std::vector<Node*> nodes(data.nodes.size());
+  for (unsigned int i=0; i<data.nodes.size(); i++) {
+    const ModelData::NodeData& node_data = data.nodes[i];
+
+    Node* my_node;
+    if (node_data.parent < 0) {
+      my_node = this;
+    } else {
+      my_node = new Node();
+      my_node->name = node_data.name;
+      nodes[node_data.parent]->add_child_node(std::shared_ptr<Node>(my_node));
+    }
+    nodes[i] = my_node;
+    // Create a map from the node's ORIGINAL name to the node itself
+    loaded_nodes[node_data.name] = my_node;
+
+    my_node->set_transformation(node_data.transformation);
+
+    // Process the node's mesh (might be none)
+    for (auto mesh_index : node_data.meshes) {
+      const ModelData::MeshData& mesh_data = data.meshes[mesh_index];
+      const ModelData::MaterialData& material_data = data.materials[mesh_data.material];
+
+      Material* mesh_colors = new Material();
+      for (auto& texture : material_data.textures) {
+        auto prepared = import.textures.find(ModelImport::texture_key(texture));
+        mesh_colors->load_texture(texture.path.c_str(), Image_Type(texture.type), ImageLoading::Options::NONE, prepared != import.textures.end() ? &prepared->second : nullptr);
+      }
+      mesh_colors->color = material_data.color;
+      mesh_colors->metalness = 1.0f;
+      mesh_colors = Scene::is_material_loaded(mesh_colors);
+
+      std::vector<Vertex> vertices = mesh_data.vertices;
+      std::vector<unsigned int> indices = mesh_data.indices;
+      Mesh* my_mesh = new Mesh(vertices, indices, mesh_colors, mesh_data.lods);
+      my_mesh->name = mesh_data.name;
+      my_node->add_mesh(std::shared_ptr<Mesh>(my_mesh));
+    }
+  }
 
-    NodeAnimation* my_animation = new NodeAnimation(tps, duration, animation_name);
-    this->animation[animation_name] = my_animation;
+  for (unsigned int i=0; i<data.bone_names.size(); i++) {
+    loaded_bones[data.bone_names[i]] = i;
+    this->armature_offsets.push_back(data.armature_offsets[i]);
+    this->armature_final_transforms.push_back(glm::mat4(1.0f));
+  }
+  load_armature(this);
 
-    for (unsigned int j=0; j<scene->mAnimations[i]->mNumChannels; j++) {
-      const aiNodeAnim* ai_animation = scene->mAnimations[i]->mChannels[j];
+  qDebug() << data.animations.size() << "animations found for" << name.c_str();
+  for (auto& animation_data : data.animations) {
+    NodeAnimation* my_animation = new NodeAnimation(animation_data.tps, animation_data.duration, animation_data.name);
+    this->animation[animation_data.name] = my_animation;
 
-      auto it = loaded_nodes.find(std::string(ai_animation->mNodeName.C_Str()));
+    for (auto& channel_data : animation_data.channels) {
+      auto it = loaded_nodes.find(channel_data.node_name);
       Q_ASSERT_X(it != loaded_nodes.end(), "loading animations", "node specified for animation does not exist");
       it->second->set_animated(true);
 
-      NodeAnimationChannel* my_animation_channel = new NodeAnimationChannel(std::string(ai_animation->mNodeName.C_Str()));
-      for (unsigned int n=0; n<ai_animation->mNumPositionKeys; n++) {
-        my_animation_channel->add_position_key(
-          VectorKey{
-            (float) ai_animation->mPositionKeys[n].mTime,
-            aiVector3D_to_glm_vec3(ai_animation->mPositionKeys[n].mValue)
-          }
-        );
-      }
-      for (unsigned int n=0; n<ai_animation->mNumRotationKeys; n++) {
-        my_animation_channel->add_rotation_key(
-          QuaternionKey{
-            (float) ai_animation->mRotationKeys[n].mTime,
-            aiQuaternion_to_glm_quat(ai_animation->mRotationKeys[n].mValue)
-          }
-        );
-      }
-      for (unsigned int n=0; n<ai_animation->mNumScalingKeys; n++) {
-        my_animation_channel->add_scale_key(
-          VectorKey{
-            (float) ai_animation->mScalingKeys[n].mTime,
-            aiVector3D_to_glm_vec3(ai_animation->mScalingKeys[n].mValue)
-          }
-        );
-      }
+      NodeAnimationChannel* my_animation_channel = new NodeAnimationChannel(channel_data.node_name);
+      for (auto& key : channel_data.position_keys) my_animation_channel->add_position_key(key);
+      for (auto& key : channel_data.rotation_keys) my_animation_channel->add_rotation_key(key);
+      for (auto& key : channel_data.scale_keys) my_animation_channel->add_scale_key(key);
 
       my_animation_channel->verify();
+      my_animation_channel->set_loop_duration(animation_data.duration); // RootNode always loops its animations
+      if (animation_resample_step > 0.0f) my_animation_channel->resample(animation_resample_step);
 
-      my_animation->animation_channels[std::string(ai_animation->mNodeName.C_Str())] = my_animation_channel;
+      my_animation->animation_channels[channel_data.node_name] = my_animation_channel;
     }
+
+    my_animation->compression_tolerance = animation_compression_tolerance;
+    my_animation->pack();
+  }
+
+  bind_skeleton();
+}
+
+void Model::load_armature(Node* node) {
+  auto it = this->loaded_bones.find(node->name);
+  if (it != this->loaded_bones.end()) {
+    node->set_bone_id(it->second);
+  }
+
+  for (auto child_node : node->get_child_nodes()) {
+    load_armature(child_node.get());
   }
 }
@@ -2,6 +2,8 @@
 #define MODEL_H
 
 #include <QObject>
+#include <QFuture>
+#include <QElapsedTimer>
 #include <vector>
 #include <unordered_map>
 #include <string>
@@ -14,10 +16,30 @@
 #include <assimp/postprocess.h>
 
 #include "../../rendering/Shader.h"
+#include "../../rendering/TextureCache.h"
 #include "../meshes/Mesh.h"
 #include "../meshes/Material.h"
 #include "Node.h"
 #include "RootNode.h"
+#include "ModelData.h"
+
+// Everything Model::start_import does off the context thread
+struct ModelImport {
+  std::string path;
+  bool ok = false;
+  bool from_cache = false;
+  ModelData data;
+  std::unordered_map<std::string, PreparedTexture> textures; // Keyed by ModelImport::texture_key
+
+  // Stage wall times in ms. Mesh conversion includes the bone weights; stages that didn't run (cache hit) stay 0
+  qint64 read_time = 0; // Cache lookup or Assimp parsing
+  qint64 mesh_time = 0;
+  qint64 animation_time = 0;
+  qint64 texture_time = 0;
+  QElapsedTimer timer; // Started with the import
+
+  static std::string texture_key(const ModelData::TextureData& texture) {return std::to_string(texture.type) + '|' + texture.path;}
+};
 
 class Model : public RootNode {
   Q_OBJECT;
@@ -25,15 +47,37 @@ class Model : public RootNode {
 public:
   Model(const char *path);
   Model(const char *path, const char* name);
+  // Waits for an import started with start_import and creates its GL objects; must be called on the context thread
+  Model(QFuture<ModelImport> import, const char* name);
   virtual ~Model();
 
+  // Loads path from the model cache (or imports it with Assimp and refreshes the cache) and decodes its textures on the global thread pool
+  // Needs TextureCache::initialize to have been called
+  static QFuture<ModelImport> start_import(const std::string& path);
+
+  // When positive, animation channels are resampled to keys this many ticks apart as models are built so key lookups are O(1)
+  // 0 keeps the imported keys (already uniform tracks are still indexed directly)
+  static float animation_resample_step;
+  // Animations are packed and compressed (see ClipCompression) with this tolerance as models are built. 0 keeps the packed
+  // key frames uncompressed
+  static float animation_compression_tolerance;
+  // Also prints every mesh's optimization and level of detail statistics while importing (the timing report is always printed)
+  static bool verbose_import;
+
 protected:
-  void load_model(std::string path);
-  Node* process_node(aiNode* node, const aiScene* scene, bool root=false);
-  Mesh* process_mesh(aiMesh* mesh, const aiScene* scene);
-  void load_material_textures(aiMaterial* mat, Material* mesh_material);
+  // Creates the nodes, meshes, materials and animations described by the import and reports the timings
+  void finish_import(const ModelImport& import);
+
+  // Assimp import into the CPU-side ModelData; meshes and animations are converted in parallel
+  static bool import_model(ModelImport& import);
+  static void import_node(aiNode* node, int parent, ModelData& data);
+  static void import_mesh(aiMesh* mesh, const std::unordered_map<std::string, unsigned int>& bone_indices, ModelData::MeshData& my_mesh);
+  static void import_material(aiMaterial* material, const std::string& directory, ModelData& data);
+  static void import_animation(aiAnimation* animation, ModelData::AnimationData& my_animation);
+  static void prepare_textures(ModelImport& import);
+
+  void build_model(const ModelImport& import);
   void load_armature(Node* node);
-  void load_animations(const aiScene* scene);
 
   std::unordered_map<std::string, unsigned int> loaded_bones;
   std::unordered_map<std::string, Node*> loaded_nodes;
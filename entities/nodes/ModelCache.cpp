@@ -0,0 +1,243 @@
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#include <assimp/version.h>
+
+#include <cstring>
+#include <type_traits>
+
+#include "ModelCache.h"
+
+static const char cache_magic[8] = {'Q', 'T', 'M', 'O', 'D', 'E', 'L', '\n'};
+
+namespace {
+  // Appends raw values to a byte array. Arrays are written as an element count followed by the elements' bytes
+  struct Writer {
+    QByteArray bytes;
+
+    template <typename T>
+    void value(const T& v) {
+      static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written directly");
+      bytes.append(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+    template <typename T>
+    void array(const std::vector<T>& v) {
+      static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written directly");
+      value(quint32(v.size()));
+      bytes.append(reinterpret_cast<const char*>(v.data()), v.size()*sizeof(T));
+    }
+    void string(const std::string& s) {
+      value(quint32(s.size()));
+      bytes.append(s.data(), s.size());
+    }
+  };
+
+  // Reads back what Writer wrote from the mapped file. Any read past the end clears ok and leaves the output untouched
+  struct Reader {
+    const uchar* position;
+    const uchar* end;
+    bool ok = true;
+
+    bool take(void* out, size_t size) {
+      if (!ok || size > size_t(end-position)) return ok = false;
+      std::memcpy(out, position, size);
+      position += size;
+      return true;
+    }
+    template <typename T>
+    void value(T& v) {take(&v, sizeof(T));}
+    template <typename T>
+    void array(std::vector<T>& v) {
+      quint32 size = 0;
+      value(size);
+      if (!ok || size > (end-position)/sizeof(T)) {ok = false; return;}
+      v.resize(size);
+      take(v.data(), size*sizeof(T));
+    }
+    void string(std::string& s) {
+      quint32 size = 0;
+      value(size);
+      if (!ok || size > size_t(end-position)) {ok = false; return;}
+      s.assign(reinterpret_cast<const char*>(position), size);
+      position += size;
+    }
+    quint32 count() {
+      quint32 size = 0;
+      value(size);
+      if (size > size_t(end-position)) ok = false; // Every element takes at least one byte
+      return ok ? size : 0;
+    }
+  };
+}
+
+std::string ModelCache::cache_path(const std::string& hash) {
+  return "cache/models/" + hash + ".model";
+}
+
+std::string ModelCache::source_hash(const std::string& path) {
+  QFile file(QString::fromStdString(path));
+  if (!file.open(QIODevice::ReadOnly)) return std::string();
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(&file);
+
+  QByteArray settings = QByteArray::number(IMPORTER_VERSION) + '|' + QByteArray::number(aiGetVersionMajor()) + '.' + QByteArray::number(aiGetVersionMinor()) + '.' + QByteArray::number(aiGetVersionRevision());
+  hash.addData(settings);
+
+  return hash.result().toHex().toStdString();
+}
+
+bool ModelCache::load(const std::string& hash, ModelData& data) {
+  if (hash.empty()) return false;
+
+  QFile file(QString::fromStdString(cache_path(hash)));
+  if (!file.open(QIODevice::ReadOnly)) return false;
+
+  uchar* mapped = file.map(0, file.size());
+  if (!mapped) return false;
+
+  Reader in{mapped, mapped+file.size()};
+
+  char magic[8];
+  quint32 version, vertex_size;
+  std::string stored_hash;
+  in.take(magic, 8);
+  in.value(version);
+  in.value(vertex_size);
+  in.string(stored_hash);
+  if (!in.ok || !std::equal(magic, magic+8, cache_magic) || version != FORMAT_VERSION || vertex_size != sizeof(Vertex) || stored_hash != hash) {
+    qDebug() << "Ignoring stale or invalid model cache" << file.fileName();
+    return false;
+  }
+
+  ModelData loaded;
+
+  loaded.materials.resize(in.count());
+  for (auto& material : loaded.materials) {
+    in.value(material.color);
+    material.textures.resize(in.count());
+    for (auto& texture : material.textures) {
+      in.value(texture.type);
+      in.string(texture.path);
+    }
+  }
+
+  loaded.meshes.resize(in.count());
+  for (auto& mesh : loaded.meshes) {
+    in.string(mesh.name);
+    in.array(mesh.vertices);
+    in.array(mesh.indices);
+    in.array(mesh.lods);
+    in.value(mesh.material);
+    for (auto& lod : mesh.lods) {
+      if (size_t(lod.first_index) + lod.index_count > mesh.indices.size()) in.ok = false;
+    }
+    if (mesh.material >= loaded.materials.size()) in.ok = false;
+  }
+
+  loaded.nodes.resize(in.count());
+  for (unsigned int i=0; i<loaded.nodes.size(); i++) {
+    auto& node = loaded.nodes[i];
+    in.string(node.name);
+    in.value(node.transformation);
+    in.value(node.parent);
+    in.array(node.meshes);
+    if (node.parent >= int(i) || (node.parent < 0) != (i == 0)) in.ok = false;
+    for (auto mesh : node.meshes) {
+      if (mesh >= loaded.meshes.size()) in.ok = false;
+    }
+  }
+
+  loaded.animations.resize(in.count());
+  for (auto& animation : loaded.animations) {
+    in.string(animation.name);
+    in.value(animation.tps);
+    in.value(animation.duration);
+    animation.channels.resize(in.count());
+    for (auto& channel : animation.channels) {
+      in.string(channel.node_name);
+      in.array(channel.position_keys);
+      in.array(channel.rotation_keys);
+      in.array(channel.scale_keys);
+    }
+  }
+
+  loaded.bone_names.resize(in.count());
+  for (auto& bone_name : loaded.bone_names) in.string(bone_name);
+  in.array(loaded.armature_offsets);
+
+  if (!in.ok || loaded.nodes.empty() || loaded.bone_names.size() != loaded.armature_offsets.size()) {
+    qDebug() << "Ignoring truncated model cache" << file.fileName();
+    return false;
+  }
+
+  data = std::move(loaded);
+  return true;
+}
+
+void ModelCache::store(const std::string& hash, const ModelData& data) {
+  if (hash.empty()) return;
+
+  Writer out;
+  out.bytes.append(cache_magic, 8);
+  out.value(quint32(FORMAT_VERSION));
+  out.value(quint32(sizeof(Vertex)));
+  out.string(hash);
+
+  out.value(quint32(data.materials.size()));
+  for (auto& material : data.materials) {
+    out.value(material.color);
+    out.value(quint32(material.textures.size()));
+    for (auto& texture : material.textures) {
+      out.value(texture.type);
+      out.string(texture.path);
+    }
+  }
+
+  out.value(quint32(data.meshes.size()));
+  for (auto& mesh : data.meshes) {
+    out.string(mesh.name);
+    out.array(mesh.vertices);
+    out.array(mesh.indices);
+    out.array(mesh.lods);
+    out.value(mesh.material);
+  }
+
+  out.value(quint32(data.nodes.size()));
+  for (auto& node : data.nodes) {
+    out.string(node.name);
+    out.value(node.transformation);
+    out.value(node.parent);
+    out.array(node.meshes);
+  }
+
+  out.value(quint32(data.animations.size()));
+  for (auto& animation : data.animations) {
+    out.string(animation.name);
+    out.value(animation.tps);
+    out.value(animation.duration);
+    out.value(quint32(animation.channels.size()));
+    for (auto& channel : animation.channels) {
+      out.string(channel.node_name);
+      out.array(channel.position_keys);
+      out.array(channel.rotation_keys);
+      out.array(channel.scale_keys);
+    }
+  }
+
+  out.value(quint32(data.bone_names.size()));
+  for (auto& bone_name : data.bone_names) out.string(bone_name);
+  out.array(data.armature_offsets);
+
+  QDir().mkpath("cache/models");
+  QSaveFile file(QString::fromStdString(cache_path(hash)));
+  if (!file.open(QIODevice::WriteOnly)) {
+    qDebug() << "Could not write model cache" << file.fileName();
+    return;
+  }
+  file.write(out.bytes);
+  file.commit();
+}
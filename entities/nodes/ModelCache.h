@@ -0,0 +1,26 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <string>
+
+#include "ModelData.h"
+
+// Processed models are cached in cache/models/<source hash>.model so Assimp only runs the first time a file is imported
+// The file is memory-mapped and read back with plain copies: a header followed by length-prefixed strings and raw arrays
+class ModelCache {
+public:
+  static constexpr unsigned int FORMAT_VERSION = 2; // Bump when the file layout changes
+  static constexpr unsigned int IMPORTER_VERSION = 4; // Bump when Model's import code changes what ends up in ModelData
+
+  // Hash of the source file's contents, the importer version and the Assimp version. Empty if the file can't be read
+  static std::string source_hash(const std::string& path);
+
+  // Returns false if there is no valid cache entry for hash
+  static bool load(const std::string& hash, ModelData& data);
+  static void store(const std::string& hash, const ModelData& data);
+
+protected:
+  static std::string cache_path(const std::string& hash);
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef MODEL_DATA_H
+#define MODEL_DATA_H
+
+#include <vector>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "../meshes/Mesh.h"
+#include "NodeAnimation.h"
+
+// Everything Model needs from an imported file, without any Qt objects or GL state
+// Filled by Model's Assimp import or by ModelCache and turned into nodes/meshes/materials by Model::build_model
+struct ModelData {
+  struct TextureData {
+    int type; // Image_Type
+    std::string path;
+  };
+
+  struct MaterialData {
+    glm::vec3 color;
+    std::vector<TextureData> textures;
+  };
+
+  struct MeshData {
+    std::string name;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices; // Every level of detail back to back
+    std::vector<MeshLod> lods;
+    unsigned int material; // Index into materials
+  };
+
+  // Nodes are stored in pre-order so a node's parent always comes before it. nodes[0] is the root (parent -1)
+  struct NodeData {
+    std::string name;
+    glm::mat4 transformation;
+    int parent;
+    std::vector<unsigned int> meshes; // Indices into meshes
+  };
+
+  struct ChannelData {
+    std::string node_name;
+    std::vector<VectorKey> position_keys;
+    std::vector<QuaternionKey> rotation_keys;
+    std::vector<VectorKey> scale_keys;
+  };
+
+  struct AnimationData {
+    std::string name;
+    float tps;
+    unsigned int duration;
+    std::vector<ChannelData> channels;
+  };
+
+  std::vector<MaterialData> materials;
+  std::vector<MeshData> meshes;
+  std::vector<NodeData> nodes;
+  std::vector<AnimationData> animations;
+
+  // The armature, in bone index order
+  std::vector<std::string> bone_names;
+  std::vector<glm::mat4> armature_offsets;
+};
+
+#endif
@@ -43,28 +43,28 @@ void Node::update_armature(glm::mat4 parent_transformation, RootNode* root_node,
   }
 }
 
-void Node::draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, std::vector<Transparent_Draw>* partially_transparent_meshes, glm::mat4 model, int texture_unit) {
+void Node::draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, std::vector<Transparent_Draw>* partially_transparent_meshes, glm::mat4 model) {
   if (visible) {
     model *= get_model_matrix();
 
     for (unsigned int i=0; i<meshes.size(); i++) {
       if (meshes[i]->get_transparency() == OPAQUE) {
-        meshes[i]->draw(shaders.opaque, draw_type, model, texture_unit);
+        meshes[i]->draw(shaders.opaque, draw_type, model);
       }
       else if (meshes[i]->get_transparency() == FULL_TRANSPARENCY) {
-        meshes[i]->draw(shaders.full_transparency, draw_type, model, texture_unit);
+        meshes[i]->draw(shaders.full_transparency, draw_type, model);
       }
       else {
         if (draw_type != Shader::DrawType::COLOR) {
           Q_ASSERT_X(partially_transparent_meshes != nullptr, "Node::draw", "partially_transparent_meshes is null but it is needed");
-          meshes[i]->draw(shaders.partial_transparency, draw_type, model, texture_unit);
+          meshes[i]->draw(shaders.partial_transparency, draw_type, model);
         } else {
-          partially_transparent_meshes->push_back(Transparent_Draw{meshes[i].get(), shaders.partial_transparency, model, texture_unit});
+          partially_transparent_meshes->push_back(Transparent_Draw{meshes[i].get(), shaders.partial_transparency, model, Mesh::bone_offset});
         }
       }
     }
     for (unsigned int i=0; i<child_nodes.size(); i++) {
-      child_nodes[i]->draw(shaders, draw_type, partially_transparent_meshes, model, texture_unit);
+      child_nodes[i]->draw(shaders, draw_type, partially_transparent_meshes, model);
     }
   }
 }
@@ -35,7 +35,7 @@ public:
 
   // If NodeAnimation is a nullptr, bone matrix data is used instead of animation data (i.e. default bone pose is used)
   virtual void update_armature(glm::mat4 parent_transformation, RootNode* root_node, NodeAnimation* animation, float animation_time);
-  virtual void draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, std::vector<Transparent_Draw>* partially_transparent_meshes=nullptr, glm::mat4 model=glm::mat4(1.0f), int texture_unit=0);
+  virtual void draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, std::vector<Transparent_Draw>* partially_transparent_meshes=nullptr, glm::mat4 model=glm::mat4(1.0f));
 
   // Getters & setters
   virtual glm::mat4 get_model_matrix(bool use_transformation_matrix=true);
@@ -60,6 +60,7 @@ public:
   virtual const glm::vec3& get_rotation();
 
   virtual void set_bone_id(int id) {bone_id = id;}
+  int get_bone_id() const {return bone_id;}
 
   virtual void set_visibility(bool v);
   virtual bool get_visibility() {return visible;}
@@ -2,12 +2,93 @@
 
 #include <QDebug>
 
+#include <algorithm>
+#include <cmath>
+
 NodeAnimationChannel::NodeAnimationChannel(std::string name) {
   this->name = name;
 }
 
 NodeAnimationChannel::~NodeAnimationChannel() {}
 
+namespace {
+  // Returns the spacing of keys if every gap matches the first one, otherwise 0
+  template <typename Key>
+  float uniform_spacing(const std::vector<Key>& keys) {
+    if (keys.size() < 2) return 0.0f;
+    float spacing = keys[1].animation_time - keys[0].animation_time;
+    for (unsigned int i=1; i<keys.size(); i++) {
+      float expected = keys[0].animation_time + i*spacing;
+      if (std::abs(keys[i].animation_time - expected) > spacing*1e-3f) return 0.0f;
+    }
+    return spacing;
+  }
+
+  // Finds i such that keys[i] <= animation_time < keys[i+1], clamped to [0, keys.size()-2] so times outside the keys use the
+  // first or last segment. Uniform tracks are indexed directly; otherwise the cursor and the segment after it are tried before
+  // falling back to a binary search
+  template <typename Key>
+  unsigned int find_key_index(const std::vector<Key>& keys, float animation_time, float spacing, unsigned int& cursor) {
+    unsigned int last = keys.size()-2;
+    if (spacing > 0.0f) {
+      float index = (animation_time - keys[0].animation_time) / spacing;
+      return index <= 0.0f ? 0 : unsigned(std::min(index, float(last)));
+    }
+
+    if (cursor > last) cursor = 0;
+    if (keys[cursor].animation_time <= animation_time) {
+      if (cursor == last || animation_time < keys[cursor+1].animation_time) return cursor;
+      if (cursor+1 == last || animation_time < keys[cursor+2].animation_time) return ++cursor;
+    }
+
+    // First key after animation_time; the segment before it contains animation_time
+    auto it = std::upper_bound(keys.begin()+1, keys.end()-1, animation_time, [](float time, const Key& key) {
+      return time < key.animation_time;
+    });
+    cursor = unsigned(it - keys.begin()) - 1;
+    return cursor;
+  }
+
+  template <typename Key>
+  float interpolation_factor(const std::vector<Key>& keys, unsigned int index, float animation_time) {
+    float delta_time = keys[index+1].animation_time - keys[index].animation_time;
+    float factor = (animation_time - keys[index].animation_time) / delta_time;
+    // Before the first key and after the last key the track holds its end values (unless it loops, see wrap_factor)
+    return glm::clamp(factor, 0.0f, 1.0f);
+  }
+
+  // In a looping track, times after the last key (or before the first) are in the segment from the last key to the first key
+  // of the next loop. Returns false (and leaves factor alone) for times between the keys or if the track doesn't loop
+  template <typename Key>
+  bool wrap_factor(const std::vector<Key>& keys, float animation_time, float loop_duration, float& factor) {
+    if (loop_duration <= 0.0f) return false;
+    float first = keys.front().animation_time;
+    float last = keys.back().animation_time;
+    float gap = first + loop_duration - last;
+    if (gap <= 0.0f || (animation_time >= first && animation_time <= last)) return false;
+
+    float since_last = animation_time > last ? animation_time - last : animation_time + loop_duration - last;
+    factor = glm::clamp(since_last / gap, 0.0f, 1.0f);
+    return true;
+  }
+
+  // Keys at most step apart from the first to exactly the last key of the track, sampled with interpolate
+  template <typename Key, typename Interpolate>
+  std::vector<Key> resample_keys(const std::vector<Key>& keys, float step, Interpolate interpolate) {
+    float start = keys.front().animation_time;
+    float end = keys.back().animation_time;
+    // The slack keeps a span that is a multiple of step (up to rounding) from getting an extra, nearly empty interval
+    unsigned int intervals = std::max(1u, unsigned(std::ceil((end - start) / step - 1e-3f)));
+
+    std::vector<Key> resampled(intervals+1);
+    for (unsigned int i=0; i<=intervals; i++) {
+      float time = i == intervals ? end : start + (end - start) * i / intervals;
+      resampled[i] = Key{time, interpolate(time)};
+    }
+    return resampled;
+  }
+}
+
 void NodeAnimationChannel::verify() {
   #ifdef QT_DEBUG
     for (unsigned int i=1; i<position_keys.size(); i++) {
@@ -20,48 +101,56 @@ void NodeAnimationChannel::verify() {
       Q_ASSERT_X(scale_keys[i-1].animation_time < scale_keys[i].animation_time, "Node animation verification", "scale keys are out of order");
     }
   #endif
+  position_spacing = uniform_spacing(position_keys);
+  rotation_spacing = uniform_spacing(rotation_keys);
+  scale_spacing = uniform_spacing(scale_keys);
 }
 
-// TODO: make these use binary search instead of a linear search
-unsigned int NodeAnimationChannel::find_position_index(float animation_time) {
-  for (unsigned int i=0; i<position_keys.size()-1; i++) {
-    if (animation_time < position_keys[i+1].animation_time) {
-      return i;
-    }
+void NodeAnimationChannel::resample(float step) {
+  Q_ASSERT_X(step > 0.0f, "Resampling node animation", "Step must be positive");
+
+  // Uniform tracks are already indexed directly and are left alone
+  if (position_keys.size() >= 2 && position_spacing == 0.0f) {
+    position_keys = resample_keys(position_keys, step, [this](float time) {return interpolate_position(time);});
+  }
+  if (rotation_keys.size() >= 2 && rotation_spacing == 0.0f) {
+    rotation_keys = resample_keys(rotation_keys, step, [this](float time) {return interpolate_rotation(time);});
   }
-  qFatal("Finding position at animation_time: Could not find position");
+  if (scale_keys.size() >= 2 && scale_spacing == 0.0f) {
+    scale_keys = resample_keys(scale_keys, step, [this](float time) {return interpolate_scale(time);});
+  }
+
+  position_cursor = rotation_cursor = scale_cursor = 0;
+  verify();
+}
+
+unsigned int NodeAnimationChannel::find_position_index(float animation_time) {
+  Q_ASSERT_X(position_keys.size() >= 2, "Finding position index", "Need at least two position keys");
+  return find_key_index(position_keys, animation_time, position_spacing, position_cursor);
 }
 
 unsigned int NodeAnimationChannel::find_rotation_index(float animation_time) {
-  for (unsigned int i=0; i<rotation_keys.size()-1; i++) {
-    if (animation_time < rotation_keys[i+1].animation_time) {
-      return i;
-    }
-  }
-  qFatal("Finding position at animation_time: Could not find rotation");
+  Q_ASSERT_X(rotation_keys.size() >= 2, "Finding rotation index", "Need at least two rotation keys");
+  return find_key_index(rotation_keys, animation_time, rotation_spacing, rotation_cursor);
 }
 
 unsigned int NodeAnimationChannel::find_scale_index(float animation_time) {
-  for (unsigned int i=0; i<scale_keys.size()-1; i++) {
-    if (animation_time < scale_keys[i+1].animation_time) {
-      return i;
-    }
-  }
-  qFatal("Finding position at animation_time: Could not find scale");
+  Q_ASSERT_X(scale_keys.size() >= 2, "Finding scale index", "Need at least two scale keys");
+  return find_key_index(scale_keys, animation_time, scale_spacing, scale_cursor);
 }
 
 
 glm::vec3 NodeAnimationChannel::interpolate_position(float animation_time) {
   Q_ASSERT_X(position_keys.size() > 0, "Position interpolation", "No position keys");
-  // qDebug() << animation_time;
   if (position_keys.size() == 1) {
     return position_keys[0].vector;
   }
+  float factor;
+  if (wrap_factor(position_keys, animation_time, loop_duration, factor)) {
+    return glm::mix(position_keys.back().vector, position_keys.front().vector, factor);
+  }
   unsigned int index = find_position_index(animation_time);
-  float delta_time = position_keys[index+1].animation_time - position_keys[index].animation_time;
-  float factor = (animation_time - position_keys[index].animation_time) / delta_time;
-  Q_ASSERT_X(0.0f <= factor && factor <= 1.0f, "Position interpolation", "Interpolation factor is out of bounds");
-
+  factor = interpolation_factor(position_keys, index, animation_time);
   return glm::mix(position_keys[index].vector, position_keys[index+1].vector, factor);
 }
 
@@ -70,10 +159,12 @@ glm::quat NodeAnimationChannel::interpolate_rotation(float animation_time) {
   if (rotation_keys.size() == 1) {
     return rotation_keys[0].quaternion;
   }
+  float factor;
+  if (wrap_factor(rotation_keys, animation_time, loop_duration, factor)) {
+    return glm::normalize(glm::slerp(rotation_keys.back().quaternion, rotation_keys.front().quaternion, factor));
+  }
   unsigned int index = find_rotation_index(animation_time);
-  float delta_time = rotation_keys[index+1].animation_time - rotation_keys[index].animation_time;
-  float factor = (animation_time - rotation_keys[index].animation_time)/delta_time;
-  Q_ASSERT_X(0.0f <= factor && factor <= 1.0f, "Rotation interpolation", "Interpolation factor is out of bounds");
+  factor = interpolation_factor(rotation_keys, index, animation_time);
   return glm::normalize(glm::slerp(
     rotation_keys[index].quaternion,
     rotation_keys[index+1].quaternion,
@@ -86,14 +177,31 @@ glm::vec3 NodeAnimationChannel::interpolate_scale(float animation_time) {
   if (scale_keys.size() == 1) {
     return scale_keys[0].vector;
   }
+  float factor;
+  if (wrap_factor(scale_keys, animation_time, loop_duration, factor)) {
+    return glm::mix(scale_keys.back().vector, scale_keys.front().vector, factor);
+  }
   unsigned int index = find_scale_index(animation_time);
-  float delta_time = scale_keys[index+1].animation_time - scale_keys[index].animation_time;
-  float factor = (animation_time - scale_keys[index].animation_time) / delta_time;
-  Q_ASSERT_X(0.0f <= factor && factor <= 1.0f, "Scale interpolation", "Interpolation factor is out of bounds");
-
+  factor = interpolation_factor(scale_keys, index, animation_time);
   return glm::mix(scale_keys[index].vector, scale_keys[index+1].vector, factor);
 }
 
+void NodeAnimationChannel::sample(float animation_time, glm::vec3& position, glm::quat& rotation, glm::vec3& scale) {
+  position = NodeAnimationChannel::interpolate_position(animation_time);
+  rotation = NodeAnimationChannel::interpolate_rotation(animation_time);
+  scale = NodeAnimationChannel::interpolate_scale(animation_time);
+}
+
+void NodeAnimationChannel::append_key_times(std::vector<float>& times) const {
+  for (auto& key : position_keys) times.push_back(key.animation_time);
+  for (auto& key : rotation_keys) times.push_back(key.animation_time);
+  for (auto& key : scale_keys) times.push_back(key.animation_time);
+}
+
+size_t NodeAnimationChannel::key_bytes() const {
+  return (position_keys.size() + scale_keys.size())*sizeof(VectorKey) + rotation_keys.size()*sizeof(QuaternionKey);
+}
+
 NodeAnimation::NodeAnimation(float tps, unsigned int duration, std::string name) {
   this->tps = tps;
   this->duration = duration;
@@ -111,3 +219,95 @@ NodeAnimationChannel* NodeAnimation::get_animation_channel_for(std::string node_
   Q_ASSERT_X(it != animation_channels.end(), "Getting animation channel", "Could not find requested animation channel");
   return it->second;
 }
+
+void NodeAnimation::pack() {
+  packed_channels.clear();
+  for (auto& it : animation_channels) packed_channels.push_back(it.second);
+  std::sort(packed_channels.begin(), packed_channels.end(), [](NodeAnimationChannel* a, NodeAnimationChannel* b) {return a->name < b->name;});
+  const unsigned int channel_count = packed_channels.size();
+
+  // Frames at the keys themselves: interpolating between them reproduces every track, since each track is interpolated
+  // between its own keys and so between any finer set of times (rotations up to nlerp versus slerp). The frame at duration
+  // holds the wrap back to the first keys
+  frame_times = {0.0f, float(duration)};
+  for (auto channel : packed_channels) channel->append_key_times(frame_times);
+  frame_times.erase(std::remove_if(frame_times.begin(), frame_times.end(), [this](float time) {return time < 0.0f || time > duration;}), frame_times.end());
+  std::sort(frame_times.begin(), frame_times.end());
+  frame_times.erase(std::unique(frame_times.begin(), frame_times.end(), [](float a, float b) {return b - a < 1e-4f;}), frame_times.end());
+
+  std::vector<float> key_times = frame_times;
+  if (frame_times.size() > MAX_PACKED_FRAMES) {
+    qWarning().nospace() << "Animation " << name.c_str() << " has " << frame_times.size() << " distinct key times; packing it to "
+                         << MAX_PACKED_FRAMES << " evenly spaced frames, which loses detail between them";
+    frame_times.resize(MAX_PACKED_FRAMES);
+    for (unsigned int frame=0; frame<MAX_PACKED_FRAMES; frame++) frame_times[frame] = float(duration) * frame / (MAX_PACKED_FRAMES-1);
+  }
+
+  key_frames.resize(frame_times.size() * channel_count);
+  glm::vec3 position, scale;
+  glm::quat rotation;
+  for (unsigned int frame=0; frame<frame_times.size(); frame++) {
+    for (unsigned int i=0; i<channel_count; i++) {
+      packed_channels[i]->sample(frame_times[frame], position, rotation, scale);
+      key_frames.set(frame*channel_count + i, position, rotation, scale);
+    }
+  }
+
+  packing_statistics = Packing_Statistics();
+  for (auto channel : packed_channels) packing_statistics.key_bytes += channel->key_bytes();
+  packing_statistics.uncompressed_bytes = key_frames.size() * 10*sizeof(float) + frame_times.size()*sizeof(float);
+  packing_statistics.packed_bytes = packing_statistics.uncompressed_bytes;
+  packing_statistics.frame_count = packing_statistics.kept_frame_count = frame_times.size();
+
+  compressed = compression_tolerance > 0.0f;
+  if (compressed) {
+    ClipCompression::compress(key_frames, frame_times, compression_tolerance, compressed_clip);
+    packing_statistics.packed_bytes = compressed_clip.bytes();
+    packing_statistics.kept_frame_count = compressed_clip.frame_times.size();
+    key_frames = LocalPose();
+  }
+  packing_statistics.error = measure_error(key_times);
+}
+
+ClipCompression::Error NodeAnimation::measure_error(const std::vector<float>& key_times) const {
+  ClipCompression::Error error;
+  LocalPose pose;
+  glm::vec3 position, scale;
+  glm::quat rotation;
+  for (float time : key_times) {
+    sample(time, pose);
+    for (unsigned int i=0; i<packed_channels.size(); i++) {
+      // Exactly the key's value wherever the channel has a key at time
+      packed_channels[i]->sample(time, position, rotation, scale);
+      error.position = std::max(error.position, glm::distance(glm::vec3(pose.position[0][i], pose.position[1][i], pose.position[2][i]), position));
+      error.rotation = std::max(error.rotation, ClipCompression::angle_between(glm::quat(pose.rotation[3][i], pose.rotation[0][i], pose.rotation[1][i], pose.rotation[2][i]), rotation));
+      error.scale = std::max(error.scale, glm::distance(glm::vec3(pose.scale[0][i], pose.scale[1][i], pose.scale[2][i]), scale));
+    }
+  }
+  return error;
+}
+
+void NodeAnimation::sample(float animation_time, LocalPose& pose) const {
+  Q_ASSERT_X(is_packed(), "Sampling node animation", "Animation must be packed first");
+  if (compressed) {
+    ClipCompression::sample(compressed_clip, animation_time, pose);
+    return;
+  }
+
+  const unsigned int channel_count = packed_channels.size();
+  if (frame_times.size() == 1) {
+    PoseBlending::blend(key_frames, 0, 0, channel_count, 0.0f, pose);
+    return;
+  }
+
+  // First frame after animation_time, clamped so times outside the clip use the first or last pair of frames
+  unsigned int index = std::upper_bound(frame_times.begin(), frame_times.end(), animation_time) - frame_times.begin();
+  index = std::min(std::max(index, 1u), unsigned(frame_times.size()-1)) - 1;
+  float factor = glm::clamp((animation_time - frame_times[index]) / (frame_times[index+1] - frame_times[index]), 0.0f, 1.0f);
+  PoseBlending::blend(key_frames, index*channel_count, (index+1)*channel_count, channel_count, factor, pose);
+}
+
+int NodeAnimation::packed_channel_index(const std::string& node_name) const {
+  auto it = std::lower_bound(packed_channels.begin(), packed_channels.end(), node_name, [](NodeAnimationChannel* channel, const std::string& name) {return channel->name < name;});
+  return it != packed_channels.end() && (*it)->name == node_name ? int(it - packed_channels.begin()) : -1;
+}
@@ -9,6 +9,10 @@
 
 #include <vector>
 #include <unordered_map>
+#include <string>
+
+#include "LocalPose.h"
+#include "ClipCompression.h"
 
 struct VectorKey {
   float animation_time;
@@ -41,7 +45,14 @@ public:
 
   std::string name;
 
+  // Checks the key order (debug builds) and detects uniformly spaced keys so they can be indexed directly
   virtual void verify();
+  // Replaces the keys of unevenly spaced tracks with uniform keys at most `step` ticks apart, from the first to the last key,
+  // so lookups are O(1)
+  virtual void resample(float step);
+  // Length (ticks) of the loop the channel plays in. When positive, times past the last key interpolate towards the first key
+  // of the next loop instead of holding the last key. 0 holds the end values
+  void set_loop_duration(float duration) {loop_duration = duration;}
 
   virtual unsigned int find_position_index(float animation_time);
   virtual unsigned int find_rotation_index(float animation_time);
@@ -50,6 +61,11 @@ public:
   virtual glm::vec3 interpolate_position(float animation_time);
   virtual glm::quat interpolate_rotation(float animation_time);
   virtual glm::vec3 interpolate_scale(float animation_time);
+  // All three tracks at once without virtual dispatch, for NodeAnimation::pack
+  void sample(float animation_time, glm::vec3& position, glm::quat& rotation, glm::vec3& scale);
+  // Appends the time of every key of every track to times (unsorted, with duplicates)
+  void append_key_times(std::vector<float>& times) const;
+  size_t key_bytes() const;
 
   // TODO: Make these functions force the key to be inserted in proper chronological order
   virtual void add_position_key(VectorKey key) {position_keys.push_back(key);}
@@ -62,6 +78,18 @@ protected:
   std::vector<VectorKey> position_keys;
   std::vector<QuaternionKey> rotation_keys;
   std::vector<VectorKey> scale_keys;
+
+  // Key spacing of each track when it is uniform (0 otherwise), set by verify and resample
+  float position_spacing = 0.0f;
+  float rotation_spacing = 0.0f;
+  float scale_spacing = 0.0f;
+
+  float loop_duration = 0.0f;
+
+  // Segment found by the previous lookup; playback usually lands in the same or the next one
+  unsigned int position_cursor = 0;
+  unsigned int rotation_cursor = 0;
+  unsigned int scale_cursor = 0;
 };
 
 class NodeAnimation : public QObject {
@@ -79,6 +107,51 @@ public:
   unsigned int duration;
 
   std::unordered_map<std::string, NodeAnimationChannel*> animation_channels;
+
+  // Clips with more distinct key times than this are packed to this many evenly spaced frames instead (with a warning)
+  static constexpr unsigned int MAX_PACKED_FRAMES = 2048;
+
+  // When positive, pack compresses the key frames (see ClipCompression) with this tolerance
+  float compression_tolerance = 0.0f;
+
+  // Samples every channel at every key time of any channel (and at both ends of the loop) into one table of key frames so
+  // sample can evaluate the whole clip at once; the source keys are reproduced exactly. Called when the clip is loaded and
+  // must be called again after the channels change (not while the clip is being sampled)
+  void pack();
+  bool is_packed() const {return !frame_times.empty();}
+  // Every channel at animation_time (ticks), in the order of packed_channels. Only reads the packed frames, so it is
+  // safe to call from several threads at once
+  void sample(float animation_time, LocalPose& pose) const;
+  const std::vector<NodeAnimationChannel*>& get_packed_channels() const {return packed_channels;}
+  // Index of the node's channel in packed_channels, or -1
+  int packed_channel_index(const std::string& node_name) const;
+
+  // Memory and accuracy of the packed clip, for the Settings animation view
+  struct Packing_Statistics {
+    size_t key_bytes = 0; // The channels' keys
+    size_t uncompressed_bytes = 0; // The key frames
+    size_t packed_bytes = 0; // What sample uses (the compressed clip if compressed)
+    unsigned int frame_count = 0;
+    unsigned int kept_frame_count = 0;
+    ClipCompression::Error error; // What sample returns against the channels' keys, at every key time
+  };
+  bool is_compressed() const {return compressed;}
+  const Packing_Statistics& get_packing_statistics() const {return packing_statistics;}
+
+protected:
+  std::vector<NodeAnimationChannel*> packed_channels; // Sorted by name
+  // Every frame in one table: channel i of frame f (packed_channels[i] at frame_times[f]) is at f*packed_channels.size() + i
+  // Emptied when compressed
+  LocalPose key_frames;
+  std::vector<float> frame_times; // Ticks, ascending
+
+  bool compressed = false;
+  CompressedClip compressed_clip;
+  Packing_Statistics packing_statistics;
+
+  // Largest difference between sample and the channels' keys at key_times (which are inside the clip), so it includes
+  // both the frame cap and the compression
+  ClipCompression::Error measure_error(const std::vector<float>& key_times) const;
 };
 
 #endif
@@ -1,8 +1,10 @@
 #include <cmath>
 
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/matrix_decompose.hpp>
 
 #include "RootNode.h"
+#include "../../rendering/BonePalette.h"
 
 RootNode::RootNode(glm::mat4 transformation, glm::vec3 position, glm::vec3 scale, glm::vec3 rotation) : Node(transformation, position, scale, rotation) {
 }
@@ -13,10 +15,240 @@ RootNode::~RootNode() {
   }
 }
 
+namespace {
+  // Hands mutex to the RootNodes below node (which pass it on to theirs)
+  void share_simulation_mutex(Node* node, QMutex* mutex) {
+    for (auto& child : node->get_child_nodes()) {
+      RootNode* nested_root = qobject_cast<RootNode*>(child.get());
+      if (nested_root) {
+        nested_root->set_simulation_mutex(mutex);
+      } else {
+        share_simulation_mutex(child.get(), mutex);
+      }
+    }
+  }
+}
+
+void RootNode::set_simulation_mutex(QMutex* mutex) {
+  simulation_mutex = mutex;
+  share_simulation_mutex(this, mutex);
+}
+
 void RootNode::update() {
+  update_pose(clock);
+  publish_bones();
+}
+
+void RootNode::advance_clock(double time) {
+  if (!clock_started) {
+    // Whatever was started before the first pose started at the scene's current time
+    double shift = time - clock;
+    animation_start += shift;
+    fade_start += shift;
+    for (auto& layer : additive_layers) layer.start += shift;
+    clock_started = true;
+  }
+  clock = time;
+}
+
+void RootNode::update_pose(double time) {
+  advance_clock(time);
+  if (!skeleton_bound) bind_skeleton();
   root_inverse_model = inverse(get_model_matrix());
   if (armature_offsets.size() >= 1) {
-    update_armature(glm::mat4(1.0f), this, animation_status==Animation_Status::NO_ANIMATION ? nullptr : current_animation, get_animation_time());
+    NodeAnimation* playing = animation_status != Animation_Status::NO_ANIMATION ? current_animation : nullptr;
+    if (fade_from != nullptr || !additive_layers.empty()) {
+      evaluate_layers(playing, current_animation_time());
+    } else {
+      evaluate_skeleton(playing, current_animation_time());
+    }
+  }
+}
+
+void RootNode::publish_bones() {
+  if (armature_offsets.size() >= 1) {
+    bone_offset = BonePalette::add(armature_final_transforms);
+    for (auto nested_root : skeleton.nested_roots) {
+      nested_root->publish_bones();
+    }
+  }
+}
+
+void RootNode::append_bones(std::vector<glm::mat4>& palette, std::unordered_map<const RootNode*, unsigned int>& offsets) const {
+  if (armature_offsets.size() >= 1) {
+    offsets[this] = palette.size();
+    palette.insert(palette.end(), armature_final_transforms.begin(), armature_final_transforms.end());
+    for (auto nested_root : skeleton.nested_roots) {
+      nested_root->append_bones(palette, offsets);
+    }
+  }
+}
+
+void RootNode::sample_bones(NodeAnimation* animation, float animation_time, std::vector<glm::mat4>& bones) {
+  if (!skeleton_bound) bind_skeleton();
+
+  glm::mat4 root_model = get_model_matrix();
+  root_inverse_model = inverse(root_model);
+  std::vector<glm::mat4> posed_transforms;
+  posed_transforms.swap(armature_final_transforms);
+  armature_final_transforms.resize(armature_offsets.size());
+
+  evaluate_skeleton(animation, animation_time);
+
+  bones.resize(armature_final_transforms.size());
+  for (unsigned int i=0; i<bones.size(); i++) {
+    bones[i] = root_inverse_model * armature_final_transforms[i] * root_model;
+  }
+  armature_final_transforms.swap(posed_transforms);
+}
+
+void RootNode::bind_skeleton() {
+  skeleton = Skeleton();
+  flatten_skeleton(this, -1);
+  skeleton.global_transforms.resize(skeleton.nodes.size());
+
+  skeleton.rest_pose.resize(skeleton.nodes.size());
+  for (unsigned int i=0; i<skeleton.nodes.size(); i++) {
+    glm::vec3 scale, translation, skew;
+    glm::quat orientation;
+    glm::vec4 perspective;
+    glm::decompose(skeleton.nodes[i]->get_transformation(), scale, orientation, translation, skew, perspective);
+    skeleton.rest_pose.set(i, translation, orientation, scale);
+  }
+
+  animation_bindings.clear();
+  for (auto& it : animation) {
+    // Packed when loaded: bind_skeleton can run on several pool threads at once (from update_pose), which pack can't
+    Q_ASSERT_X(it.second->is_packed(), "Binding skeleton", "Animations must be packed when they are loaded");
+    std::vector<int>& channels = animation_bindings[it.second];
+    channels.resize(skeleton.nodes.size(), -1);
+    for (unsigned int i=0; i<skeleton.nodes.size(); i++) {
+      if (!skeleton.nodes[i]->get_animated()) continue;
+      channels[i] = it.second->packed_channel_index(skeleton.nodes[i]->name);
+      Q_ASSERT_X(channels[i] >= 0, "Binding skeleton", "Could not find requested animation channel");
+    }
+  }
+  skeleton_bound = true;
+}
+
+void RootNode::flatten_skeleton(Node* node, int parent) {
+  int index = skeleton.nodes.size();
+  skeleton.nodes.push_back(node);
+  skeleton.parents.push_back(parent);
+  skeleton.bone_ids.push_back(node->get_bone_id());
+
+  for (auto& child : node->get_child_nodes()) {
+    RootNode* nested_root = qobject_cast<RootNode*>(child.get());
+    if (nested_root) {
+      skeleton.nested_roots.push_back(nested_root);
+    } else {
+      flatten_skeleton(child.get(), index);
+    }
+  }
+}
+
+void RootNode::evaluate_skeleton(NodeAnimation* animation, float animation_time) {
+  const unsigned int count = skeleton.nodes.size();
+  glm::mat4* global_transforms = skeleton.global_transforms.data();
+
+  // Every channel of the clip in one pass, then each node picks its own
+  const int* channels = nullptr;
+  if (animation != nullptr) {
+    animation->sample(animation_time, clip_pose);
+    channels = bound_channels(animation).data();
+  }
+
+  for (unsigned int i=0; i<count; i++) {
+    Node* node = skeleton.nodes[i];
+    int channel = channels ? channels[i] : -1;
+    glm::mat4 local = channel >= 0 ? clip_pose.matrix(channel) * node->get_model_matrix(false) : node->get_model_matrix();
+
+    int parent = skeleton.parents[i];
+    global_transforms[i] = parent < 0 ? local : global_transforms[parent] * local;
+
+    int bone_id = skeleton.bone_ids[i];
+    if (bone_id >= 0) {
+      armature_final_transforms[bone_id] = global_transforms[i] * armature_offsets[bone_id] * root_inverse_model;
+    }
+  }
+
+  for (auto nested_root : skeleton.nested_roots) {
+    nested_root->update_pose(clock);
+  }
+}
+
+const std::vector<int>& RootNode::bound_channels(NodeAnimation* animation) {
+  auto it = animation_bindings.find(animation);
+  Q_ASSERT_X(it != animation_bindings.end(), "Binding animation", "Animation is not bound to the skeleton");
+  return it->second;
+}
+
+void RootNode::sample_local_pose(NodeAnimation* animation, float animation_time, LocalPose& pose) {
+  pose = skeleton.rest_pose;
+  if (animation == nullptr) return;
+
+  animation->sample(animation_time, clip_pose);
+  const std::vector<int>& channels = bound_channels(animation);
+  for (unsigned int i=0; i<skeleton.nodes.size(); i++) {
+    if (channels[i] >= 0) pose.copy(i, clip_pose, channels[i]);
+  }
+}
+
+void RootNode::evaluate_layers(NodeAnimation* animation, float animation_time) {
+  sample_local_pose(animation, animation_time, blend_pose);
+
+  if (fade_from != nullptr) {
+    float weight = fade_length > 0.0f ? float(clock - fade_start) / fade_length : 1.0f;
+    if (weight >= 1.0f) {
+      fade_from = nullptr;
+    } else {
+      float from_time = fade_from_time + float(clock - fade_start) * fade_from->tps;
+      if (fade_from->duration > 0) from_time = fmod(from_time, fade_from->duration);
+      sample_local_pose(fade_from, from_time, layer_pose);
+      PoseBlending::blend(layer_pose, blend_pose, weight, blend_pose);
+    }
+  }
+
+  for (auto& layer : additive_layers) {
+    float layer_time = float(clock - layer.start) * layer.animation->tps;
+    if (layer.animation->duration > 0) layer_time = fmod(layer_time, layer.animation->duration);
+    sample_local_pose(layer.animation, layer_time, layer_pose);
+    PoseBlending::add(blend_pose, layer_pose, layer.reference, layer.weight);
+  }
+
+  compose_skeleton(blend_pose);
+}
+
+void RootNode::evaluate_blend(NodeAnimation* from, float from_time, NodeAnimation* to, float to_time, float weight) {
+  QMutexLocker lock(simulation_mutex); // Shares the scratch poses with update_pose
+  if (!skeleton_bound) bind_skeleton();
+  if (armature_offsets.empty()) return;
+  root_inverse_model = inverse(get_model_matrix());
+
+  sample_local_pose(from, from_time, layer_pose);
+  sample_local_pose(to, to_time, blend_pose);
+  PoseBlending::blend(layer_pose, blend_pose, weight, blend_pose);
+  compose_skeleton(blend_pose);
+}
+
+void RootNode::compose_skeleton(const LocalPose& pose) {
+  const unsigned int count = skeleton.nodes.size();
+  glm::mat4* global_transforms = skeleton.global_transforms.data();
+
+  for (unsigned int i=0; i<count; i++) {
+    glm::mat4 local = pose.matrix(i) * skeleton.nodes[i]->get_model_matrix(false);
+
+    int parent = skeleton.parents[i];
+    global_transforms[i] = parent < 0 ? local : global_transforms[parent] * local;
+
+    int bone_id = skeleton.bone_ids[i];
+    if (bone_id >= 0) {
+      armature_final_transforms[bone_id] = global_transforms[i] * armature_offsets[bone_id] * root_inverse_model;
+    }
+  }
+
+  for (auto nested_root : skeleton.nested_roots) {
+    nested_root->update_pose(clock);
   }
 }
 
@@ -31,15 +263,17 @@ void RootNode::update_armature(glm::mat4 parent_transformation, RootNode* root_n
   }
 }
 
-void RootNode::draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, std::vector<Transparent_Draw>* partially_transparent_meshes, glm::mat4 model, int texture_unit) {
-  auto it = Shader::uniform_block_buffers.find("Armature");
-  Q_ASSERT_X(it != Shader::uniform_block_buffers.end(), "Setting armature UBO", "No UBO found");
-  Q_ASSERT_X(armature_final_transforms.size() <= 10, "Setting armature UBO", "Too many bones in armature");
-  glBindBuffer(GL_UNIFORM_BUFFER, it->second);
-  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4)*armature_final_transforms.size(), armature_final_transforms.data());
-  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+void RootNode::draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, std::vector<Transparent_Draw>* partially_transparent_meshes, glm::mat4 model) {
+  if (armature_offsets.empty()) {
+    Node::draw(shaders, draw_type, partially_transparent_meshes, model);
+    return;
+  }
 
-  Node::draw(shaders, draw_type, partially_transparent_meshes, model, texture_unit);
+  // Nested RootNodes point the meshes at their own bones, so the enclosing model's offset is restored afterwards
+  int parent_bone_offset = Mesh::bone_offset;
+  Mesh::bone_offset = bone_offset;
+  Node::draw(shaders, draw_type, partially_transparent_meshes, model);
+  Mesh::bone_offset = parent_bone_offset;
 }
 
 void RootNode::set_bone_final_transform(unsigned int bone_index, const glm::mat4& parent_transformation) {
@@ -47,6 +281,7 @@ void RootNode::set_bone_final_transform(unsigned int bone_index, const glm::mat4
 }
 
 void RootNode::set_current_animation(std::string new_animation_name) {
+  QMutexLocker lock(simulation_mutex);
   if (new_animation_name.empty()) {
     if (animation_status==NO_ANIMATION) {
       current_animation_name.clear();
@@ -63,39 +298,89 @@ void RootNode::set_current_animation(std::string new_animation_name) {
   time_offset=0;
 }
 
+void RootNode::crossfade_to(std::string new_animation_name, float fade_seconds) {
+  QMutexLocker lock(simulation_mutex);
+  fade_from = nullptr;
+  if (fade_seconds > 0.0f && animation_status != Animation_Status::NO_ANIMATION && current_animation != nullptr && new_animation_name != current_animation_name) {
+    if (!skeleton_bound) bind_skeleton();
+    fade_from = current_animation;
+    fade_from_time = current_animation_time();
+    fade_start = clock;
+    fade_length = fade_seconds;
+  }
+  set_current_animation(new_animation_name);
+  if (animation_status == Animation_Status::ANIMATED) animation_start = clock;
+}
+
+unsigned int RootNode::add_additive_layer(std::string animation_name, float weight) {
+  QMutexLocker lock(simulation_mutex);
+  auto it = animation.find(animation_name);
+  Q_ASSERT_X(it != animation.end(), "Adding additive layer", "Could not find specified animation in animations map");
+  if (!skeleton_bound) bind_skeleton();
+
+  Additive_Layer layer;
+  layer.animation = it->second;
+  layer.weight = weight;
+  layer.start = clock;
+  sample_local_pose(layer.animation, 0.0f, layer.reference);
+  additive_layers.push_back(std::move(layer));
+  return additive_layers.size() - 1;
+}
+
+void RootNode::set_additive_layer_weight(unsigned int index, float weight) {
+  QMutexLocker lock(simulation_mutex);
+  Q_ASSERT_X(index < additive_layers.size(), "set_additive_layer_weight", "index is greater than vector additive_layers' size");
+  additive_layers[index].weight = weight;
+}
+
+void RootNode::remove_additive_layer(unsigned int index) {
+  QMutexLocker lock(simulation_mutex);
+  Q_ASSERT_X(index < additive_layers.size(), "remove_additive_layer", "index is greater than vector additive_layers' size");
+  additive_layers.erase(additive_layers.begin() + index);
+}
+
 void RootNode::disable_animation() {
+  QMutexLocker lock(simulation_mutex);
   animation_status = Animation_Status::NO_ANIMATION;
   emit animation_status_changed(animation_status);
 }
 
 void RootNode::start_animation() {
+  QMutexLocker lock(simulation_mutex);
   Q_ASSERT_X(current_animation!=nullptr, "Start animation", "No current animation");
-  timer->start();
+  animation_start = clock;
   animation_status = Animation_Status::ANIMATED;
   emit animation_status_changed(animation_status);
 }
 
 void RootNode::stop_animation() {
+  QMutexLocker lock(simulation_mutex);
   if (animation_status == Animation_Status::ANIMATED) {
-    time_offset += timer->elapsed();
+    time_offset += int((clock - animation_start) * 1000.0);
     animation_status = Animation_Status::ANIMATION_PAUSED;
     emit animation_status_changed(animation_status);
   }
 }
 
 float RootNode::get_animation_time() {
-  if (animation_status == Animation_Status::NO_ANIMATION) {
+  QMutexLocker lock(simulation_mutex);
+  return current_animation_time();
+}
+
+float RootNode::current_animation_time() {
+  if (animation_status == Animation_Status::NO_ANIMATION || current_animation->duration == 0) {
     return 0.0f;
   }
-  int time = time_offset;
+  double time = time_offset / 1000.0;
   if (animation_status == Animation_Status::ANIMATED) {
-    time += timer->elapsed();
+    time += clock - animation_start;
   }
-  float animation_time = time / 1000.0f * current_animation->tps;
+  float animation_time = float(time * current_animation->tps);
   animation_time = fmod(animation_time, current_animation->duration);
   return animation_time;
 }
 
 void RootNode::set_animation_time(float animation_time) {
+  QMutexLocker lock(simulation_mutex);
   time_offset = animation_time * 1000.0f / current_animation->tps;
 }
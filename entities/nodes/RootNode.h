@@ -1,9 +1,10 @@
 #ifndef ROOT_NODE_H
 #define ROOT_NODE_H
 
-#include <QElapsedTimer>
+#include <QMutex>
 
 #include "Node.h"
+#include "LocalPose.h"
 
 class RootNode : public Node {
   Q_OBJECT;
@@ -19,9 +20,29 @@ public:
   RootNode(glm::mat4 transformation=glm::mat4(1.0f), glm::vec3 position=glm::vec3(0.0f), glm::vec3 scale=glm::vec3(1.0f), glm::vec3 rotation=glm::vec3(0.0f));
   virtual ~RootNode();
 
-  virtual void update();
+  // The mutex held while this RootNode is posed on the simulation thread (Scene::add_node passes its own; nested RootNodes get
+  // it too). The animation mutators below take it so they can be called from the GUI thread
+  void set_simulation_mutex(QMutex* mutex);
+
+  virtual void update(); // update_pose at the current clock time followed by publish_bones
+  // Poses the armature at time (seconds on the scene's clock: the Simulation step's time, or the renderer's clock without the
+  // simulation thread). The animation, crossfade and additive layers advance by however much time moved since the last pose
+  // Only touches this RootNode's hierarchy (nested RootNodes included), so different RootNodes can be posed on different
+  // threads, even when they share NodeAnimations (sampling a packed clip doesn't change it)
+  virtual void update_pose(double time);
+  // Appends the posed bones (and those of nested RootNodes) to this frame's BonePalette. Not thread safe
+  virtual void publish_bones();
+  // Same for a palette built away from the render thread; offsets receives where each RootNode's bones start
+  virtual void append_bones(std::vector<glm::mat4>& palette, std::unordered_map<const RootNode*, unsigned int>& offsets) const;
+  void set_bone_offset(unsigned int offset) {bone_offset = offset;}
+  // Poses the armature at animation_time of animation (nullptr for the rest pose) into bones, each relative to this RootNode
+  // (so world = model matrix * bone * mesh node relative to this RootNode). The pose used for drawing is left alone
+  virtual void sample_bones(NodeAnimation* animation, float animation_time, std::vector<glm::mat4>& bones);
+  // Flattens the node hierarchy and resolves every animation's channels to it so update() needs no name lookups
+  // Called by update() the first time; call it again after changing the hierarchy or the animations
+  virtual void bind_skeleton();
   virtual void update_armature(glm::mat4 parent_transformation, RootNode* root_node, NodeAnimation* animation, float animation_time) override;
-  virtual void draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, std::vector<Transparent_Draw>* partially_transparent_meshes=nullptr, glm::mat4 model=glm::mat4(1.0f), int texture_unit=0) override;
+  virtual void draw(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, std::vector<Transparent_Draw>* partially_transparent_meshes=nullptr, glm::mat4 model=glm::mat4(1.0f)) override;
 
   virtual const std::vector<glm::mat4>& get_armature_offsets() {return armature_offsets;}
   virtual const std::vector<glm::mat4>& get_armature_final_transforms() {return armature_final_transforms;}
@@ -32,6 +53,22 @@ public:
   virtual std::string get_current_animation_name() {return current_animation_name;}
   virtual NodeAnimation* get_current_animation() {return current_animation;}
 
+  // Switches to new_animation_name, which starts from its beginning while the old animation keeps playing and fades out over
+  // fade_seconds. Without a playing animation (or with a fade of 0) this is the same hard cut as set_current_animation
+  virtual void crossfade_to(std::string new_animation_name, float fade_seconds);
+  bool is_crossfading() const {return fade_from != nullptr;}
+
+  // Additive layers add their animation's difference from its first frame, scaled by weight, on top of the current animation
+  // Each one loops on its own clock from when it was added. Returns the layer's index
+  // Like crossfade_to these take the simulation mutex, since evaluate_layers walks the layers on the simulation thread
+  virtual unsigned int add_additive_layer(std::string animation_name, float weight=1.0f);
+  virtual void set_additive_layer_weight(unsigned int index, float weight);
+  virtual void remove_additive_layer(unsigned int index);
+  unsigned int additive_layer_count() const {return additive_layers.size();}
+
+  // Poses the armature as the crossfade from `from` at from_time to `to` at to_time (in ticks) by weight
+  virtual void evaluate_blend(NodeAnimation* from, float from_time, NodeAnimation* to, float to_time, float weight);
+
   // Note that time and animation time are different
   virtual void disable_animation();
   virtual void start_animation(); // Starts/resumes the animation
@@ -49,16 +86,67 @@ protected:
   // Armature exsts so the all bone matrices for this node tree can be sent to a shader
   std::vector<glm::mat4> armature_offsets;
   std::vector<glm::mat4> armature_final_transforms;
+  unsigned int bone_offset = 0; // Where armature_final_transforms went in this frame's BonePalette
 
   std::unordered_map<std::string, NodeAnimation*> animation;
 
   glm::mat4 root_inverse_model;
 
+  // The hierarchy below this RootNode in pre-order, so every parent comes before its children
+  struct Skeleton {
+    std::vector<Node*> nodes;
+    std::vector<int> parents; // Index into nodes; -1 for this RootNode
+    std::vector<int> bone_ids;
+    std::vector<RootNode*> nested_roots; // RootNodes inside the hierarchy set their own armature and are not descended into
+    std::vector<glm::mat4> global_transforms; // Scratch space for evaluation
+    LocalPose rest_pose; // Decomposed transformation of every node, for the nodes an animation doesn't move
+  } skeleton;
+  // Packed channel (see NodeAnimation::pack) for each skeleton node (-1 if the node isn't animated by that animation)
+  std::unordered_map<NodeAnimation*, std::vector<int>> animation_bindings;
+  bool skeleton_bound = false;
+
+  // get_animation_time without the simulation mutex, for update_pose: it already runs under the mutex, possibly on a pool
+  // thread while the simulation thread holds it
+  float current_animation_time();
+
+  void flatten_skeleton(Node* node, int parent);
+  void evaluate_skeleton(NodeAnimation* animation, float animation_time); // nullptr for the rest pose
+
+  // Blended evaluation, used instead of evaluate_skeleton while crossfading or with additive layers
+  const std::vector<int>& bound_channels(NodeAnimation* animation);
+  void sample_local_pose(NodeAnimation* animation, float animation_time, LocalPose& pose);
+  void evaluate_layers(NodeAnimation* animation, float animation_time);
+  void compose_skeleton(const LocalPose& pose);
+
+  struct Additive_Layer {
+    NodeAnimation* animation;
+    float weight;
+    double start; // On clock
+    LocalPose reference; // The animation's first frame
+  };
+  std::vector<Additive_Layer> additive_layers;
+
+  NodeAnimation* fade_from = nullptr; // Animation being faded out
+  float fade_from_time = 0.0f; // Ticks into fade_from when the crossfade started
+  double fade_start = 0.0; // On clock
+  float fade_length = 0.0f; // Seconds
+
+  // The time of the last update_pose (seconds). Animations, crossfades and additive layers are timed on it, so a pose only
+  // depends on the time it was asked for. Crossfades and layers don't pause with the animation
+  double clock = 0.0;
+  bool clock_started = false; // Until the first update_pose, clock is 0 rather than the scene's time
+  void advance_clock(double time);
+  LocalPose blend_pose; // Scratch poses for evaluate_layers
+  LocalPose layer_pose;
+  LocalPose clip_pose; // Every channel of the clip being sampled, in NodeAnimation::get_packed_channels order
+
   Animation_Status animation_status = NO_ANIMATION;
   NodeAnimation* current_animation = nullptr;
   std::string current_animation_name = "";
-  QElapsedTimer* timer = new QElapsedTimer();
-  int time_offset;
+  double animation_start = 0.0; // On clock, when the animation was last started
+  int time_offset; // ms
+
+  QMutex* simulation_mutex = nullptr; // Not owned; nullptr until the node is added to a Scene
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include <QApplication>
 #include <QSurfaceFormat>
 #include "MainWindow.h"
+#include "utility/FramePacer.h"
 
 int main(int argc, char *argv[]) {
   QApplication app(argc, argv);
@@ -9,9 +10,12 @@ int main(int argc, char *argv[]) {
   format.setProfile(QSurfaceFormat::CoreProfile);
   format.setVersion(4, 5);
   format.setOption(QSurfaceFormat::DebugContext);
+
+  FramePacer frame_pacer = FramePacer::from_arguments(app.arguments());
+  format.setSwapInterval(frame_pacer.swap_interval());
   QSurfaceFormat::setDefaultFormat(format);
 
-  MainWindow window;
+  MainWindow window(frame_pacer);
 
   return app.exec();
 }
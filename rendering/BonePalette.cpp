@@ -0,0 +1,55 @@
+#include <QOpenGLContext>
+
+#include <algorithm>
+
+#include "BonePalette.h"
+#include "../utility/CpuProfiler.h"
+
+bool BonePalette::dirty = false;
+unsigned int BonePalette::current_generation = 1;
+unsigned int BonePalette::ssbo = 0;
+size_t BonePalette::capacity = 0;
+std::vector<glm::mat4> BonePalette::matrices;
+
+void BonePalette::initialize() {
+  QOpenGLFunctions_4_5_Core* gl_functions = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_5_Core>();
+  Q_ASSERT_X(gl_functions, "BonePalette::initialize", "Could not get GL functions");
+
+  // Starts with one identity matrix so the binding is never empty
+  capacity = 1;
+  glm::mat4 identity(1.0f);
+  gl_functions->glCreateBuffers(1, &ssbo);
+  gl_functions->glNamedBufferData(ssbo, sizeof(glm::mat4), &identity, GL_STREAM_DRAW);
+  gl_functions->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING, ssbo);
+}
+
+void BonePalette::clear() {
+  matrices.clear();
+  dirty = true;
+  current_generation++;
+}
+
+unsigned int BonePalette::add(const std::vector<glm::mat4>& new_matrices) {
+  unsigned int offset = matrices.size();
+  matrices.insert(matrices.end(), new_matrices.begin(), new_matrices.end());
+  dirty = true;
+  return offset;
+}
+
+void BonePalette::update() {
+  if (!dirty || matrices.empty()) return;
+  dirty = false;
+  PROFILE_ZONE("BonePalette::update");
+
+  QOpenGLFunctions_4_5_Core* gl_functions = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_5_Core>();
+
+  if (matrices.size() > capacity) {
+    // Grows geometrically so adding a model doesn't reallocate every frame
+    capacity = std::max(matrices.size(), capacity*2);
+    gl_functions->glNamedBufferData(ssbo, capacity*sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+  } else {
+    // Orphans last frame's storage so the upload doesn't wait for draws still reading it
+    gl_functions->glInvalidateBufferData(ssbo);
+  }
+  gl_functions->glNamedBufferSubData(ssbo, 0, matrices.size()*sizeof(glm::mat4), matrices.data());
+}
@@ -0,0 +1,39 @@
+#ifndef BONE_PALETTE_H
+#define BONE_PALETTE_H
+
+#include <QOpenGLFunctions_4_5_Core>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// The bone matrices of every skinned RootNode for the current frame, packed one after another into a shader storage buffer (binding 2)
+// Each RootNode appends its armature while updating and draws with the returned offset (Mesh::bone_offset), so the whole
+// palette is uploaded once per frame however many passes and models use it
+class BonePalette {
+public:
+  static constexpr unsigned int BINDING = 2; // Shader storage buffer binding point (see bone_palette.glsl)
+
+  // Must be called with a current context before anything is drawn
+  static void initialize();
+
+  // Starts a new frame's palette; offsets returned before this are no longer valid
+  static void clear();
+  // Appends the matrices and returns the index of the first one
+  static unsigned int add(const std::vector<glm::mat4>& matrices);
+  static unsigned int size() {return matrices.size();}
+  // Changes whenever the palette is rebuilt, so results computed from it (pre-skinned meshes) know when they are stale
+  static unsigned int generation() {return current_generation;}
+
+  // Uploads the palette if anything was added since the last upload
+  static void update();
+
+protected:
+  static bool dirty;
+  static unsigned int current_generation;
+  static unsigned int ssbo;
+  static size_t capacity; // In matrices
+  static std::vector<glm::mat4> matrices;
+};
+
+#endif
@@ -26,7 +26,7 @@ Camera::Camera(glm::vec3 position, float yaw, float pitch) :
 
 Camera::~Camera() {}
 
-void Camera::initialize_camera(const std::unordered_set<int>* keys_pressed, const QPoint* mouse_movement, const int* delta_time) {
+void Camera::initialize_camera(const std::unordered_set<int>* keys_pressed, const QPoint* mouse_movement, const float* delta_time) {
   this->keys_pressed = keys_pressed;
   this->mouse_movement = mouse_movement;
   this->delta_time = delta_time;
@@ -116,6 +116,18 @@ void Camera::update_position() {
   position += velocity / (glm::log((*delta_time)*100.0f) / glm::log(10.0f)) * 50.0f;
 }
 
+void Camera::look_at(glm::vec3 new_position, glm::vec3 target) {
+  position = new_position;
+  velocity = glm::vec3(0.0f);
+
+  glm::vec3 direction = target - new_position;
+  yaw = glm::degrees(atan2(direction.x, direction.z));
+  pitch = glm::degrees(atan2(direction.y, glm::length(glm::vec2(direction.x, direction.z))));
+  if (pitch > 89.0f) pitch = 89.0f;
+  else if (pitch < -89.0f) pitch = -89.0f;
+  update_vectors();
+}
+
 glm::mat4 Camera::view_matrix() {
   return glm::lookAt(position, position+front, up);
 }
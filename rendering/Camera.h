@@ -14,9 +14,11 @@ public:
   Camera(glm::vec3 position=glm::vec3(0.0f,0.0f,-3.0f), float yaw=0, float pitch=0);
   ~Camera();
 
-  void initialize_camera(const std::unordered_set<int>* keys_pressed, const QPoint* mouse_movement, const int* delta_time);
+  void initialize_camera(const std::unordered_set<int>* keys_pressed, const QPoint* mouse_movement, const float* delta_time);
 
   void update_cam();
+  // Moves the camera to position and turns it towards target (pitch is clamped like mouse look) and stops it
+  void look_at(glm::vec3 new_position, glm::vec3 target);
 
   glm::mat4 view_matrix();
 
@@ -51,7 +53,7 @@ protected:
 
   const std::unordered_set<int>* keys_pressed;
   const QPoint* mouse_movement;
-  const int* delta_time;
+  const float* delta_time;
 };
 
 #endif
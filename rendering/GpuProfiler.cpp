@@ -0,0 +1,155 @@
+#include <QOpenGLContext>
+#include <QSaveFile>
+#include <QTextStream>
+
+#include "GpuProfiler.h"
+
+bool GpuProfiler::initialized = false;
+unsigned int GpuProfiler::queries[BUFFERS][PASS_COUNT];
+bool GpuProfiler::issued[BUFFERS][PASS_COUNT];
+unsigned int GpuProfiler::current_set = 0;
+int GpuProfiler::active_pass = -1;
+std::vector<GpuProfiler::Frame_Times> GpuProfiler::history;
+unsigned int GpuProfiler::history_next = 0;
+unsigned long long GpuProfiler::collected = 0;
+GpuProfiler::Frame_Times GpuProfiler::latest_times;
+
+void GpuProfiler::initialize() {
+  QOpenGLFunctions_4_5_Core* gl_functions = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_5_Core>();
+  Q_ASSERT_X(gl_functions, "GpuProfiler::initialize", "Could not get GL functions");
+
+  for (unsigned int set=0; set<BUFFERS; set++) {
+    gl_functions->glGenQueries(PASS_COUNT, queries[set]);
+    for (unsigned int pass=0; pass<PASS_COUNT; pass++) issued[set][pass] = false;
+  }
+  history.clear();
+  history_next = 0;
+  collected = 0;
+  latest_times.fill(-1.0f);
+  initialized = true;
+}
+
+void GpuProfiler::begin_frame() {
+  if (!initialized) return;
+  Q_ASSERT_X(active_pass < 0, "GpuProfiler::begin_frame", "A pass was not ended");
+  QOpenGLFunctions_4_5_Core* gl_functions = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_5_Core>();
+
+  current_set = (current_set + 1) % BUFFERS;
+
+  bool any_issued = false;
+  Frame_Times times;
+  for (unsigned int pass=0; pass<PASS_COUNT; pass++) {
+    times[pass] = -1.0f;
+    if (!issued[current_set][pass]) continue;
+    issued[current_set][pass] = false;
+    any_issued = true;
+
+    GLint available = 0;
+    gl_functions->glGetQueryObjectiv(queries[current_set][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint64 elapsed = 0;
+      gl_functions->glGetQueryObjectui64v(queries[current_set][pass], GL_QUERY_RESULT, &elapsed);
+      times[pass] = elapsed / 1e6f;
+    }
+  }
+  if (!any_issued) return;
+  latest_times = times;
+  collected++;
+
+  if (history.size() < HISTORY) {
+    history.push_back(times);
+  } else {
+    history[history_next] = times;
+  }
+  history_next = (history_next + 1) % HISTORY;
+}
+
+void GpuProfiler::begin(Pass pass) {
+  if (!initialized) return;
+  Q_ASSERT_X(active_pass < 0, "GpuProfiler::begin", "Passes can't nest");
+  QOpenGLFunctions_4_5_Core* gl_functions = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_5_Core>();
+
+  unsigned int index = static_cast<unsigned int>(pass);
+  gl_functions->glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, index, -1, pass_name(pass));
+  gl_functions->glBeginQuery(GL_TIME_ELAPSED, queries[current_set][index]);
+  issued[current_set][index] = true;
+  active_pass = index;
+}
+
+void GpuProfiler::end() {
+  if (!initialized) return;
+  Q_ASSERT_X(active_pass >= 0, "GpuProfiler::end", "No pass was begun");
+  QOpenGLFunctions_4_5_Core* gl_functions = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_5_Core>();
+
+  gl_functions->glEndQuery(GL_TIME_ELAPSED);
+  gl_functions->glPopDebugGroup();
+  active_pass = -1;
+}
+
+const char* GpuProfiler::pass_name(Pass pass) {
+  switch (pass) {
+    case Pass::DIRLIGHT_SHADOWS: return "dirlight shadows";
+    case Pass::POINTLIGHT_SHADOWS: return "pointlight shadows";
+    case Pass::SKYBOX: return "skybox";
+    case Pass::OPAQUE_OBJECTS: return "opaque";
+    case Pass::TRANSPARENT_OBJECTS: return "transparent";
+    case Pass::COMPOSITE: return "composite";
+    case Pass::BLUR: return "blur";
+    case Pass::POST_PROCESSING: return "post processing";
+    case Pass::FXAA: return "fxaa";
+    default: return "unknown";
+  }
+}
+
+float GpuProfiler::average_ms(Pass pass) {
+  unsigned int index = static_cast<unsigned int>(pass);
+  double total = 0.0;
+  unsigned int count = 0;
+  for (auto& times : history) {
+    if (times[index] >= 0.0f) {
+      total += times[index];
+      count++;
+    }
+  }
+  return count > 0 ? total / count : -1.0f;
+}
+
+QString GpuProfiler::overlay_text() {
+  QString text("GPU:");
+  float total = 0.0f;
+  for (unsigned int pass=0; pass<PASS_COUNT; pass++) {
+    float average = average_ms(Pass(pass));
+    if (average < 0.0f) continue;
+    total += average;
+    text += QString("\n  ") + pass_name(Pass(pass)) + QString(": ") + QString::number(average, 'f', 3) + QString("ms");
+  }
+  return text + QString("\n  total: ") + QString::number(total, 'f', 3) + QString("ms");
+}
+
+bool GpuProfiler::export_csv(const QString& path) {
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+
+  QTextStream out(&file);
+  out << "frame";
+  for (unsigned int pass=0; pass<PASS_COUNT; pass++) out << ',' << QString(pass_name(Pass(pass))).replace(' ', '_');
+  out << ",total\n";
+
+  // Oldest first; passes that didn't run are left empty
+  unsigned int start = history.size() < HISTORY ? 0 : history_next;
+  for (unsigned int i=0; i<history.size(); i++) {
+    const Frame_Times& times = history[(start + i) % history.size()];
+    float total = 0.0f;
+    out << i;
+    for (unsigned int pass=0; pass<PASS_COUNT; pass++) {
+      out << ',';
+      if (times[pass] >= 0.0f) {
+        out << QString::number(times[pass], 'f', 4);
+        total += times[pass];
+      }
+    }
+    out << ',' << QString::number(total, 'f', 4) << '\n';
+  }
+  out.flush();
+  return file.commit();
+}
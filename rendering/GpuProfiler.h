@@ -0,0 +1,68 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <QOpenGLFunctions_4_5_Core>
+#include <QString>
+
+#include <array>
+#include <vector>
+
+// GPU time of each render pass, measured with GL_TIME_ELAPSED queries
+// Frames alternate between BUFFERS sets of queries and a set is only read back just before it is reused, when the GPU has
+// long finished with it, so reading never stalls the pipeline (results that still aren't available are skipped)
+// Every pass is also a KHR_debug group so it shows up by name in frame debuggers
+class GpuProfiler {
+public:
+  enum class Pass {
+    DIRLIGHT_SHADOWS,
+    POINTLIGHT_SHADOWS,
+    SKYBOX, // And the light gizmos
+    OPAQUE_OBJECTS, // Opaque and fully transparent (alpha tested) meshes
+    TRANSPARENT_OBJECTS, // Sorted partially transparent meshes
+    COMPOSITE, // Scene composite and volumetrics
+    BLUR,
+    POST_PROCESSING,
+    FXAA,
+    COUNT
+  };
+  static constexpr unsigned int PASS_COUNT = static_cast<unsigned int>(Pass::COUNT);
+  static constexpr unsigned int BUFFERS = 2;
+  static constexpr unsigned int HISTORY = 300; // Frames kept for the averages and the CSV export
+
+  typedef std::array<float, PASS_COUNT> Frame_Times; // ms; negative if the pass didn't run that frame
+
+  // Must be called with a current context before the first frame
+  static void initialize();
+
+  // Collects the results of the query set this frame reuses. Call at the start of every frame
+  static void begin_frame();
+  // Passes can't nest (GL_TIME_ELAPSED queries can't overlap)
+  static void begin(Pass pass);
+  static void end();
+
+  // Frames whose results have been collected so far; the nth collected frame is the nth frame timed since initialize
+  static unsigned long long frames_collected() {return collected;}
+  // The times of the most recently collected frame
+  static const Frame_Times& latest() {return latest_times;}
+
+  static const char* pass_name(Pass pass);
+  // Mean over the history of the frames the pass ran in
+  static float average_ms(Pass pass);
+  // One line per pass that ran recently, plus the total, for the F3 overlay
+  static QString overlay_text();
+  // Every frame in the history, oldest first, one column per pass. Returns false if the file couldn't be written
+  static bool export_csv(const QString& path);
+
+protected:
+  static bool initialized;
+  static unsigned int queries[BUFFERS][PASS_COUNT];
+  static bool issued[BUFFERS][PASS_COUNT]; // Whether the query was used in the frame that last used the set
+  static unsigned int current_set;
+  static int active_pass; // -1 when no pass is being timed
+  static std::vector<Frame_Times> history; // Ring buffer
+  static unsigned int history_next;
+  static unsigned long long collected;
+  static Frame_Times latest_times;
+};
+
+#endif
@@ -0,0 +1,308 @@
+#include <QOpenGLContext>
+#include <QDebug>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include "MaterialBuffer.h"
+#include "../utility/CpuProfiler.h"
+#include "../entities/meshes/Material.h"
+
+// Bit flags of Material::used_maps (see material_buffer.glsl)
+enum Used_Maps : unsigned int {
+  USE_ALBEDO_MAP =            1u << 0,
+  USE_AMBIENT_OCCLUSION_MAP = 1u << 1,
+  USE_ROUGHNESS_MAP =         1u << 2,
+  USE_METALNESS_MAP =         1u << 3,
+  USE_OPACITY_MAP =           1u << 4
+};
+
+typedef GLuint64 (QOPENGLF_APIENTRYP get_texture_handle_function)(GLuint texture);
+typedef void (QOPENGLF_APIENTRYP make_texture_handle_resident_function)(GLuint64 handle);
+
+static get_texture_handle_function glGetTextureHandleARB = nullptr;
+static make_texture_handle_resident_function glMakeTextureHandleResidentARB = nullptr;
+static make_texture_handle_resident_function glMakeTextureHandleNonResidentARB = nullptr;
+
+bool MaterialBuffer::bindless = false;
+bool MaterialBuffer::dirty = false;
+unsigned int MaterialBuffer::ssbo = 0;
+std::vector<Material*> MaterialBuffer::materials;
+std::unordered_set<Material*> MaterialBuffer::changed_materials;
+std::vector<unsigned int> MaterialBuffer::texture_arrays;
+std::unordered_map<unsigned int, glm::uvec2> MaterialBuffer::texture_references;
+std::unordered_map<unsigned int, MaterialBuffer::Texture_Layout> MaterialBuffer::texture_layouts;
+
+void MaterialBuffer::initialize() {
+  QOpenGLContext* context = QOpenGLContext::currentContext();
+  QOpenGLFunctions_4_5_Core* gl_functions = context->versionFunctions<QOpenGLFunctions_4_5_Core>();
+  Q_ASSERT_X(gl_functions, "MaterialBuffer::initialize", "Could not get GL functions");
+
+  if (context->hasExtension("GL_ARB_bindless_texture")) {
+    glGetTextureHandleARB = reinterpret_cast<get_texture_handle_function>(context->getProcAddress("glGetTextureHandleARB"));
+    glMakeTextureHandleResidentARB = reinterpret_cast<make_texture_handle_resident_function>(context->getProcAddress("glMakeTextureHandleResidentARB"));
+    glMakeTextureHandleNonResidentARB = reinterpret_cast<make_texture_handle_resident_function>(context->getProcAddress("glMakeTextureHandleNonResidentARB"));
+    bindless = glGetTextureHandleARB && glMakeTextureHandleResidentARB && glMakeTextureHandleNonResidentARB;
+  }
+  qDebug() << "Material textures use" << (bindless ? "bindless textures" : "texture arrays");
+
+  if (bindless) {
+    Shader::global_preamble = "#extension GL_ARB_bindless_texture : require\n#define BINDLESS_TEXTURES 1\n";
+  }
+
+  gl_functions->glGenBuffers(1, &ssbo);
+  gl_functions->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING, ssbo);
+  dirty = true;
+}
+
+void MaterialBuffer::initialize_shader(Shader* shader) {
+  if (bindless) return;
+
+  shader->use();
+  for (int i=0; i<MAX_TEXTURE_ARRAYS; i++) {
+    shader->setInt(("material_texture_arrays["+std::to_string(i)+"]").c_str(), FIRST_TEXTURE_ARRAY_UNIT+i);
+  }
+}
+
+void MaterialBuffer::add(Material* material) {
+  material->index = materials.size();
+  materials.push_back(material);
+  dirty = true;
+}
+
+void MaterialBuffer::remove(Material* material) {
+  auto it = std::find(materials.begin(), materials.end(), material);
+  if (it == materials.end()) return;
+
+  materials.erase(it);
+  changed_materials.erase(material);
+  for (unsigned int i=0; i<materials.size(); i++) {
+    materials[i]->index = i;
+  }
+  material->index = -1;
+  dirty = true;
+}
+
+void MaterialBuffer::set_changed(Material* material) {
+  if (material->index >= 0) {
+    changed_materials.insert(material);
+  }
+}
+
+glm::uvec2 MaterialBuffer::texture_reference(unsigned int texture_id) {
+  auto it = texture_references.find(texture_id);
+  if (it != texture_references.end()) return it->second;
+
+  Q_ASSERT_X(bindless, "MaterialBuffer::texture_reference", "texture was not copied into a texture array");
+  GLuint64 handle = glGetTextureHandleARB(texture_id);
+  glMakeTextureHandleResidentARB(handle);
+
+  glm::uvec2 reference(handle & 0xFFFFFFFFu, handle >> 32);
+  texture_references[texture_id] = reference;
+  return reference;
+}
+
+void MaterialBuffer::texture_released(unsigned int texture_id) {
+  auto it = texture_references.find(texture_id);
+  if (it == texture_references.end()) return;
+
+  if (bindless) {
+    glMakeTextureHandleNonResidentARB(GLuint64(it->second.x) | (GLuint64(it->second.y) << 32));
+  } else {
+    texture_layouts.erase(texture_id);
+    dirty = true; // Frees its layer
+  }
+  texture_references.erase(it);
+}
+
+void MaterialBuffer::build_texture_arrays(QOpenGLFunctions_4_5_Core* gl_functions) {
+  // Textures that are already in an array only exist there, so the new arrays are filled from the old ones
+  std::vector<unsigned int> old_arrays;
+  std::unordered_map<unsigned int, glm::uvec2> old_references;
+  old_arrays.swap(texture_arrays);
+  old_references.swap(texture_references);
+
+  std::map<Texture_Layout, std::vector<unsigned int>> layouts;
+  std::unordered_set<unsigned int> queued;
+  for (auto material : materials) {
+    std::vector<unsigned int> ids;
+    for (auto& texture : material->textures) ids.push_back(texture.id);
+    ids.push_back(material->opacity_map.id);
+
+    for (auto id : ids) {
+      if (id == 0 || !queued.insert(id).second) continue;
+
+      auto layout = texture_layouts.find(id);
+      if (layout == texture_layouts.end()) {
+        int format, width, height, wrap, levels = 1;
+        gl_functions->glGetTextureLevelParameteriv(id, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+        gl_functions->glGetTextureLevelParameteriv(id, 0, GL_TEXTURE_WIDTH, &width);
+        gl_functions->glGetTextureLevelParameteriv(id, 0, GL_TEXTURE_HEIGHT, &height);
+        gl_functions->glGetTextureParameteriv(id, GL_TEXTURE_WRAP_S, &wrap);
+        for (int level_width=1; levels < 32; levels++) {
+          gl_functions->glGetTextureLevelParameteriv(id, levels, GL_TEXTURE_WIDTH, &level_width);
+          if (level_width == 0) break;
+        }
+        layout = texture_layouts.emplace(id, Texture_Layout(format, width, height, levels, wrap)).first;
+      }
+      layouts[layout->second].push_back(id);
+    }
+  }
+
+  // Layouts with textures that only exist in the old arrays come first so they always get an array again. Textures of the
+  // layouts that don't fit keep their own storage (and are treated as missing) so a later rebuild can still pick them up
+  std::vector<std::pair<Texture_Layout, std::vector<unsigned int>>> ordered_layouts(layouts.begin(), layouts.end());
+  auto in_old_arrays = [&old_references](const std::pair<Texture_Layout, std::vector<unsigned int>>& layout) {
+    for (auto id : layout.second) {
+      if (old_references.count(id)) return true;
+    }
+    return false;
+  };
+  auto first_new_layout = std::stable_partition(ordered_layouts.begin(), ordered_layouts.end(), in_old_arrays);
+
+  if (first_new_layout - ordered_layouts.begin() > MAX_TEXTURE_ARRAYS) {
+    // Can't happen (each old array holds one layout) but dropping one would lose its textures, so keep the old arrays
+    qCritical() << "Material texture arrays could not be rebuilt: the textures already in arrays need"
+                << first_new_layout - ordered_layouts.begin() << "of them";
+    texture_arrays.swap(old_arrays);
+    texture_references.swap(old_references);
+    return;
+  }
+  if (ordered_layouts.size() > MAX_TEXTURE_ARRAYS) {
+    qCritical() << "Material textures need" << ordered_layouts.size() << "texture arrays but only" << MAX_TEXTURE_ARRAYS
+                << "are available; the textures of" << ordered_layouts.size() - MAX_TEXTURE_ARRAYS << "layouts will be missing";
+    ordered_layouts.resize(MAX_TEXTURE_ARRAYS);
+  }
+
+  for (auto& layout : ordered_layouts) {
+    int format, width, height, levels, wrap;
+    std::tie(format, width, height, levels, wrap) = layout.first;
+    const std::vector<unsigned int>& ids = layout.second;
+
+    unsigned int array;
+    gl_functions->glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &array);
+    gl_functions->glTextureStorage3D(array, levels, format, width, height, ids.size());
+    gl_functions->glTextureParameteri(array, GL_TEXTURE_WRAP_S, wrap);
+    gl_functions->glTextureParameteri(array, GL_TEXTURE_WRAP_T, wrap);
+    gl_functions->glTextureParameteri(array, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    gl_functions->glTextureParameteri(array, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    for (unsigned int layer=0; layer<ids.size(); layer++) {
+      auto old_reference = old_references.find(ids[layer]);
+      bool from_array = old_reference != old_references.end();
+      for (int level=0; level<levels; level++) {
+        if (from_array) {
+          gl_functions->glCopyImageSubData(
+            old_arrays[old_reference->second.x], GL_TEXTURE_2D_ARRAY, level, 0, 0, old_reference->second.y,
+            array, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+            std::max(1, width >> level), std::max(1, height >> level), 1
+          );
+        } else {
+          gl_functions->glCopyImageSubData(
+            ids[layer], GL_TEXTURE_2D, level, 0, 0, 0,
+            array, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+            std::max(1, width >> level), std::max(1, height >> level), 1
+          );
+        }
+      }
+      if (!from_array) release_storage(ids[layer], levels, gl_functions);
+      texture_references[ids[layer]] = glm::uvec2(texture_arrays.size(), layer);
+    }
+
+    gl_functions->glBindTextureUnit(FIRST_TEXTURE_ARRAY_UNIT+texture_arrays.size(), array);
+    texture_arrays.push_back(array);
+  }
+
+  gl_functions->glDeleteTextures(old_arrays.size(), old_arrays.data());
+}
+
+void MaterialBuffer::release_storage(unsigned int texture_id, int levels, QOpenGLFunctions_4_5_Core* gl_functions) {
+  // The id stays valid (the registry and the materials still refer to it) but every level is respecified as empty
+  int previous_binding;
+  gl_functions->glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_binding);
+  gl_functions->glBindTexture(GL_TEXTURE_2D, texture_id);
+  for (int level=0; level<levels; level++) {
+    gl_functions->glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  }
+  gl_functions->glBindTexture(GL_TEXTURE_2D, previous_binding);
+}
+
+MaterialBuffer::GpuMaterial MaterialBuffer::make_record(Material* material) {
+  GpuMaterial record{};
+  record.color = material->color;
+  record.opacity = material->opacity;
+  record.ambient = material->ambient;
+  record.diffuse = material->diffuse;
+  record.specular = material->specular;
+  record.roughness = material->roughness;
+  record.metalness = material->metalness;
+
+  // As before, if a material has several maps of one type the last one is used
+  for (auto& texture : material->textures) {
+    if (!bindless && !texture_references.count(texture.id)) continue;
+    switch (texture.type) {
+      case ALBEDO_MAP:
+        record.albedo_map = texture_reference(texture.id);
+        record.used_maps |= USE_ALBEDO_MAP;
+        break;
+      case AMBIENT_OCCLUSION_MAP:
+        record.ambient_occlusion_map = texture_reference(texture.id);
+        record.used_maps |= USE_AMBIENT_OCCLUSION_MAP;
+        break;
+      case ROUGHNESS_MAP:
+        record.roughness_map = texture_reference(texture.id);
+        record.used_maps |= USE_ROUGHNESS_MAP;
+        break;
+      case METALNESS_MAP:
+        record.metalness_map = texture_reference(texture.id);
+        record.used_maps |= USE_METALNESS_MAP;
+        break;
+      case OPACITY_MAP:{
+        #ifdef QT_DEBUG
+          qDebug() << "Opacity maps should not be put in textures\n";
+          qDebug() << "Materials have a special opacity map variable\n";
+        #endif
+        break;}
+      default:
+        break;
+    }
+  }
+  unsigned int opacity_map = material->opacity_map.id;
+  if (opacity_map != 0 && (bindless || texture_references.count(opacity_map))) {
+    record.opacity_map = texture_reference(opacity_map);
+    record.used_maps |= USE_OPACITY_MAP;
+  }
+
+  return record;
+}
+
+void MaterialBuffer::update() {
+  if (!dirty && changed_materials.empty()) return;
+  PROFILE_ZONE("MaterialBuffer::update");
+
+  QOpenGLFunctions_4_5_Core* gl_functions = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_5_Core>();
+
+  if (!dirty) {
+    // Only parameters changed; rewrite just those records
+    for (auto material : changed_materials) {
+      GpuMaterial record = make_record(material);
+      gl_functions->glNamedBufferSubData(ssbo, material->index*sizeof(GpuMaterial), sizeof(GpuMaterial), &record);
+    }
+    changed_materials.clear();
+    return;
+  }
+  dirty = false;
+  changed_materials.clear();
+
+  if (!bindless) {
+    build_texture_arrays(gl_functions);
+  }
+
+  std::vector<GpuMaterial> records(std::max<size_t>(materials.size(), 1), GpuMaterial{});
+  for (unsigned int i=0; i<materials.size(); i++) {
+    records[i] = make_record(materials[i]);
+  }
+
+  gl_functions->glNamedBufferData(ssbo, records.size()*sizeof(GpuMaterial), records.data(), GL_DYNAMIC_DRAW);
+}
@@ -0,0 +1,87 @@
+#ifndef MATERIAL_BUFFER_H
+#define MATERIAL_BUFFER_H
+
+#include <QOpenGLFunctions_4_5_Core>
+
+#include <tuple>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+class Material;
+
+// Holds every registered material (parameters and textures) in a shader storage buffer (binding 1) indexed by Material::index
+// With ARB_bindless_texture the buffer stores texture handles. Otherwise textures are copied into texture arrays (one per format, size,
+// mip count and wrap mode) that stay bound to their own texture units, and the buffer stores (array, layer) pairs
+// (a texture's own storage is released once it has been copied into an array)
+// Either way drawing a mesh only needs the material_index uniform; nothing else is set or bound per draw
+class MaterialBuffer {
+public:
+  static constexpr unsigned int BINDING = 1; // Shader storage buffer binding point (see material_buffer.glsl)
+  static constexpr int MAX_TEXTURE_ARRAYS = 8; // Must match MAX_MATERIAL_TEXTURE_ARRAYS in material_buffer.glsl
+  static constexpr int FIRST_TEXTURE_ARRAY_UNIT = 32; // Texture units [32, 40) are reserved for the texture arrays
+
+  // Must be called with a current context before any shader is loaded (the shaders need to know if bindless textures are used)
+  static void initialize();
+  static bool is_bindless() {return bindless;}
+
+  // Points the shader's texture array samplers at their reserved units. Does nothing with bindless textures
+  static void initialize_shader(Shader* shader);
+
+  static void add(Material* material); // Sets material->index
+  static void remove(Material* material);
+  // Must be called after a registered material's parameters are changed (the Settings material windows do this)
+  static void set_changed(Material* material);
+
+  // Rebuilds the buffer (and the texture arrays) if materials were added or removed since the last call
+  // Otherwise only the records of changed materials are uploaded
+  static void update();
+
+  // Called by TextureRegistry before a texture is deleted: makes its bindless handle non-resident or drops it from the arrays
+  static void texture_released(unsigned int texture_id);
+
+protected:
+  // Mirrors Material in material_buffer.glsl (std430)
+  struct GpuMaterial {
+    glm::vec3 color;
+    float opacity;
+    float ambient;
+    float diffuse;
+    float specular;
+    float roughness;
+    float metalness;
+
+    unsigned int used_maps;
+    glm::uvec2 albedo_map;
+    glm::uvec2 ambient_occlusion_map;
+    glm::uvec2 roughness_map;
+    glm::uvec2 metalness_map;
+    glm::uvec2 opacity_map;
+  };
+  static_assert(sizeof(GpuMaterial) == 80, "GpuMaterial must match the std430 layout of Material in material_buffer.glsl");
+
+  // Textures can only share an array if they have the same internal format, width, height, number of mips and wrapping
+  typedef std::tuple<int, int, int, int, int> Texture_Layout;
+
+  static GpuMaterial make_record(Material* material);
+  static glm::uvec2 texture_reference(unsigned int texture_id);
+  static void build_texture_arrays(QOpenGLFunctions_4_5_Core* gl_functions);
+  // Frees the GPU memory of a texture that has been copied into an array
+  static void release_storage(unsigned int texture_id, int levels, QOpenGLFunctions_4_5_Core* gl_functions);
+
+  static bool bindless;
+  static bool dirty;
+  static unsigned int ssbo;
+  static std::vector<Material*> materials;
+  static std::unordered_set<Material*> changed_materials;
+
+  static std::vector<unsigned int> texture_arrays;
+  static std::unordered_map<unsigned int, glm::uvec2> texture_references; // texture id -> bindless handle or (array, layer)
+  static std::unordered_map<unsigned int, Texture_Layout> texture_layouts; // Kept since it can't be queried once the storage is released
+};
+
+#endif
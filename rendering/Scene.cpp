@@ -1,15 +1,21 @@
 #include <QOpenGLContext>
 #include <QOpenGLDebugLogger>
 #include <QDebug>
+#include <QtConcurrent>
 
 #include <algorithm>
+#include <cmath>
 
 #include <glm/gtx/norm.hpp>
 
 #include "Scene.h"
+#include "GpuProfiler.h"
+#include "../utility/CpuProfiler.h"
+#include "../Simulation.h"
 
-std::vector<Texture> Scene::loaded_textures;
 std::vector<Material*> Scene::loaded_materials;
+std::unordered_map<std::string, Material*> Scene::loaded_material_keys;
+QMutex Scene::loaded_materials_mutex;
 
 Scene::Scene(QObject *parent) : QObject(parent) {
   initializeOpenGLFunctions();
@@ -25,6 +31,11 @@ Scene::Scene(QObject *parent) : QObject(parent) {
   bloom_interpolation = 1;
   bloom_applications = 10;
 
+  parallel_animation = true;
+
+  lod_pixel_error = 1.0f;
+  shadow_lod_bias = 1;
+
   volumetric_samples = 75;
   volumetric_scattering = 0.75;
   volumetric_density = 0.5;
@@ -51,14 +62,73 @@ Scene::~Scene() {
 
   for (auto m: Scene::loaded_materials)
     delete m;
+  Scene::loaded_materials.clear();
+  loaded_material_keys.clear();
 }
 
 void Scene::initialize_scene() {
 }
 
-void Scene::update_scene() {
-  for (auto node : nodes) {
-    node->update();
+void Scene::update_scene(double time) {
+  PROFILE_ZONE("Scene::update_scene");
+  update_poses(nodes, parallel_animation, time);
+}
+
+void Scene::update_poses(std::vector<std::shared_ptr<RootNode>>& nodes, bool parallel, double time) {
+  pose(nodes, parallel, time);
+
+  // Serially and in scene order, so the palette layout doesn't depend on which worker finished first
+  BonePalette::clear();
+  for (auto& node : nodes) {
+    node->publish_bones();
+  }
+}
+
+void Scene::pose(std::vector<std::shared_ptr<RootNode>>& nodes, bool parallel, double time) {
+  if (parallel && nodes.size() > 1) {
+    QtConcurrent::blockingMap(nodes, [time](std::shared_ptr<RootNode>& node) {
+      node->update_pose(time);
+    });
+  } else {
+    for (auto& node : nodes) {
+      node->update_pose(time);
+    }
+  }
+}
+
+static void apply_bone_offsets(Node* node, const std::unordered_map<const RootNode*, unsigned int>& offsets) {
+  RootNode* root_node = qobject_cast<RootNode*>(node);
+  if (root_node) {
+    auto it = offsets.find(root_node);
+    if (it != offsets.end()) root_node->set_bone_offset(it->second);
+  }
+  for (auto& child : node->get_child_nodes()) {
+    apply_bone_offsets(child.get(), offsets);
+  }
+}
+
+void Scene::simulate(FrameSnapshot& snapshot) {
+  PROFILE_ZONE("Scene::simulate");
+  QMutexLocker lock(&simulation_mutex);
+  pose(nodes, parallel_animation, snapshot.time);
+
+  snapshot.bone_palette.clear();
+  snapshot.bone_offsets.clear();
+  for (auto& node : nodes) {
+    node->append_bones(snapshot.bone_palette, snapshot.bone_offsets);
+  }
+}
+
+void Scene::apply_snapshot(const FrameSnapshot& snapshot) {
+  if (snapshot.tick == applied_snapshot_tick) return;
+  applied_snapshot_tick = snapshot.tick;
+  PROFILE_ZONE("Scene::apply_snapshot");
+
+  BonePalette::clear();
+  BonePalette::add(snapshot.bone_palette);
+  // Walks the live tree rather than dereferencing the snapshot's keys, which may belong to nodes deleted since
+  for (auto& node : nodes) {
+    apply_bone_offsets(node.get(), snapshot.bone_offsets);
   }
 }
 
@@ -141,13 +211,43 @@ void Scene::draw_light(Shader *shader) {
   }
 }
 
-void Scene::draw_objects(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, int texture_unit, glm::vec3 camera_position) {
+void Scene::set_lod_view(glm::vec3 camera_position, float fov, int viewport_height) {
+  lod_view_position = camera_position;
+  lod_pixels_per_unit = viewport_height / (2.0f * std::tan(glm::radians(fov) / 2.0f));
+}
+
+void Scene::draw_objects(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, glm::vec3 camera_position) {
+  PROFILE_ZONE("Scene::draw_objects");
+  MaterialBuffer::update();
+  BonePalette::update();
+
+  Mesh::lod_selection.view_position = lod_view_position;
+  Mesh::lod_selection.pixels_per_unit = lod_pixels_per_unit;
+  Mesh::lod_selection.pixel_error = lod_pixel_error;
+  Mesh::lod_selection.bias = draw_type == Shader::DrawType::COLOR ? 0 : shadow_lod_bias;
+
+  // Only the color pass is split into opaque and transparent; shadow passes are timed as a whole by the caller
+  bool profiled = draw_type == Shader::DrawType::COLOR;
+  if (profiled) GpuProfiler::begin(GpuProfiler::Pass::OPAQUE_OBJECTS);
+
   std::vector<Transparent_Draw> partially_transparent_meshes;
-  for (auto node : nodes) {
-    node->draw(shaders, draw_type, &partially_transparent_meshes, glm::mat4(1.0f), texture_unit);
+  {
+    PROFILE_ZONE("Draw nodes and build the transparent draw list");
+    for (auto node : nodes) {
+      node->draw(shaders, draw_type, &partially_transparent_meshes, glm::mat4(1.0f));
+    }
+    for (auto crowd : crowds) {
+      crowd->draw(shaders, draw_type);
+    }
+  }
+
+  if (profiled) {
+    GpuProfiler::end();
+    GpuProfiler::begin(GpuProfiler::Pass::TRANSPARENT_OBJECTS);
   }
   glBlendFuncSeparate(GL_ONE, GL_SRC1_COLOR, GL_ONE, GL_ZERO);
 
+  PROFILE_ZONE("Sort and draw transparent meshes");
   std::sort(partially_transparent_meshes.begin(), partially_transparent_meshes.end(),
     [&camera_position](Transparent_Draw& obj1, Transparent_Draw& obj2){
       return glm::length2(camera_position-glm::vec3(obj1.model*glm::vec4(0.0f,0.0f,0.0f,1.0f))) >= glm::length2(camera_position-glm::vec3(obj2.model*glm::vec4(0.0f,0.0f,0.0f,1.0f)));
@@ -155,45 +255,70 @@ void Scene::draw_objects(Shader_Opacity_Triplet shaders, Shader::DrawType draw_t
   );
 
   for (auto draw_call : partially_transparent_meshes) {
-    draw_call.mesh->draw(draw_call.shader, draw_type, draw_call.model, draw_call.texture_unit);
+    Mesh::bone_offset = draw_call.bone_offset;
+    draw_call.mesh->draw(draw_call.shader, draw_type, draw_call.model);
   }
-  glBlendFunc(GL_ONE, GL_ZERO);
-}
-
-Texture Scene::is_texture_loaded(std::string image_path) {
-  for (unsigned int i=0; i<loaded_textures.size(); i++) {
-    if (image_path == Scene::loaded_textures[i].path) {
-      return Scene::loaded_textures[i];
+  if (draw_type == Shader::DrawType::COLOR) {
+    for (auto crowd : crowds) {
+      crowd->draw(shaders, draw_type, true);
     }
   }
-  return Texture();
+  glBlendFunc(GL_ONE, GL_ZERO);
+  if (profiled) GpuProfiler::end();
 }
 
 Material * Scene::is_material_loaded(Material *new_material) {
-  for (auto m : Scene::loaded_materials) {
-    if ((*new_material) == (*m)) {
-      delete new_material;
-      return m;
-    }
+  std::string key = new_material->dedup_key(); // Built outside the lock
+
+  QMutexLocker lock(&loaded_materials_mutex);
+  auto it = loaded_material_keys.find(key);
+  if (it != loaded_material_keys.end()) {
+    delete new_material; // Under the lock since ~Material unregisters itself from the MaterialBuffer
+    return it->second;
   }
+  loaded_material_keys[key] = new_material;
   Scene::loaded_materials.push_back(new_material);
+  MaterialBuffer::add(new_material);
   return new_material;
 }
 
 // Getters and Setters
 void Scene::add_node(std::shared_ptr<RootNode> node) {
+  QMutexLocker lock(&simulation_mutex);
+  node->set_simulation_mutex(&simulation_mutex);
   nodes.push_back(node);
 }
 
 void Scene::delete_node_at(unsigned int index) {
   Q_ASSERT_X(index < nodes.size(), "delete_node_at", "index is greater than vector nodes' size");
+  QMutexLocker lock(&simulation_mutex);
   nodes.erase(nodes.begin() + index);
 }
 
 void Scene::clear_nodes() {
+  QMutexLocker lock(&simulation_mutex);
   nodes.clear();
 }
 
+void Scene::add_crowd(std::shared_ptr<Crowd> crowd) {
+  crowds.push_back(crowd);
+}
+
+void Scene::set_crowd_time(double time) {
+  for (auto& crowd : crowds) {
+    crowd->set_time(time);
+  }
+}
+
+void Scene::delete_crowd_at(unsigned int index) {
+  Q_ASSERT_X(index < crowds.size(), "delete_crowd_at", "index is greater than vector crowds' size");
+  crowds.erase(crowds.begin() + index);
+}
+
+void Scene::clear_crowds() {
+  crowds.clear();
+}
+
 void Scene::add_dirlight(std::shared_ptr<DirectionalLight> dirlight) {
   dirlights.push_back(dirlight);
 }
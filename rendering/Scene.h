@@ -3,8 +3,10 @@
 
 #include <QObject>
 #include <QOpenGLFunctions_4_5_Core>
+#include <QMutex>
 
 #include <vector>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -12,6 +14,7 @@
 #include "../entities/nodes/Node.h"
 #include "../entities/nodes/RootNode.h"
 #include "../entities/nodes/Model.h"
+#include "../entities/nodes/Crowd.h"
 #include "../entities/lights/Light.h"
 #include "../entities/lights/PointLight.h"
 #include "../entities/lights/DirectionalLight.h"
@@ -19,6 +22,8 @@
 #include "../entities/meshes/Material.h"
 #include "Shader.h"
 #include "Camera.h"
+#include "MaterialBuffer.h"
+#include "BonePalette.h"
 
 enum Antialiasing_Types {
   NONE,
@@ -34,11 +39,13 @@ enum Display_Types {
   BRIGHT=5
 };
 
+struct FrameSnapshot;
+
 struct Transparent_Draw {
   Mesh* mesh;
   Shader* shader;
   glm::mat4 model;
-  int texture_unit;
+  int bone_offset; // Mesh::bone_offset when the draw was deferred
 };
 
 class Scene : public QObject, protected QOpenGLFunctions_4_5_Core {
@@ -58,12 +65,27 @@ public:
 
   Antialiasing_Types antialiasing;
 
+  bool parallel_animation; // Pose the RootNodes on the global thread pool
+
+  float lod_pixel_error; // Simplification error (in pixels) a level of detail may show
+  int shadow_lod_bias; // Extra levels of detail dropped in the shadow passes
+
   Scene(QObject *parent=nullptr);
   ~Scene();
 
   void initialize_scene();
 
-  void update_scene();
+  // Poses the nodes at time (seconds) on the render thread, when there is no Simulation thread
+  void update_scene(double time);
+  // Poses every RootNode at time (on the global thread pool if parallel) and rebuilds the BonePalette from the results
+  // The bone matrices are the same either way
+  static void update_poses(std::vector<std::shared_ptr<RootNode>>& nodes, bool parallel, double time);
+  // Just the posing part of update_poses (RootNode::update_pose for every node)
+  static void pose(std::vector<std::shared_ptr<RootNode>>& nodes, bool parallel, double time);
+  // Poses the nodes at snapshot.time into snapshot (the Simulation thread's step). Changes to the node list wait for it to finish
+  void simulate(FrameSnapshot& snapshot);
+  // Uses the bones of a snapshot made by the Simulation thread instead of posing the nodes here
+  void apply_snapshot(const FrameSnapshot& snapshot);
 
   void draw_skybox(Shader *shader);
   int set_skybox_settings(std::string name, Shader *shader, int texture_unit=0); // Returns the next free texture unit
@@ -76,22 +98,32 @@ public:
   int set_light_settings(std::string name, Shader *shader, int texture_unit=0); // Returns the next free texture unit
   void draw_light(Shader *shader);
 
-  void draw_objects(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, int texture_unit=0, glm::vec3 camera_position = glm::vec3(0.0f));
+  void draw_objects(Shader_Opacity_Triplet shaders, Shader::DrawType draw_type, glm::vec3 camera_position = glm::vec3(0.0f));
+  // Where levels of detail are measured from for the rest of the frame (all passes use the camera, including shadows)
+  void set_lod_view(glm::vec3 camera_position, float fov, int viewport_height);
 
-  static std::vector<Texture> loaded_textures;
   static std::vector<Material*> loaded_materials;
 
-  static Texture is_texture_loaded(std::string image_path); // Returns the texture if the path is already loaded. Returns an empty texture otherwise
-  static Material * is_material_loaded(Material *new_material); // Returns new_material if it is unique. Otherwise, it deletes new_material and returns a ptr to the loaded material
+  // Returns new_material if it is unique. Otherwise, it deletes new_material and returns a ptr to the loaded material
+  // Safe to call from several loader threads at once
+  static Material * is_material_loaded(Material *new_material);
 
   // Getters and Setters
   const std::vector<std::shared_ptr<RootNode>>& get_nodes() const {return nodes;}
   unsigned int nodes_size() const {return nodes.size();}
   std::shared_ptr<RootNode> get_node_at(unsigned int index) {return nodes[index];}
   void add_node(std::shared_ptr<RootNode> node);
+  QMutex* get_simulation_mutex() {return &simulation_mutex;}
   void delete_node_at(unsigned int index);
   void clear_nodes();
 
+  // Crowds are drawn with the nodes' shaders but not simulated (their animations run on the GPU)
+  const std::vector<std::shared_ptr<Crowd>>& get_crowds() const {return crowds;}
+  void add_crowd(std::shared_ptr<Crowd> crowd);
+  void set_crowd_time(double time); // Seconds; the crowds are drawn at it until the next call
+  void delete_crowd_at(unsigned int index);
+  void clear_crowds();
+
   const std::vector<std::shared_ptr<DirectionalLight>>& get_dirlights() const {return dirlights;}
   void add_dirlight(std::shared_ptr<DirectionalLight> dirlight);
   void delete_dirlight_at(unsigned int index);
@@ -123,9 +155,21 @@ protected:
   std::vector<std::shared_ptr<PointLight>> pointlights;
 
   std::vector<std::shared_ptr<RootNode>> nodes;
+  std::vector<std::shared_ptr<Crowd>> crowds;
 
 private:
   float angle;
+
+  // Held while simulate runs, while the node list changes and (through RootNode::set_simulation_mutex) while the GUI changes a
+  // node's animation or transform. Recursive since the RootNode mutators call each other
+  QMutex simulation_mutex{QMutex::Recursive};
+  quint64 applied_snapshot_tick = 0;
+
+  glm::vec3 lod_view_position;
+  float lod_pixels_per_unit = 0.0f;
+
+  static std::unordered_map<std::string, Material*> loaded_material_keys; // Material::dedup_key() -> material
+  static QMutex loaded_materials_mutex;
 };
 
 #endif
@@ -3,9 +3,12 @@
 
 #include "Shader.h"
 #include "../entities/meshes/Material.h"
+#include "TextureRegistry.h"
 
 unsigned int Shader::placeholder_texture = 0;
+std::shared_ptr<TextureHandle> Shader::placeholder_texture_handle;
 std::unordered_map<std::string, unsigned int> Shader::uniform_block_buffers;
+std::string Shader::global_preamble;
 
 QString textContent(QString path, std::shared_ptr<std::vector<QString>> already_included_names = std::make_shared<std::vector<QString>>()) {
   QFile file(path);
@@ -54,6 +57,14 @@ QString textContent(QString path, std::shared_ptr<std::vector<QString>> already_
   // return in.readAll().toStdString();
 }
 
+// #extension directives have to come before anything else so the preamble goes directly after #version
+std::string add_global_preamble(std::string source) {
+  if (Shader::global_preamble.empty()) return source;
+  size_t version_line_end = source.find('\n', source.find("#version"));
+  if (version_line_end == std::string::npos) return source;
+  return source.insert(version_line_end+1, Shader::global_preamble);
+}
+
 Shader::Shader() {}
 
 Shader::~Shader() {}
@@ -68,7 +79,7 @@ void Shader::loadShaders(const char* vertex_path, const char* fragment_path, con
   ID = glCreateProgram();
 
   // Load vertex shader
-  std::string vertex_shader_str = textContent(vertex_path).toStdString();
+  std::string vertex_shader_str = add_global_preamble(textContent(vertex_path).toStdString());
   const char* vertex_shader_code = vertex_shader_str.data();
   // Compile vertex shader
   vert_shader = glCreateShader(GL_VERTEX_SHADER);
@@ -84,7 +95,7 @@ void Shader::loadShaders(const char* vertex_path, const char* fragment_path, con
   glDeleteShader(vert_shader);
 
   // Load fragment shader
-  std::string fragment_shader_str = textContent(fragment_path).toStdString();
+  std::string fragment_shader_str = add_global_preamble(textContent(fragment_path).toStdString());
   const char* fragment_shader_code = fragment_shader_str.data();
   // Compile fragment shader
   frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -101,7 +112,7 @@ void Shader::loadShaders(const char* vertex_path, const char* fragment_path, con
 
   if (geometry_path[0] != '\0') {
     // Load geometry shader
-    std::string geometry_shader_str = textContent(geometry_path).toStdString();
+    std::string geometry_shader_str = add_global_preamble(textContent(geometry_path).toStdString());
     const char* geometry_shader_code = geometry_shader_str.data();
     // Compile geometry shader
     unsigned int geom_shader = glCreateShader(GL_GEOMETRY_SHADER);
@@ -126,9 +137,43 @@ void Shader::loadShaders(const char* vertex_path, const char* fragment_path, con
   }
 }
 
+void Shader::loadComputeShader(const char* compute_path) {
+  initializeOpenGLFunctions();
+  int success;
+  char infoLog[512];
+
+  ID = glCreateProgram();
+
+  // Load compute shader
+  std::string compute_shader_str = add_global_preamble(textContent(compute_path).toStdString());
+  const char* compute_shader_code = compute_shader_str.data();
+  // Compile compute shader
+  unsigned int comp_shader = glCreateShader(GL_COMPUTE_SHADER);
+  glShaderSource(comp_shader, 1, &compute_shader_code, NULL);
+  glCompileShader(comp_shader);
+  // Check for errors
+  glGetShaderiv(comp_shader, GL_COMPILE_STATUS, &success);
+  if(!success) {
+    glGetShaderInfoLog(comp_shader, 512, NULL, infoLog);
+    qDebug() << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog;
+  }
+  glAttachShader(ID, comp_shader);
+  glDeleteShader(comp_shader);
+
+  glLinkProgram(ID);
+  // Check for errors
+  glGetProgramiv(ID, GL_LINK_STATUS, &success);
+  if(!success) {
+    glGetProgramInfoLog(ID, 512, NULL, infoLog);
+    qDebug() << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog;
+  }
+}
+
 void Shader::initialize_placeholder_textures(Image_Type texture_types) {
   if (Shader::placeholder_texture == 0) {
-    Shader::placeholder_texture = Material::static_load_texture("assets/textures/placeholder_texture.png", Image_Type::ALBEDO_MAP).id;
+    Texture placeholder = Material::static_load_texture("assets/textures/placeholder_texture.png", Image_Type::ALBEDO_MAP);
+    Shader::placeholder_texture = placeholder.id;
+    Shader::placeholder_texture_handle = placeholder.handle;
   }
 
   use();
@@ -151,7 +196,9 @@ void Shader::initialize_placeholder_textures(Image_Type texture_types) {
 
 void Shader::initialize_placeholder_2D_textures(std::vector<const char*> texture_names) {
   if (Shader::placeholder_texture == 0) {
-    Shader::placeholder_texture = Material::static_load_texture("textures/placeholder_texture.png", Image_Type::ALBEDO_MAP).id;
+    Texture placeholder = Material::static_load_texture("textures/placeholder_texture.png", Image_Type::ALBEDO_MAP);
+    Shader::placeholder_texture = placeholder.id;
+    Shader::placeholder_texture_handle = placeholder.handle;
   }
 
   use();
@@ -7,6 +7,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <unordered_map>
 
 #include <glm/glm.hpp>
@@ -29,12 +30,16 @@ inline constexpr Image_Type operator&(Image_Type a, Image_Type b) {
   return a = static_cast<Image_Type> (int(a) & int(b));
 }
 
+struct TextureHandle;
+
 class Shader : public QObject, protected QOpenGLFunctions_4_5_Core {
   Q_OBJECT;
 
 public:
   static unsigned int placeholder_texture;
+  static std::shared_ptr<TextureHandle> placeholder_texture_handle; // Keeps placeholder_texture registered
   static std::unordered_map<std::string, unsigned int> uniform_block_buffers;
+  static std::string global_preamble; // Inserted right after the #version line of every shader (extensions and feature defines)
 
   enum DrawType {
     COLOR = 0x0,
@@ -48,6 +53,7 @@ public:
   ~Shader();
 
   void loadShaders(const char* vertex_path, const char* fragment_path, const char* geometry_path="");
+  void loadComputeShader(const char* compute_path);
   void initialize_placeholder_textures(Image_Type texture_types); // Input the types of images that the shaders have samplers for
   void initialize_placeholder_2D_textures(std::vector<const char*> texture_names);
   bool validate_program(); // Will return whether or not the program is valid. If invalid, a warning will be outputted to stdout
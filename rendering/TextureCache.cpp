@@ -0,0 +1,218 @@
+#include <QOpenGLContext>
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#include <algorithm>
+
+#include "TextureCache.h"
+
+static const char cache_magic[8] = {'Q', 'T', 'K', 'T', 'X', '2', '\r', '\n'};
+
+bool TextureCache::initialized = false;
+bool TextureCache::s3tc = false;
+bool TextureCache::s3tc_srgb = false;
+
+void TextureCache::initialize() {
+  QOpenGLContext* context = QOpenGLContext::currentContext();
+  s3tc = context->hasExtension("GL_EXT_texture_compression_s3tc");
+  s3tc_srgb = s3tc && (context->hasExtension("GL_EXT_texture_sRGB") || context->hasExtension("GL_EXT_texture_compression_s3tc_srgb"));
+  initialized = true;
+}
+
+std::string TextureCache::cache_path(const std::string& hash) {
+  return "cache/textures/" + hash + ".ktx";
+}
+
+std::string TextureCache::source_hash(const std::vector<std::string>& paths, GLenum internal_format, ImageLoading::Options options) {
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  for (auto& path : paths) {
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly)) return std::string();
+    hash.addData(&file);
+  }
+
+  // Only the options that change the uploaded pixels matter; transparency is already part of the format
+  QByteArray settings = QByteArray::number(CACHE_VERSION) + '|' + QByteArray::number(internal_format) + '|' + QByteArray::number(int(options & ImageLoading::Options::FLIP_ON_LOAD));
+  hash.addData(settings);
+
+  return hash.result().toHex().toStdString();
+}
+
+GLenum TextureCache::internal_format(Image_Type type, ImageLoading::Options options) {
+  bool srgb = (type == ALBEDO_MAP || type == CUBE_MAP);
+  bool alpha = options & ImageLoading::Options::TRANSPARENCY;
+  Q_ASSERT_X(initialized, "TextureCache::internal_format", "TextureCache::initialize was not called");
+
+  if (srgb) {
+    if (s3tc_srgb) return alpha ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    return alpha ? GL_SRGB_ALPHA : GL_SRGB;
+  } else {
+    if (s3tc) return alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    return alpha ? GL_RGBA : GL_RGB;
+  }
+}
+
+bool TextureCache::is_compressed(GLenum internal_format) {
+  switch (internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool TextureCache::load(const std::string& hash, GLenum target, QOpenGLFunctions_4_5_Core* gl_functions, size_t& gpu_bytes) {
+  if (hash.empty()) return false;
+
+  QFile file(QString::fromStdString(cache_path(hash)));
+  if (!file.open(QIODevice::ReadOnly)) return false;
+
+  QDataStream in(&file);
+  in.setByteOrder(QDataStream::LittleEndian);
+
+  char magic[8];
+  quint32 version, format, width, height, levels, faces;
+  in.readRawData(magic, 8);
+  in >> version >> format >> width >> height >> levels >> faces;
+  if (in.status() != QDataStream::Ok || !std::equal(magic, magic+8, cache_magic) || version != CACHE_VERSION) {
+    qDebug() << "Ignoring stale or invalid texture cache" << file.fileName();
+    return false;
+  }
+  if (faces != (target == GL_TEXTURE_CUBE_MAP ? 6u : 1u) || levels == 0 || levels > 32) return false;
+
+  // Read everything before uploading so a truncated file doesn't leave a half-specified texture behind
+  std::vector<QByteArray> blocks(levels*faces);
+  for (auto& block : blocks) {
+    quint32 size;
+    in >> size;
+    if (in.status() != QDataStream::Ok || size > file.size()) return false;
+    block.resize(size);
+    if (in.readRawData(block.data(), size) != int(size)) return false;
+  }
+
+  gpu_bytes = 0;
+  for (unsigned int level=0; level<levels; level++) {
+    int level_width = std::max(1u, width >> level);
+    int level_height = std::max(1u, height >> level);
+    for (unsigned int face=0; face<faces; face++) {
+      GLenum face_target = (target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X+face : target;
+      const QByteArray& block = blocks[level*faces+face];
+      gl_functions->glCompressedTexImage2D(face_target, level, format, level_width, level_height, 0, block.size(), block.constData());
+      gpu_bytes += block.size();
+    }
+  }
+  gl_functions->glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levels-1);
+
+  return true;
+}
+
+PreparedTexture TextureCache::prepare(const std::string& path, Image_Type type, ImageLoading::Options options) {
+  PreparedTexture prepared;
+  prepared.internal_format = internal_format(type, options);
+  prepared.hash = source_hash({path}, prepared.internal_format, options);
+  if (!prepared.hash.empty() && QFile::exists(QString::fromStdString(cache_path(prepared.hash)))) return prepared;
+
+  QImage img = QImage(path.c_str());
+  if (img.isNull()) return prepared; // Left for the context thread to report
+  if (options & ImageLoading::Options::TRANSPARENCY) {
+    img = img.convertToFormat(QImage::Format_RGBA8888);
+  } else {
+    img = img.convertToFormat(QImage::Format_RGB888);
+  }
+  if (options & ImageLoading::Options::FLIP_ON_LOAD) {
+    img = img.mirrored(false, true);
+  }
+  prepared.levels = build_levels(img, true);
+  return prepared;
+}
+
+std::vector<QImage> TextureCache::build_levels(const QImage& image, bool mipmapped) {
+  // Compressed formats can't be render targets so glGenerateMipmap is not an option; the mips are downscaled on the CPU instead
+  std::vector<QImage> levels{image};
+  for (int level=1; mipmapped && (levels.back().width() > 1 || levels.back().height() > 1); level++) {
+    // Smooth scaling returns RGB32/ARGB32_Premultiplied images, so each level is converted back to the byte layout upload expects
+    QImage scaled = image.scaled(std::max(1, image.width() >> level), std::max(1, image.height() >> level), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    levels.push_back(scaled.convertToFormat(image.format()));
+  }
+  return levels;
+}
+
+size_t TextureCache::upload(const QImage& image, GLenum face_target, GLenum internal_format, bool mipmapped, QOpenGLFunctions_4_5_Core* gl_functions) {
+  return upload(build_levels(image, mipmapped), face_target, internal_format, gl_functions);
+}
+
+size_t TextureCache::upload(const std::vector<QImage>& levels, GLenum face_target, GLenum internal_format, QOpenGLFunctions_4_5_Core* gl_functions) {
+  size_t bytes = 0;
+  if (levels.empty()) return bytes;
+
+  // Decided from the source level; build_levels keeps every mip in the same format
+  bool alpha = levels[0].format() == QImage::Format_RGBA8888;
+  GLenum format = alpha ? GL_RGBA : GL_RGB;
+  for (unsigned int level=0; level<levels.size(); level++) {
+    const QImage& level_image = levels[level];
+    Q_ASSERT_X(level_image.format() == levels[0].format(), "TextureCache::upload", "mip levels must share the source format");
+    gl_functions->glTexImage2D(face_target, level, internal_format, level_image.width(), level_image.height(), 0, format, GL_UNSIGNED_BYTE, level_image.bits());
+
+    if (is_compressed(internal_format)) {
+      int compressed_size = 0;
+      gl_functions->glGetTexLevelParameteriv(face_target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressed_size);
+      bytes += compressed_size;
+    } else {
+      bytes += size_t(level_image.width()) * level_image.height() * (alpha ? 4 : 3);
+    }
+  }
+  return bytes;
+}
+
+void TextureCache::store(const std::string& hash, GLenum target, QOpenGLFunctions_4_5_Core* gl_functions) {
+  if (hash.empty()) return;
+
+  GLenum first_face = (target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+  int compressed = 0, format = 0, width = 0, height = 0;
+  gl_functions->glGetTexLevelParameteriv(first_face, 0, GL_TEXTURE_COMPRESSED, &compressed);
+  gl_functions->glGetTexLevelParameteriv(first_face, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+  gl_functions->glGetTexLevelParameteriv(first_face, 0, GL_TEXTURE_WIDTH, &width);
+  gl_functions->glGetTexLevelParameteriv(first_face, 0, GL_TEXTURE_HEIGHT, &height);
+  if (!compressed) return; // The driver fell back to an uncompressed format; nothing worth caching
+
+  unsigned int faces = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+  unsigned int levels = 1;
+  for (int level_width=1; levels < 32; levels++) {
+    gl_functions->glGetTexLevelParameteriv(first_face, levels, GL_TEXTURE_WIDTH, &level_width);
+    if (level_width == 0) break;
+  }
+
+  QDir().mkpath("cache/textures");
+  QSaveFile file(QString::fromStdString(cache_path(hash)));
+  if (!file.open(QIODevice::WriteOnly)) {
+    qDebug() << "Could not write texture cache" << file.fileName();
+    return;
+  }
+
+  QDataStream out(&file);
+  out.setByteOrder(QDataStream::LittleEndian);
+  out.writeRawData(cache_magic, 8);
+  out << quint32(CACHE_VERSION) << quint32(format) << quint32(width) << quint32(height) << quint32(levels) << quint32(faces);
+
+  QByteArray block;
+  for (unsigned int level=0; level<levels; level++) {
+    for (unsigned int face=0; face<faces; face++) {
+      GLenum face_target = (target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X+face : target;
+      int size = 0;
+      gl_functions->glGetTexLevelParameteriv(face_target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+      block.resize(size);
+      gl_functions->glGetCompressedTexImage(face_target, level, block.data());
+      out << quint32(size);
+      out.writeRawData(block.constData(), size);
+    }
+  }
+
+  file.commit();
+}
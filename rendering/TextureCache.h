@@ -0,0 +1,72 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <QOpenGLFunctions_4_5_Core>
+#include <QImage>
+
+#include <string>
+#include <vector>
+
+#include "../entities/meshes/Material.h"
+
+// Not every GL header ships the S3TC/sRGB extension enums
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// The CPU side of loading a texture, done ahead of time (on any thread) by TextureCache::prepare
+struct PreparedTexture {
+  std::string hash;
+  GLenum internal_format = 0;
+  std::vector<QImage> levels; // Converted and downscaled mips, ready for upload. Empty if the texture cache already has the texture
+};
+
+// Block-compressed textures are cached in cache/textures/<source hash>.ktx so later runs skip decoding, compression and mip generation
+// The file layout follows KTX2 loosely: a fixed header (format, size, level and face counts) followed by every level's faces, largest level first
+class TextureCache {
+public:
+  static constexpr unsigned int CACHE_VERSION = 2; // Bump when the layout or the compression settings change
+
+  // Hash of the source files' contents together with everything that changes the compressed result (format, flipping) and the cache version
+  // The path isn't part of it so moved or duplicated files still hit. Empty if a source file can't be read
+  static std::string source_hash(const std::vector<std::string>& paths, GLenum internal_format, ImageLoading::Options options);
+
+  // BC1 for opaque and BC3 for transparent textures, sRGB for gamma-space types. Falls back to uncompressed formats without S3TC support
+  // Needs TextureCache::initialize to have been called
+  static GLenum internal_format(Image_Type type, ImageLoading::Options options);
+  static bool is_compressed(GLenum internal_format);
+
+  // Records which compressed formats the current context supports so internal_format and prepare can run on any thread
+  static void initialize();
+
+  // Hashes the file and, unless the texture cache has it, decodes, converts and downscales it. Safe to call from worker threads
+  static PreparedTexture prepare(const std::string& path, Image_Type type, ImageLoading::Options options);
+
+  // Uploads the cached levels of `hash` into the texture bound to `target`. Returns false (and uploads nothing) on a cache miss
+  static bool load(const std::string& hash, GLenum target, QOpenGLFunctions_4_5_Core* gl_functions, size_t& gpu_bytes);
+  // Uploads `image` and its downscaled mips (if `mipmapped`) into `face_target` with the given internal format
+  static size_t upload(const QImage& image, GLenum face_target, GLenum internal_format, bool mipmapped, QOpenGLFunctions_4_5_Core* gl_functions);
+  static size_t upload(const std::vector<QImage>& levels, GLenum face_target, GLenum internal_format, QOpenGLFunctions_4_5_Core* gl_functions);
+  // `image` followed by its downscaled mips down to 1x1 (or just `image` if not `mipmapped`)
+  static std::vector<QImage> build_levels(const QImage& image, bool mipmapped);
+  // Reads the compressed levels of the texture bound to `target` back from the driver and writes them to the cache
+  static void store(const std::string& hash, GLenum target, QOpenGLFunctions_4_5_Core* gl_functions);
+
+protected:
+  static std::string cache_path(const std::string& hash);
+
+  static bool initialized;
+  static bool s3tc;
+  static bool s3tc_srgb;
+};
+
+#endif
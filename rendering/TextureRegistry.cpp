@@ -0,0 +1,91 @@
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QFileInfo>
+#include <QDir>
+
+#include "TextureRegistry.h"
+#include "MaterialBuffer.h"
+
+TextureHandle::~TextureHandle() {
+  TextureRegistry::release(key, id);
+}
+
+std::unordered_map<std::string, TextureRegistry::Entry>& TextureRegistry::entries() {
+  // Intentionally leaked so handles destroyed during static destruction can still unregister themselves
+  static std::unordered_map<std::string, Entry>* registry = new std::unordered_map<std::string, Entry>();
+  return *registry;
+}
+
+std::string TextureRegistry::make_key(const std::string& path, Image_Type type, ImageLoading::Options options) {
+  QFileInfo file_info(QString::fromStdString(path));
+  QString normalized_path = file_info.exists() ? file_info.canonicalFilePath() : QDir::cleanPath(file_info.absoluteFilePath());
+
+  // KEEP_IMAGE doesn't change what ends up on the GPU so it isn't part of the key
+  int uploaded_options = int(options & (ImageLoading::Options::TRANSPARENCY | ImageLoading::Options::FLIP_ON_LOAD | ImageLoading::Options::CLAMPED));
+  bool srgb = (type == ALBEDO_MAP || type == CUBE_MAP);
+
+  return normalized_path.toStdString() + '|' + std::to_string(uploaded_options) + (srgb ? "|srgb" : "|linear");
+}
+
+Texture TextureRegistry::find(const std::string& key) {
+  Texture texture = {0, UNKNOWN, "", QImage(), nullptr};
+
+  auto it = entries().find(key);
+  if (it != entries().end()) {
+    texture.handle = it->second.handle.lock();
+    if (texture.handle) {
+      texture.id = texture.handle->id;
+      texture.image = it->second.image;
+    }
+  }
+  return texture;
+}
+
+Texture TextureRegistry::add(const std::string& key, Texture texture, size_t gpu_bytes) {
+  Q_ASSERT_X(entries().find(key) == entries().end(), "TextureRegistry::add", "key is already registered");
+
+  texture.handle = std::make_shared<TextureHandle>();
+  texture.handle->key = key;
+  texture.handle->id = texture.id;
+
+  entries()[key] = Entry{texture.handle, texture.image, gpu_bytes};
+  return texture;
+}
+
+void TextureRegistry::set_image(const std::string& key, const QImage& image) {
+  auto it = entries().find(key);
+  if (it != entries().end()) {
+    it->second.image = image;
+  }
+}
+
+void TextureRegistry::release(const std::string& key, unsigned int id) {
+  entries().erase(key);
+
+  // There is no context to delete from when the application is shutting down (the driver frees everything anyway)
+  QOpenGLContext* context = QOpenGLContext::currentContext();
+  if (context) {
+    MaterialBuffer::texture_released(id);
+    context->functions()->glDeleteTextures(1, &id);
+  }
+}
+
+unsigned int TextureRegistry::size() {
+  return entries().size();
+}
+
+size_t TextureRegistry::resident_cpu_bytes() {
+  size_t bytes = 0;
+  for (auto& it : entries()) {
+    bytes += it.second.image.sizeInBytes();
+  }
+  return bytes;
+}
+
+size_t TextureRegistry::resident_gpu_bytes() {
+  size_t bytes = 0;
+  for (auto& it : entries()) {
+    bytes += it.second.gpu_bytes;
+  }
+  return bytes;
+}
@@ -0,0 +1,48 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <QImage>
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+#include "../entities/meshes/Material.h"
+
+// Every copy of a Texture shares one handle; the registry entry (and the GL texture) is released when the last copy is destroyed
+struct TextureHandle {
+  std::string key;
+  unsigned int id;
+
+  ~TextureHandle();
+};
+
+class TextureRegistry {
+public:
+  // The key is built from the normalized path and everything that changes what is uploaded (color space, transparency, flipping, wrapping)
+  static std::string make_key(const std::string& path, Image_Type type, ImageLoading::Options options);
+
+  // Returns the texture if the key is already loaded. Returns an empty texture (id of 0) otherwise
+  static Texture find(const std::string& key);
+  // Registers a freshly uploaded texture and returns it with its handle set
+  static Texture add(const std::string& key, Texture texture, size_t gpu_bytes);
+  // Keeps a CPU copy of the image for a texture that was loaded without one
+  static void set_image(const std::string& key, const QImage& image);
+
+  static unsigned int size();
+  static size_t resident_cpu_bytes(); // Only textures loaded with ImageLoading::Options::KEEP_IMAGE count towards this
+  static size_t resident_gpu_bytes();
+
+protected:
+  friend struct TextureHandle;
+  static void release(const std::string& key, unsigned int id);
+
+  struct Entry {
+    std::weak_ptr<TextureHandle> handle;
+    QImage image;
+    size_t gpu_bytes;
+  };
+  static std::unordered_map<std::string, Entry>& entries();
+};
+
+#endif
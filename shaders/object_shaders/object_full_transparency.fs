@@ -18,8 +18,6 @@ in VS_OUT {
 uniform samplerCube skybox;
 uniform float skybox_multiplier;
 
-uniform Material material;
-
 uniform int nr_dirlights;
 uniform DirLight dirlights[MAX_NR_DIRLIGHTS];
 
@@ -37,14 +35,16 @@ uniform vec3 camera_position;
 #mypreprocessor include "../shader_components/misc_functions.glsl"
 
 void main() {
-	if (material.simple) {
-		frag_color = vec4(material.color, linear_depth(gl_FragCoord.z));
+	if (simple) {
+		frag_color = vec4(simple_color, linear_depth(gl_FragCoord.z));
 		return;
 	}
 
+	Material material = materials[material_index];
+
 	float opacity = material.opacity;
-	if (material.use_opacity_map) {
-		opacity *= texture(material.opacity_map, fs_in.texture_coordinate).a;
+	if ((material.used_maps & USE_OPACITY_MAP) != 0u) {
+		opacity *= sample_material_texture(material.opacity_map, fs_in.texture_coordinate).a;
 	}
 	if (opacity <= 0.05f) {
 		discard;
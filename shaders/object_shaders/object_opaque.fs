@@ -18,8 +18,6 @@ in VS_OUT {
 uniform samplerCube skybox;
 uniform float skybox_multiplier;
 
-uniform Material material;
-
 uniform int nr_dirlights;
 uniform DirLight dirlights[MAX_NR_DIRLIGHTS];
 
@@ -37,11 +35,13 @@ uniform vec3 camera_position;
 #mypreprocessor include "../shader_components/misc_functions.glsl"
 
 void main() {
-	if (material.simple) {
-		frag_color = vec4(material.color, linear_depth(gl_FragCoord.z));
+	if (simple) {
+		frag_color = vec4(simple_color, linear_depth(gl_FragCoord.z));
 		return;
 	}
 
+	Material material = materials[material_index];
+
 	vec3 fragment_normal = normalize(fs_in.normal);
 	vec3 camera_direction = normalize(camera_position - fs_in.fragment_position);
 
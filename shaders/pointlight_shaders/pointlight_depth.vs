@@ -2,32 +2,18 @@
 
 layout(location=0) in vec3 vertex_position;
 layout(location=2) in vec2 vertex_texture_coordinate;
-layout(location=3) in ivec4 vertex_ids;
+layout(location=3) in uvec4 vertex_ids; // Only enabled for skinned meshes
 layout(location=4) in vec4 vertex_weights;
 
-#define MAX_BONES 10
-
-// The size of armature is 64 * MAX_BONES
-layout (std140, binding=0) uniform Armature {
-	mat4 armature[MAX_BONES];
-};
+#mypreprocessor include "../shader_components/crowd.glsl"
 
 uniform mat4 model;
 
 out vec2 vert_texture_coordinate;
 
 void main() {
-	mat4 bone_transform;
-	float vertex_weight_total = vertex_weights[0]+vertex_weights[1]+vertex_weights[2]+vertex_weights[3];
-	if (vertex_weight_total <= 0.001) {
-		bone_transform = mat4(1.0f);
-	} else {
-		bone_transform = armature[vertex_ids[0]] * vertex_weights[0]/vertex_weight_total;
-		bone_transform += armature[vertex_ids[1]] * vertex_weights[1]/vertex_weight_total;
-		bone_transform += armature[vertex_ids[2]] * vertex_weights[2]/vertex_weight_total;
-		bone_transform += armature[vertex_ids[3]] * vertex_weights[3]/vertex_weight_total;
-	}
+	mat4 transform = crowd ? crowd_transform(vertex_ids, vertex_weights) : skinning_transform(vertex_ids, vertex_weights) * model;
 
 	vert_texture_coordinate = vertex_texture_coordinate;
-	gl_Position = bone_transform * model * vec4(vertex_position, 1.0f);
+	gl_Position = transform * vec4(vertex_position, 1.0f);
 }
@@ -6,20 +6,17 @@
 in vec4 fragment_position;
 in vec2 texture_coordinate;
 
-struct Material {
-  sampler2D opacity_map; // Only exists in the full transparency & partial transparency shaders
-  bool use_opacity_map;
-  float opacity;
-};
+#mypreprocessor include "../shader_components/material_buffer.glsl"
 
-uniform Material material;
 uniform vec3 pointlight_position;
 uniform float far_plane;
 
 void main() {
+  Material material = materials[material_index];
+
   float opacity = material.opacity;
-	if (material.use_opacity_map) {
-		opacity *= texture(material.opacity_map, texture_coordinate).a;
+	if ((material.used_maps & USE_OPACITY_MAP) != 0u) {
+		opacity *= sample_material_texture(material.opacity_map, texture_coordinate).a;
 	}
 	if (opacity <= 0.05f) {
 		discard;
@@ -0,0 +1,26 @@
+#ifndef BONE_PALETTE_GLSL
+#define BONE_PALETTE_GLSL
+
+// Every skinned model's bone matrices for this frame (see BonePalette); a model's bones start at bone_offset
+layout (std430, binding=2) readonly buffer BonePalette {
+	mat4 bone_palette[];
+};
+
+uniform bool skinned;
+uniform int bone_offset;
+
+// Weighted bone matrix for a vertex (identity for static meshes and unweighted vertices)
+mat4 skinning_transform(uvec4 bone_ids, vec4 bone_weights) {
+	float weight_total = skinned ? bone_weights[0]+bone_weights[1]+bone_weights[2]+bone_weights[3] : 0.0f;
+	if (weight_total <= 0.001) {
+		return mat4(1.0f);
+	}
+	uvec4 ids = bone_ids + uint(bone_offset);
+	mat4 bone_transform = bone_palette[ids[0]] * bone_weights[0]/weight_total;
+	bone_transform += bone_palette[ids[1]] * bone_weights[1]/weight_total;
+	bone_transform += bone_palette[ids[2]] * bone_weights[2]/weight_total;
+	bone_transform += bone_palette[ids[3]] * bone_weights[3]/weight_total;
+	return bone_transform;
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef CROWD_GLSL
+#define CROWD_GLSL
+
+#mypreprocessor include "bone_palette.glsl"
+
+// Instanced crowds (see Crowd): each instance has its own model matrix and animation state, and bone matrices come from
+// the animations baked into crowd_bones instead of the bone palette
+
+// Must match Crowd::Instance (std430)
+struct CrowdInstance {
+	mat4 model;
+	uint animation;
+	float time_offset; // Seconds
+	float speed;
+	float padding;
+};
+
+// Must match Crowd::Clip (std430)
+struct CrowdClip {
+	uint first_row; // Row of crowd_bones holding the clip's first frame
+	uint frame_count;
+	float frames_per_second;
+	float padding;
+};
+
+layout (std430, binding=5) readonly buffer CrowdInstances {
+	CrowdInstance crowd_instances[];
+};
+layout (std430, binding=6) readonly buffer CrowdClips {
+	CrowdClip crowd_clips[];
+};
+
+uniform bool crowd;
+uniform sampler2D crowd_bones; // RGBA32F; each row is one baked frame with 4 texels (columns) per bone
+uniform float crowd_time; // Seconds
+uniform mat4 crowd_mesh_transform; // The mesh's node relative to the model's root
+
+mat4 crowd_bone(uint bone, int row) {
+	int x = int(bone) * 4;
+	return mat4(
+		texelFetch(crowd_bones, ivec2(x, row), 0),
+		texelFetch(crowd_bones, ivec2(x+1, row), 0),
+		texelFetch(crowd_bones, ivec2(x+2, row), 0),
+		texelFetch(crowd_bones, ivec2(x+3, row), 0)
+	);
+}
+
+// Object to world transform of a vertex of the current instance
+mat4 crowd_transform(uvec4 bone_ids, vec4 bone_weights) {
+	CrowdInstance instance = crowd_instances[gl_InstanceID];
+	float weight_total = skinned ? bone_weights[0]+bone_weights[1]+bone_weights[2]+bone_weights[3] : 0.0f;
+	if (weight_total <= 0.001) {
+		return instance.model * crowd_mesh_transform;
+	}
+
+	CrowdClip clip = crowd_clips[instance.animation];
+	float frame = mod((crowd_time*instance.speed + instance.time_offset) * clip.frames_per_second, float(clip.frame_count));
+	int row = int(clip.first_row) + int(frame);
+	int next_row = int(clip.first_row) + (int(frame)+1) % int(clip.frame_count); // Clips loop
+	float factor = fract(frame);
+
+	mat4 bone_transform = mat4(0.0f);
+	for (int i=0; i<4; i++) {
+		if (bone_weights[i] > 0.0f) {
+			mat4 bone = mix(crowd_bone(bone_ids[i], row), crowd_bone(bone_ids[i], next_row), factor);
+			bone_transform += bone * (bone_weights[i]/weight_total);
+		}
+	}
+	return instance.model * bone_transform * crowd_mesh_transform;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef MATERIAL_BUFFER_GLSL
+#define MATERIAL_BUFFER_GLSL
+
+// Must match MaterialBuffer::GpuMaterial (std430)
+// Each map is a bindless texture handle (BINDLESS_TEXTURES) or an (array, layer) pair into material_texture_arrays
+struct Material {
+	vec3 color;
+	float opacity; // Only used by the full transparency & partial transparency shaders
+	float ambient;
+  float diffuse;
+	float specular;
+  float roughness; // Should be in range 0.1 - 1.0 (shininess is calculated as 2^(roughness*10))
+  float metalness;
+
+  uint used_maps; // USE_*_MAP flags
+  uvec2 albedo_map;
+  uvec2 ambient_occlusion_map;
+  uvec2 roughness_map; // Inverted (white is smooth and black is rough)
+  uvec2 metalness_map;
+  uvec2 opacity_map; // Only the alpha value is used
+};
+
+#define USE_ALBEDO_MAP            1u
+#define USE_AMBIENT_OCCLUSION_MAP 2u
+#define USE_ROUGHNESS_MAP         4u
+#define USE_METALNESS_MAP         8u
+#define USE_OPACITY_MAP           16u
+
+layout (std430, binding=1) readonly buffer MaterialBuffer {
+  Material materials[];
+};
+
+// Index of the material being drawn in materials
+uniform int material_index;
+
+#ifdef BINDLESS_TEXTURES
+  vec4 sample_material_texture(uvec2 texture_reference, vec2 texture_coordinate) {
+    return texture(sampler2D(texture_reference), texture_coordinate);
+  }
+#else
+  #define MAX_MATERIAL_TEXTURE_ARRAYS 8
+
+  uniform sampler2DArray material_texture_arrays[MAX_MATERIAL_TEXTURE_ARRAYS];
+
+  // material_index is the same for the whole draw so the array index is dynamically uniform
+  vec4 sample_material_texture(uvec2 texture_reference, vec2 texture_coordinate) {
+    return texture(material_texture_arrays[texture_reference.x], vec3(texture_coordinate, float(texture_reference.y)));
+  }
+#endif
+
+#endif
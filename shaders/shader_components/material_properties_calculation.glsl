@@ -1,19 +1,19 @@
 {
   roughness = material.roughness;
-  if (material.use_roughness_map) {
-    roughness *= length(texture(material.roughness_map, fs_in.texture_coordinate).rgb)/1.73f;
+  if ((material.used_maps & USE_ROUGHNESS_MAP) != 0u) {
+    roughness *= length(sample_material_texture(material.roughness_map, fs_in.texture_coordinate).rgb)/1.73f;
   }
 
   shininess = pow(2,(roughness)*10);
 
   metalness = material.metalness;
-  if (material.use_metalness_map) {
-    metalness *= length(texture(material.metalness_map, fs_in.texture_coordinate).rgb)/1.73f;
+  if ((material.used_maps & USE_METALNESS_MAP) != 0u) {
+    metalness *= length(sample_material_texture(material.metalness_map, fs_in.texture_coordinate).rgb)/1.73f;
   }
 
   color = material.color;
-  if (material.use_albedo_map) {
-    color *= texture(material.albedo_map, fs_in.texture_coordinate).rgb;
+  if ((material.used_maps & USE_ALBEDO_MAP) != 0u) {
+    color *= sample_material_texture(material.albedo_map, fs_in.texture_coordinate).rgb;
   }
   diffuse = material.diffuse * color;
 
@@ -27,7 +27,7 @@
   }
 
   ambient = color * material.ambient;
-  if (material.use_ambient_occlusion_map) {
-    ambient *= texture(material.ambient_occlusion_map, fs_in.texture_coordinate).rgb;
+  if ((material.used_maps & USE_AMBIENT_OCCLUSION_MAP) != 0u) {
+    ambient *= sample_material_texture(material.ambient_occlusion_map, fs_in.texture_coordinate).rgb;
   }
 }
@@ -0,0 +1,128 @@
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+#include "AnimationBenchmark.h"
+#include "../rendering/Scene.h"
+
+namespace {
+  // Every model plays the animation with its own phase so no two poses are the same
+  void set_frame(std::vector<std::shared_ptr<RootNode>>& models, unsigned int frame) {
+    for (unsigned int i=0; i<models.size(); i++) {
+      models[i]->set_animation_time((frame*7 + i*13) * 0.1f);
+    }
+  }
+
+  double time_updates(std::vector<std::shared_ptr<RootNode>>& models, unsigned int frames, bool parallel) {
+    QElapsedTimer timer;
+    qint64 total = 0;
+    for (unsigned int frame=0; frame<frames; frame++) {
+      set_frame(models, frame);
+      timer.start();
+      Scene::update_poses(models, parallel, 0.0);
+      total += timer.nsecsElapsed();
+    }
+    return total / 1e6 / frames;
+  }
+
+  std::vector<glm::mat4> all_bones(std::vector<std::shared_ptr<RootNode>>& models) {
+    std::vector<glm::mat4> bones;
+    for (auto& model : models) {
+      const std::vector<glm::mat4>& transforms = model->get_armature_final_transforms();
+      bones.insert(bones.end(), transforms.begin(), transforms.end());
+    }
+    return bones;
+  }
+}
+
+void AnimationBenchmark::run(QFuture<ModelImport> import, const std::string& animation_name, const std::vector<unsigned int>& model_counts, unsigned int frames) {
+  qDebug() << "Animation benchmark:" << frames << "frames per run," << QThreadPool::globalInstance()->maxThreadCount() << "threads";
+  qDebug() << "models | serial ms/frame | parallel ms/frame | speedup | identical";
+
+  std::vector<std::shared_ptr<RootNode>> models;
+  for (unsigned int count : model_counts) {
+    while (models.size() < count) {
+      Model* model = new Model(import, ("benchmark #" + std::to_string(models.size())).c_str());
+      model->set_current_animation(animation_name);
+      model->start_animation();
+      model->stop_animation(); // Paused so set_animation_time fully decides the pose
+      models.push_back(std::shared_ptr<RootNode>(model));
+    }
+
+    // Warm up the key lookup cursors and the thread pool
+    time_updates(models, 10, true);
+    double serial = time_updates(models, frames, false);
+    double parallel = time_updates(models, frames, true);
+
+    bool identical = true;
+    for (unsigned int frame=0; frame<frames && identical; frame++) {
+      set_frame(models, frame);
+      Scene::update_poses(models, false, 0.0);
+      std::vector<glm::mat4> serial_bones = all_bones(models);
+      Scene::update_poses(models, true, 0.0);
+      std::vector<glm::mat4> parallel_bones = all_bones(models);
+      identical = std::memcmp(serial_bones.data(), parallel_bones.data(), serial_bones.size()*sizeof(glm::mat4)) == 0;
+    }
+
+    qDebug().noquote() << QString("%1 | %2 | %3 | %4x | %5").arg(count, 6).arg(serial, 15, 'f', 3).arg(parallel, 17, 'f', 3)
+                                                            .arg(serial/parallel, 6, 'f', 2).arg(identical ? "yes" : "NO");
+  }
+
+  // The scene's own nodes rebuild the palette on their next update
+  BonePalette::clear();
+}
+
+void AnimationBenchmark::run_blend(QFuture<ModelImport> import, const std::string& from_name, const std::string& to_name, unsigned int frames) {
+  std::unique_ptr<Model> model(new Model(import, "blend benchmark"));
+  NodeAnimation* from = model->get_animation().at(from_name);
+  NodeAnimation* to = model->get_animation().at(to_name);
+  model->update_pose(0.0); // Binds the skeleton and sets the root's inverse model matrix
+  const unsigned int bones = model->get_armature_offsets().size();
+  if (bones == 0) return;
+
+  auto from_time = [from](unsigned int frame) {return std::fmod(frame*0.37f, float(from->duration));};
+  auto to_time = [to](unsigned int frame) {return std::fmod(frame*0.53f + 3.0f, float(to->duration));};
+
+  // Warm up the key lookup cursors
+  for (unsigned int frame=0; frame<10; frame++) {
+    model->evaluate_blend(from, from_time(frame), to, to_time(frame), 0.5f);
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  for (unsigned int frame=0; frame<frames; frame++) {
+    model->update_armature(glm::mat4(1.0f), model.get(), from, from_time(frame));
+    model->update_armature(glm::mat4(1.0f), model.get(), to, to_time(frame));
+  }
+  double per_node = timer.nsecsElapsed() / double(frames) / bones;
+
+  timer.start();
+  for (unsigned int frame=0; frame<frames; frame++) {
+    model->evaluate_blend(from, from_time(frame), to, to_time(frame), frame / float(frames));
+  }
+  double blended = timer.nsecsElapsed() / double(frames) / bones;
+
+  // Blending rebuilds the local transforms from decomposed rest poses, so it is close to the per-node path but not bit-identical
+  float max_error = 0.0f;
+  for (unsigned int frame=0; frame<frames; frame+=frames/20+1) {
+    model->update_armature(glm::mat4(1.0f), model.get(), from, from_time(frame));
+    std::vector<glm::mat4> expected = model->get_armature_final_transforms();
+    model->evaluate_blend(from, from_time(frame), to, to_time(frame), 0.0f);
+    const std::vector<glm::mat4>& blended_bones = model->get_armature_final_transforms();
+    for (unsigned int i=0; i<bones; i++) {
+      for (int c=0; c<4; c++) {
+        glm::vec4 difference = glm::abs(expected[i][c] - blended_bones[i][c]);
+        max_error = std::max({max_error, difference.x, difference.y, difference.z, difference.w});
+      }
+    }
+  }
+
+  qDebug() << "Blend benchmark:" << bones << "bones," << frames << "frames";
+  qDebug().noquote() << QString("two clips per node: %1 ns/bone | crossfade: %2 ns/bone | %3x | max error at weight 0: %4")
+                          .arg(per_node, 0, 'f', 1).arg(blended, 0, 'f', 1).arg(per_node/blended, 0, 'f', 2).arg(max_error, 0, 'g', 3);
+}
@@ -0,0 +1,23 @@
+#ifndef ANIMATION_BENCHMARK_H
+#define ANIMATION_BENCHMARK_H
+
+#include <QFuture>
+
+#include <vector>
+#include <string>
+
+#include "../entities/nodes/Model.h"
+
+// Animation timings, run with --animation-benchmark; both need a current context
+class AnimationBenchmark {
+public:
+  // Times Scene::update_poses serially and on the global thread pool for growing numbers of copies of an animated model
+  // and checks that both produce bit-identical bone matrices
+  static void run(QFuture<ModelImport> import, const std::string& animation_name,
+                  const std::vector<unsigned int>& model_counts={1, 2, 4, 8, 16, 32, 64, 128}, unsigned int frames=200);
+  // Times a crossfade between two clips (RootNode::evaluate_blend on LocalPoses) against evaluating both clips through
+  // the per-node update_armature path, and checks that a blend weight of 0 matches the from clip
+  static void run_blend(QFuture<ModelImport> import, const std::string& from_name, const std::string& to_name, unsigned int frames=2000);
+};
+
+#endif
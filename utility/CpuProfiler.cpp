@@ -0,0 +1,88 @@
+#include <QCoreApplication>
+#include <QThread>
+#include <QSaveFile>
+#include <QTextStream>
+
+#include <algorithm>
+#include <chrono>
+
+#include "CpuProfiler.h"
+
+QMutex CpuProfiler::registry_mutex;
+std::vector<std::unique_ptr<CpuProfiler::Thread_Buffer>> CpuProfiler::registry;
+
+static const std::chrono::steady_clock::time_point profiler_epoch = std::chrono::steady_clock::now();
+
+qint64 CpuProfiler::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profiler_epoch).count();
+}
+
+void CpuProfiler::record(const char* name, qint64 start, qint64 end) {
+  Thread_Buffer* buffer = thread_buffer();
+  quint64 head = buffer->head.load(std::memory_order_relaxed);
+  buffer->events[head & (CAPACITY-1)] = Event{name, start, end};
+  buffer->head.store(head+1, std::memory_order_release);
+}
+
+CpuProfiler::Thread_Buffer* CpuProfiler::thread_buffer() {
+  thread_local Thread_Buffer* buffer = nullptr;
+  if (buffer != nullptr) return buffer;
+
+  std::unique_ptr<Thread_Buffer> new_buffer(new Thread_Buffer);
+  QThread* thread = QThread::currentThread();
+  QMutexLocker lock(&registry_mutex);
+  new_buffer->thread_id = registry.size();
+  if (QCoreApplication::instance() != nullptr && thread == QCoreApplication::instance()->thread()) {
+    new_buffer->thread_name = "Main";
+  } else if (!thread->objectName().isEmpty()) {
+    new_buffer->thread_name = thread->objectName();
+  } else {
+    new_buffer->thread_name = QString("Thread ") + QString::number(new_buffer->thread_id);
+  }
+  buffer = new_buffer.get();
+  registry.push_back(std::move(new_buffer));
+  return buffer;
+}
+
+bool CpuProfiler::export_chrome_trace(const QString& path, double seconds) {
+  qint64 cutoff = now() - qint64(seconds*1e9);
+
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+
+  QTextStream out(&file);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first_event = true;
+
+  QMutexLocker lock(&registry_mutex);
+  std::vector<Event> events;
+  for (auto& buffer : registry) {
+    quint64 head = buffer->head.load(std::memory_order_acquire);
+    quint64 first = head > CAPACITY ? head-CAPACITY : 0;
+    events.clear();
+    for (quint64 i=first; i<head; i++) events.push_back(buffer->events[i & (CAPACITY-1)]);
+
+    // The owning thread keeps recording while we copy; drop whatever it may have overwritten in the meantime
+    std::atomic_thread_fence(std::memory_order_acquire);
+    quint64 head_after = buffer->head.load(std::memory_order_relaxed);
+    if (head_after >= CAPACITY && head_after-CAPACITY+1 > first) {
+      events.erase(events.begin(), events.begin() + std::min<quint64>(head_after-CAPACITY+1-first, events.size()));
+    }
+
+    events.erase(std::remove_if(events.begin(), events.end(), [cutoff](const Event& event) {return event.end < cutoff;}), events.end());
+    if (events.empty()) continue;
+    std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) {return a.start < b.start;});
+
+    if (!first_event) out << ',';
+    first_event = false;
+    out << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer->thread_id
+        << ",\"args\":{\"name\":\"" << buffer->thread_name << "\"}}";
+    for (auto& event : events) {
+      out << ",\n{\"ph\":\"X\",\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << buffer->thread_id
+          << ",\"ts\":" << QString::number(event.start/1000.0, 'f', 3) << ",\"dur\":" << QString::number((event.end-event.start)/1000.0, 'f', 3) << '}';
+    }
+  }
+  out << "\n]}\n";
+  out.flush();
+  return file.commit();
+}
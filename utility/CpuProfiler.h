@@ -0,0 +1,78 @@
+#ifndef CPU_PROFILER_H
+#define CPU_PROFILER_H
+
+#include <QtGlobal>
+#include <QMutex>
+#include <QString>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Scoped CPU zones, e.g. PROFILE_ZONE("Scene::update_scene"); at the top of a block times the rest of the block
+// Every thread records into its own ring buffer that only it writes to, so recording takes no locks; the newest CAPACITY zones
+// per thread are kept. export_chrome_trace writes the zones that ended in the last few seconds as Chrome trace-event JSON
+// (chrome://tracing or ui.perfetto.dev). The macros compile to nothing in release builds (or with NO_CPU_PROFILER defined)
+#if defined(QT_DEBUG) && !defined(NO_CPU_PROFILER)
+  #define CPU_PROFILER_ENABLED
+#endif
+
+#define PROFILE_CONCATENATE_(a, b) a##b
+#define PROFILE_CONCATENATE(a, b) PROFILE_CONCATENATE_(a, b)
+#ifdef CPU_PROFILER_ENABLED
+  // name must be a string literal (only the pointer is stored)
+  #define PROFILE_ZONE(name) CpuProfiler::Zone PROFILE_CONCATENATE(profile_zone_, __LINE__)(name)
+#else
+  #define PROFILE_ZONE(name) do {} while (false)
+#endif
+
+class CpuProfiler {
+public:
+  static constexpr unsigned int CAPACITY = 1 << 16; // Zones kept per thread; must be a power of two
+  static constexpr double DUMP_SECONDS = 5.0;
+
+  struct Zone {
+    explicit Zone(const char* name) : name(name), start(now()) {}
+    ~Zone() {record(name, start, now());}
+
+    const char* name;
+    qint64 start;
+  };
+
+  static constexpr bool enabled() {
+#ifdef CPU_PROFILER_ENABLED
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // ns since the program started
+  static qint64 now();
+  static void record(const char* name, qint64 start, qint64 end);
+
+  // Zones that ended in the last `seconds`, from every thread. Returns false if the file couldn't be written
+  static bool export_chrome_trace(const QString& path, double seconds=DUMP_SECONDS);
+
+protected:
+  struct Event {
+    const char* name;
+    qint64 start;
+    qint64 end;
+  };
+
+  struct Thread_Buffer {
+    std::atomic<quint64> head{0}; // Zones ever recorded; the newest is at (head-1) % CAPACITY
+    Event events[CAPACITY];
+    unsigned int thread_id;
+    QString thread_name;
+  };
+
+  // The calling thread's buffer, created and registered on first use. Buffers outlive their threads so a dump can still read them
+  static Thread_Buffer* thread_buffer();
+
+  static QMutex registry_mutex;
+  static std::vector<std::unique_ptr<Thread_Buffer>> registry;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include <QThread>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+#include "FramePacer.h"
+
+FramePacer::FramePacer(Mode mode, double target_fps) : mode(mode), target_fps(std::max(target_fps, 1.0)) {
+  history.reserve(HISTORY);
+}
+
+FramePacer FramePacer::from_arguments(const QStringList& arguments) {
+  if (arguments.contains("--uncapped")) {
+    return FramePacer(UNCAPPED);
+  }
+  int index = arguments.indexOf("--target-fps");
+  if (index >= 0 && index+1 < arguments.size()) {
+    bool ok = false;
+    double fps = arguments[index+1].toDouble(&ok);
+    if (ok && fps > 0.0) return FramePacer(TARGET_FPS, fps);
+    qWarning() << "Ignoring invalid --target-fps" << arguments[index+1];
+  }
+  return FramePacer(VSYNC);
+}
+
+QString FramePacer::mode_name() const {
+  switch (mode) {
+    case VSYNC: return "vsync";
+    case UNCAPPED: return "uncapped";
+    case TARGET_FPS: return QString("%1 fps cap").arg(target_fps);
+  }
+  return QString();
+}
+
+qint64 FramePacer::begin_frame() {
+  if (!clock.isValid()) clock.start();
+
+  if (mode == TARGET_FPS) {
+    const qint64 period = qint64(1e9 / target_fps);
+    qint64 now = clock.nsecsElapsed();
+    if (next_deadline == 0 || now - next_deadline > period) {
+      // First frame, or too far behind to catch up
+      next_deadline = now;
+    }
+    qint64 remaining = next_deadline - now;
+    if (remaining > SPIN_NS) {
+      QThread::usleep((remaining - SPIN_NS) / 1000);
+    }
+    while (clock.nsecsElapsed() < next_deadline) {}
+    next_deadline += period;
+  }
+
+  qint64 now = clock.nsecsElapsed();
+  qint64 frame_time = previous_frame < 0 ? 0 : now - previous_frame;
+  previous_frame = now;
+
+  if (frame_time > 0) {
+    if (history.size() < HISTORY) {
+      history.push_back(frame_time);
+    } else {
+      history[history_index] = frame_time;
+      history_index = (history_index + 1) % HISTORY;
+    }
+  }
+  return frame_time;
+}
+
+FramePacer::Statistics FramePacer::statistics() const {
+  Statistics statistics;
+  statistics.frames = history.size();
+  if (history.empty()) return statistics;
+
+  std::vector<qint64> sorted = history;
+  std::sort(sorted.begin(), sorted.end());
+
+  double sum = 0.0;
+  for (auto frame_time : sorted) sum += frame_time;
+  double mean = sum / sorted.size();
+  double squares = 0.0;
+  for (auto frame_time : sorted) squares += (frame_time - mean) * (frame_time - mean);
+
+  statistics.mean_ms = mean / 1e6;
+  statistics.standard_deviation_ms = std::sqrt(squares / sorted.size()) / 1e6;
+  statistics.min_ms = sorted.front() / 1e6;
+  statistics.max_ms = sorted.back() / 1e6;
+  statistics.p99_ms = sorted[std::min<size_t>(sorted.size()-1, sorted.size()*99/100)] / 1e6;
+  return statistics;
+}
+
+QString FramePacer::report() const {
+  Statistics s = statistics();
+  return QString("%1: %2 frames, mean %3 ms, std dev %4 ms, min %5 ms, max %6 ms, p99 %7 ms")
+    .arg(mode_name()).arg(s.frames).arg(s.mean_ms, 0, 'f', 3).arg(s.standard_deviation_ms, 0, 'f', 3)
+    .arg(s.min_ms, 0, 'f', 3).arg(s.max_ms, 0, 'f', 3).arg(s.p99_ms, 0, 'f', 3);
+}
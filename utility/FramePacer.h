@@ -0,0 +1,59 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QString>
+
+#include <vector>
+
+// Decides when MainWindow starts the next frame. Frames are started from QOpenGLWidget::frameSwapped, so the display's swap
+// paces VSYNC; UNCAPPED starts the next frame right away and TARGET_FPS sleeps and then spins until the next frame is due
+// Also keeps the last frame times (in ns) for the variance report
+class FramePacer {
+public:
+  enum Mode {
+    VSYNC,
+    UNCAPPED,
+    TARGET_FPS
+  };
+
+  static constexpr unsigned int HISTORY = 600; // Frames the statistics cover
+  static constexpr qint64 SPIN_NS = 2000000; // How long before the deadline TARGET_FPS stops sleeping (sleep overshoots by ~1ms)
+
+  FramePacer(Mode mode=VSYNC, double target_fps=60.0);
+  // --uncapped or --target-fps <fps>; VSYNC otherwise
+  static FramePacer from_arguments(const QStringList& arguments);
+
+  Mode get_mode() const {return mode;}
+  double get_target_fps() const {return target_fps;}
+  QString mode_name() const;
+  int swap_interval() const {return mode == VSYNC ? 1 : 0;} // For the QSurfaceFormat; must be set before the context exists
+
+  // Waits if the frame is early (TARGET_FPS) and returns the time since the previous frame started in ns
+  qint64 begin_frame();
+
+  struct Statistics {
+    unsigned int frames = 0;
+    double mean_ms = 0.0;
+    double standard_deviation_ms = 0.0;
+    double min_ms = 0.0;
+    double max_ms = 0.0;
+    double p99_ms = 0.0;
+  };
+  Statistics statistics() const; // Over the last HISTORY frames
+  QString report() const;
+
+protected:
+  Mode mode;
+  double target_fps;
+
+  QElapsedTimer clock;
+  qint64 previous_frame = -1;
+  qint64 next_deadline = 0;
+
+  std::vector<qint64> history;
+  unsigned int history_index = 0;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include <QDebug>
+
+#include <algorithm>
+
+#include "InputCapture.h"
+
+static const char input_magic[8] = {'Q', 'T', 'I', 'N', 'P', 'U', 'T', '\n'};
+
+bool InputCapture::start(const QStringList& arguments) {
+  int record_index = arguments.indexOf("--record-input");
+  int replay_index = arguments.indexOf("--replay-input");
+  int timestep_index = arguments.indexOf("--fixed-timestep");
+
+  if (timestep_index >= 0 && timestep_index+1 < arguments.size()) {
+    bool ok = false;
+    fixed_timestep = arguments[timestep_index+1].toFloat(&ok);
+    if (!ok || fixed_timestep <= 0.0f) {
+      qWarning() << "Ignoring invalid --fixed-timestep" << arguments[timestep_index+1];
+      fixed_timestep = 0.0f;
+    }
+  }
+
+  if (replay_index >= 0 && replay_index+1 < arguments.size()) {
+    file.setFileName(arguments[replay_index+1]);
+    if (!file.open(QIODevice::ReadOnly)) {
+      qWarning() << "Could not open the input recording" << file.fileName();
+      return false;
+    }
+    stream.setDevice(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    char magic[8];
+    quint32 version = 0;
+    if (stream.readRawData(magic, 8) == 8) stream >> version;
+    if (!std::equal(magic, magic+8, input_magic) || version != FORMAT_VERSION || stream.status() != QDataStream::Ok) {
+      qWarning() << "Not an input recording (or an old one):" << file.fileName();
+      stream.setDevice(nullptr);
+      file.close();
+      return false;
+    }
+    mode = REPLAY;
+    qDebug() << "Replaying input from" << file.fileName() << (fixed_timestep > 0.0f ? "with a fixed timestep" : "");
+    return true;
+  }
+
+  if (record_index >= 0 && record_index+1 < arguments.size()) {
+    file.setFileName(arguments[record_index+1]);
+    if (!file.open(QIODevice::WriteOnly)) {
+      qWarning() << "Could not create the input recording" << file.fileName();
+      return false;
+    }
+    stream.setDevice(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    stream.writeRawData(input_magic, 8);
+    stream << FORMAT_VERSION;
+    mode = RECORD;
+    qDebug() << "Recording input to" << file.fileName();
+    return true;
+  }
+  return false;
+}
+
+bool InputCapture::frame(float& delta_time, QPoint& mouse_movement, std::unordered_set<int>& keys_pressed) {
+  switch (mode) {
+    case RECORD:
+      record(delta_time, mouse_movement, keys_pressed);
+      return true;
+    case REPLAY:
+      return replay(delta_time, mouse_movement, keys_pressed);
+    default:
+      return true;
+  }
+}
+
+void InputCapture::record(float delta_time, const QPoint& mouse_movement, const std::unordered_set<int>& keys_pressed) {
+  std::vector<int> current_keys(keys_pressed.begin(), keys_pressed.end());
+  std::sort(current_keys.begin(), current_keys.end());
+  if (current_keys.size() > 255) current_keys.resize(255);
+
+  quint8 flags = 0;
+  if (!mouse_movement.isNull()) flags |= MOUSE_MOVED;
+  if (current_keys != keys) flags |= KEYS_CHANGED;
+
+  stream << flags << delta_time;
+  if (flags & MOUSE_MOVED) {
+    stream << qint16(qBound(-32768, mouse_movement.x(), 32767)) << qint16(qBound(-32768, mouse_movement.y(), 32767));
+  }
+  if (flags & KEYS_CHANGED) {
+    stream << quint8(current_keys.size());
+    for (int key : current_keys) stream << quint32(key);
+    keys = std::move(current_keys);
+  }
+  frame_count++;
+}
+
+bool InputCapture::replay(float& delta_time, QPoint& mouse_movement, std::unordered_set<int>& keys_pressed) {
+  if (stream.atEnd()) return false;
+
+  quint8 flags;
+  float recorded_delta_time;
+  qint16 x = 0, y = 0;
+  std::vector<int> recorded_keys = keys;
+
+  stream >> flags >> recorded_delta_time;
+  if (flags & MOUSE_MOVED) stream >> x >> y;
+  if (flags & KEYS_CHANGED) {
+    quint8 count;
+    stream >> count;
+    recorded_keys.resize(count);
+    for (auto& key : recorded_keys) {
+      quint32 code;
+      stream >> code;
+      key = int(code);
+    }
+  }
+  if (stream.status() != QDataStream::Ok) {
+    qWarning() << "Truncated input recording after" << frame_count << "frames";
+    return false;
+  }
+
+  keys = std::move(recorded_keys);
+  delta_time = fixed_timestep > 0.0f ? fixed_timestep : recorded_delta_time;
+  mouse_movement = QPoint(x, y);
+  keys_pressed = std::unordered_set<int>(keys.begin(), keys.end());
+  frame_count++;
+  return true;
+}
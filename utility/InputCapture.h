@@ -0,0 +1,56 @@
+#ifndef INPUT_CAPTURE_H
+#define INPUT_CAPTURE_H
+
+#include <QDataStream>
+#include <QFile>
+#include <QPoint>
+#include <QStringList>
+
+#include <unordered_set>
+#include <vector>
+
+// Records the input MainWindow feeds OpenGLWindow every frame (delta time, mouse movement and held keys) to a compact binary
+// file and plays it back, so profiling runs before and after a change see the same camera motion
+// --record-input <file> records; --replay-input <file> replays, optionally with --fixed-timestep <ms> replacing the recorded
+// delta times. While replaying, OpenGLWindow poses the scene in lockstep with the frames and times every animation (nodes,
+// crowds and the Tesseract) by the replayed delta times, so each replay of a file renders identical frames
+//
+// Format (little endian): "QTINPUT\n", quint32 FORMAT_VERSION, then per frame a quint8 of Frame_Flags, the float delta time
+// in ms, the mouse movement as two qint16 if MOUSE_MOVED, and the held keys as a quint8 count and quint32 Qt::Keys if KEYS_CHANGED
+class InputCapture {
+public:
+  enum Mode {
+    OFF,
+    RECORD,
+    REPLAY
+  };
+  static constexpr quint32 FORMAT_VERSION = 1;
+
+  // Opens the file named by the arguments, if any. Returns false (and stays OFF) if it can't be opened or isn't a recording
+  bool start(const QStringList& arguments);
+
+  Mode get_mode() const {return mode;}
+  unsigned int get_frame_count() const {return frame_count;}
+
+  // RECORD appends the frame's input. REPLAY overwrites it with the next recorded frame and returns false once the
+  // recording has run out (the input is left untouched then). Does nothing when OFF
+  bool frame(float& delta_time, QPoint& mouse_movement, std::unordered_set<int>& keys_pressed);
+
+protected:
+  enum Frame_Flags : quint8 {
+    MOUSE_MOVED = 0x01,
+    KEYS_CHANGED = 0x02
+  };
+
+  void record(float delta_time, const QPoint& mouse_movement, const std::unordered_set<int>& keys_pressed);
+  bool replay(float& delta_time, QPoint& mouse_movement, std::unordered_set<int>& keys_pressed);
+
+  Mode mode = OFF;
+  QFile file;
+  QDataStream stream;
+  float fixed_timestep = 0.0f; // ms; 0 replays the recorded delta times
+  unsigned int frame_count = 0;
+  std::vector<int> keys; // Sorted; the held keys as of the last frame
+};
+
+#endif
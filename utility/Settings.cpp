@@ -1,6 +1,7 @@
 #include <QApplication>
 #include <QPushButton>
 #include <QPixmap>
+#include <QImageReader>
 #include <QRadioButton>
 #include <QDebug>
 
@@ -84,6 +85,8 @@ void Settings::set_up_nodes_tab() {
 }
 
 void Settings::set_scene(Scene *scene) {
+  simulation_mutex = scene->get_simulation_mutex();
+
   QWidget *Scene_widget = new QWidget(this);
   QGridLayout *Scene_layout = new QGridLayout(Scene_widget);
 
@@ -105,6 +108,8 @@ void Settings::set_scene(Scene *scene) {
   QGroupBox *Misc_box = new QGroupBox(this);
   QGridLayout *Misc_layout = new QGridLayout(Misc_box);
   create_option_group("Display Type:", &scene->display_type, 0.0, 5.0, 1.0, 0, Misc_box, Misc_layout, 0);
+  create_option_group("LOD Pixel Error:", &scene->lod_pixel_error, 0.0, 20.0, 0.25, 2, Misc_box, Misc_layout, 1);
+  create_option_group("Shadow LOD Bias:", &scene->shadow_lod_bias, 0.0, 3.0, 1.0, 0, Misc_box, Misc_layout, 2);
   Scene_layout->addWidget(Misc_box, 1, 1);
 
   QGroupBox *AA_box = new QGroupBox(tr("Anti-Aliasing"), this);
@@ -178,6 +183,30 @@ std::vector<Material*> Settings::get_node_materials(Node *node) {
   return materials;
 }
 
+QPixmap Settings::texture_preview(const Texture& texture) {
+  auto it = texture_previews.find(texture.path);
+  if (it != texture_previews.end()) {
+    return it->second;
+  }
+
+  // Textures don't keep their pixels after upload so previews are decoded (already scaled down) straight from the file
+  QImage preview = texture.image;
+  if (preview.isNull()) {
+    QImageReader reader(QString::fromStdString(texture.path));
+    if (reader.size().isValid()) {
+      reader.setScaledSize(reader.size().scaled(500, 500, Qt::KeepAspectRatio));
+    }
+    preview = reader.read();
+  } else {
+    preview = preview.scaled(500, 500, Qt::KeepAspectRatio);
+  }
+  Q_ASSERT_X(preview.isNull() == false, "texture preview creation", texture.path.c_str());
+
+  QPixmap pixmap = QPixmap::fromImage(preview);
+  texture_previews[texture.path] = pixmap;
+  return pixmap;
+}
+
 QStandardItem* Settings::set_node(Node* node, QStandardItem* parent) {
   QWidget *Node_widget = new QWidget(this);
   QGridLayout *Node_layout = new QGridLayout(Node_widget);
@@ -188,6 +217,7 @@ QStandardItem* Settings::set_node(Node* node, QStandardItem* parent) {
   node_transformation->set_matrix(node->transformation);
   connect(node_transformation, &Matrix_4x4_View::value_changed, this,
     [=](const glm::mat4& new_value) {
+      QMutexLocker lock(simulation_mutex);
       node->transformation = new_value;
     }
   );
@@ -220,8 +250,7 @@ QStandardItem* Settings::set_node(Node* node, QStandardItem* parent) {
   for (auto material_ptr : get_node_materials(node)) {
     QPushButton *material_jump = new QPushButton(Material_box);
     if (material_ptr->textures.size() >= 1) {
-      Q_ASSERT_X(material_ptr->textures[0].image.isNull() == false, "texture icons creation", "QImage is null");
-      material_jump->setIcon(QIcon(QPixmap::fromImage(material_ptr->textures[0].image)));
+      material_jump->setIcon(QIcon(texture_preview(material_ptr->textures[0])));
     }
     material_jump->setText(tr(material_ptr->name.c_str()));
     connect(material_jump, &QPushButton::clicked, this,
@@ -496,11 +525,12 @@ QGroupBox* Settings::set_tesseract(Tesseract* tesseract, QWidget* parent) {
   std::shared_ptr<QMetaObject::Connection> update_tesseract_connection = std::make_shared<QMetaObject::Connection>();
   connect(animate_button, &QPushButton::clicked, this,
     [this, update_tesseract_connection, rotate_tesseract_based_on_radio_buttons, angle_group, animate_button] (bool checked) {
-      auto animation = [rotate_tesseract_based_on_radio_buttons, angle_group]() {
-        rotate_tesseract_based_on_radio_buttons(angle_group->get_value());
+      // The angle is per second while animating, so the speed doesn't depend on the frame rate
+      auto animation = [rotate_tesseract_based_on_radio_buttons, angle_group](float delta_time) {
+        rotate_tesseract_based_on_radio_buttons(angle_group->get_value() * delta_time/1000.0f);
       };
       if (checked) {
-        *update_tesseract_connection = connect(update_timer, &QTimer::timeout, this, animation);
+        *update_tesseract_connection = connect(this, &Settings::updating, this, animation);
         animate_button->setText("Stop Animation");
       } else {
         disconnect(*update_tesseract_connection);
@@ -575,8 +605,7 @@ QGroupBox* Settings::set_tesseract(Tesseract* tesseract, QWidget* parent) {
 QStandardItem* Settings::set_material(Material* material) {
   QStandardItem* material_item = new QStandardItem(QString(tr(material->name.c_str())));
   if (material->textures.size() >= 1) {
-    Q_ASSERT_X(material->textures[0].image.isNull() == false, "texture icons creation", "QImage is null");
-    material_item->setIcon(QIcon(QPixmap::fromImage(material->textures[0].image)));
+    material_item->setIcon(QIcon(texture_preview(material->textures[0])));
   } else {
     material_item->setIcon(icons.find("material")->second);
   }
@@ -590,27 +619,36 @@ QStandardItem* Settings::set_material(Material* material) {
 
     QGroupBox *Color_Box = new QGroupBox(tr("Color"), this);
     QGridLayout *Color_Layout = new QGridLayout(Color_Box);
-    create_option_group("R:", &material->color.r, 0.0, 1.0, 0.1, 2, Color_Box, Color_Layout, 0);
-    create_option_group("G:", &material->color.g, 0.0, 1.0, 0.1, 2, Color_Box, Color_Layout, 1);
-    create_option_group("B:", &material->color.b, 0.0, 1.0, 0.1, 2, Color_Box, Color_Layout, 2);
+    std::vector<QWidget*> options;
+    options.push_back(create_option_group("R:", &material->color.r, 0.0, 1.0, 0.1, 2, Color_Box, Color_Layout, 0));
+    options.push_back(create_option_group("G:", &material->color.g, 0.0, 1.0, 0.1, 2, Color_Box, Color_Layout, 1));
+    options.push_back(create_option_group("B:", &material->color.b, 0.0, 1.0, 0.1, 2, Color_Box, Color_Layout, 2));
     Material_layout->addWidget(Color_Box, 0, 0);
 
     QGroupBox *Misc_box = new QGroupBox(tr("Material Properties"), this);
     QGridLayout *Misc_layout = new QGridLayout(Misc_box);
-    create_option_group("Ambient:", &material->ambient, 0.0, 5.0, 0.05, 2, Misc_box, Misc_layout, 0);
-    create_option_group("Diffuse:", &material->diffuse, 0.0, 5.0, 0.05, 2, Misc_box, Misc_layout, 1);
-    create_option_group("Specular:", &material->specular, 0.0, 5.0, 0.05, 2, Misc_box, Misc_layout, 2);
-    create_option_group("Roughness:", &material->roughness, 0.0, 1.0, 0.01, 2, Misc_box, Misc_layout, 3);
-    create_option_group("Metalness:", &material->metalness, 0.0, 1.0, 0.01, 2, Misc_box, Misc_layout, 4);
-    create_option_group("Opacity:", &material->opacity, 0.0, 1.0, 0.01, 2, Misc_box, Misc_layout, 5);
+    options.push_back(create_option_group("Ambient:", &material->ambient, 0.0, 5.0, 0.05, 2, Misc_box, Misc_layout, 0));
+    options.push_back(create_option_group("Diffuse:", &material->diffuse, 0.0, 5.0, 0.05, 2, Misc_box, Misc_layout, 1));
+    options.push_back(create_option_group("Specular:", &material->specular, 0.0, 5.0, 0.05, 2, Misc_box, Misc_layout, 2));
+    options.push_back(create_option_group("Roughness:", &material->roughness, 0.0, 1.0, 0.01, 2, Misc_box, Misc_layout, 3));
+    options.push_back(create_option_group("Metalness:", &material->metalness, 0.0, 1.0, 0.01, 2, Misc_box, Misc_layout, 4));
+    options.push_back(create_option_group("Opacity:", &material->opacity, 0.0, 1.0, 0.01, 2, Misc_box, Misc_layout, 5));
     Material_layout->addWidget(Misc_box, 0, 1);
 
+    // The material is only re-uploaded when one of its values is edited
+    for (auto option : options) {
+      connect(static_cast<Slider_Spinbox_Group*>(option), &Slider_Spinbox_Group::valueChanged, this,
+        [material](){
+          MaterialBuffer::set_changed(material);
+        }
+      );
+    }
+
     if (material->textures.size() >= 1) {
       QTabWidget *Image_container = new QTabWidget(this);
       for (auto texture : material->textures) {
         QLabel *texture_label = new QLabel(Image_container);
-        QPixmap texture_image = QPixmap::fromImage(texture.image);
-        texture_label->setPixmap(texture_image.scaled(500, 500, Qt::KeepAspectRatio));
+        texture_label->setPixmap(texture_preview(texture));
         Image_container->addTab(texture_label, tr(Image_Type_String[texture.type]));
       }
       Material_layout->addWidget(Image_container, 1, 0, 1, -1);
@@ -627,7 +665,7 @@ QStandardItem* Settings::set_material(Material* material) {
     // The material hasn't been loaded before so add it to the materials tab
     QPushButton* material_button = new QPushButton(materials_list);
     if (material->textures.size() >= 1)
-    material_button->setIcon(QIcon(QPixmap::fromImage(material->textures[0].image)));
+    material_button->setIcon(QIcon(texture_preview(material->textures[0])));
     material_button->setText(tr(material->name.c_str()));
     connect(material_button, &QPushButton::clicked, this,
       [Scrolling](){
@@ -649,8 +687,15 @@ QScrollArea* Settings::set_animation(NodeAnimation* animation) {
   animation_layout->addWidget(new QLabel(tr("TPS: ")+QString::number(animation->tps)));
   animation_layout->addWidget(new QLabel(tr("Duration: ")+QString::number(animation->duration)));
 
+  const NodeAnimation::Packing_Statistics& packing = animation->get_packing_statistics();
+  animation_layout->addWidget(new QLabel(tr("Keys: %1 KiB").arg(packing.key_bytes/1024.0, 0, 'f', 1)));
+  animation_layout->addWidget(new QLabel(tr("Packed: %1 KiB (%2 KiB uncompressed), %3 of %4 frames")
+    .arg(packing.packed_bytes/1024.0, 0, 'f', 1).arg(packing.uncompressed_bytes/1024.0, 0, 'f', 1).arg(packing.kept_frame_count).arg(packing.frame_count)));
+  animation_layout->addWidget(new QLabel(tr("Max Error: position %1, rotation %2 degrees, scale %3")
+    .arg(packing.error.position, 0, 'g', 3).arg(glm::degrees(packing.error.rotation), 0, 'g', 3).arg(packing.error.scale, 0, 'g', 3)));
+
   for (auto it : animation->animation_channels) {
-    QScrollArea* animation_channel_menu = set_animation_channel(it.second);
+    QScrollArea* animation_channel_menu = set_animation_channel(animation, it.second);
     QPushButton* animation_channel_button = new QPushButton(tr(it.first.c_str()), animation_widget);
     animation_layout->addWidget(animation_channel_button);
     connect(animation_channel_button, &QPushButton::clicked, this,
@@ -670,34 +715,45 @@ QScrollArea* Settings::set_animation(NodeAnimation* animation) {
   return scrolling;
 }
 
-QScrollArea* Settings::set_animation_channel(NodeAnimationChannel* animation_channel) {
+QScrollArea* Settings::set_animation_channel(NodeAnimation* animation, NodeAnimationChannel* animation_channel) {
   QWidget* animation_channel_widget = new QWidget(this);
   QGridLayout* animation_channel_layout = new QGridLayout(animation_channel_widget);
 
   Q_ASSERT_X(animation_channel->position_keys.size() > 0, "Animation settings", "Could not find any keys");
+  std::vector<QWidget*> key_options;
 
   QGroupBox *position_box = new QGroupBox(tr("Position"), animation_channel_widget);
   QGridLayout *position_layout = new QGridLayout(position_box);
-  create_option_group("X:", &animation_channel->position_keys[0].vector.x, -50.0, 50.0, 0.5, 2, position_box, position_layout, 0);
-  create_option_group("Y:", &animation_channel->position_keys[0].vector.y, -50.0, 50.0, 0.5, 2, position_box, position_layout, 1);
-  create_option_group("Z:", &animation_channel->position_keys[0].vector.z, -50.0, 50.0, 0.5, 2, position_box, position_layout, 2);
+  key_options.push_back(create_option_group("X:", &animation_channel->position_keys[0].vector.x, -50.0, 50.0, 0.5, 2, position_box, position_layout, 0));
+  key_options.push_back(create_option_group("Y:", &animation_channel->position_keys[0].vector.y, -50.0, 50.0, 0.5, 2, position_box, position_layout, 1));
+  key_options.push_back(create_option_group("Z:", &animation_channel->position_keys[0].vector.z, -50.0, 50.0, 0.5, 2, position_box, position_layout, 2));
   animation_channel_layout->addWidget(position_box, 0, 0);
 
   QGroupBox *scale_box = new QGroupBox(tr("Scale"), animation_channel_widget);
   QGridLayout *scale_layout = new QGridLayout(scale_box);
-  create_option_group("X:", &animation_channel->scale_keys[0].vector.x, -50.0, 50.0, 0.5, 2, scale_box, scale_layout, 0);
-  create_option_group("Y:", &animation_channel->scale_keys[0].vector.y, -50.0, 50.0, 0.5, 2, scale_box, scale_layout, 1);
-  create_option_group("Z:", &animation_channel->scale_keys[0].vector.z, -50.0, 50.0, 0.5, 2, scale_box, scale_layout, 2);
+  key_options.push_back(create_option_group("X:", &animation_channel->scale_keys[0].vector.x, -50.0, 50.0, 0.5, 2, scale_box, scale_layout, 0));
+  key_options.push_back(create_option_group("Y:", &animation_channel->scale_keys[0].vector.y, -50.0, 50.0, 0.5, 2, scale_box, scale_layout, 1));
+  key_options.push_back(create_option_group("Z:", &animation_channel->scale_keys[0].vector.z, -50.0, 50.0, 0.5, 2, scale_box, scale_layout, 2));
   animation_channel_layout->addWidget(scale_box, 1, 0);
 
   QGroupBox *rotation_box = new QGroupBox(tr("Rotation"), animation_channel_widget);
   QGridLayout *rotation_layout = new QGridLayout(rotation_box);
-  create_option_group("W:", &animation_channel->rotation_keys[0].quaternion.w, -1.0, 1.0, 1, 2, rotation_box, rotation_layout, 0);
-  create_option_group("X:", &animation_channel->rotation_keys[0].quaternion.x, -1.0, 1.0, 1, 2, rotation_box, rotation_layout, 1);
-  create_option_group("Y:", &animation_channel->rotation_keys[0].quaternion.y, -1.0, 1.0, 1, 2, rotation_box, rotation_layout, 2);
-  create_option_group("Z:", &animation_channel->rotation_keys[0].quaternion.z, -1.0, 1.0, 1, 2, rotation_box, rotation_layout, 3);
+  key_options.push_back(create_option_group("W:", &animation_channel->rotation_keys[0].quaternion.w, -1.0, 1.0, 1, 2, rotation_box, rotation_layout, 0));
+  key_options.push_back(create_option_group("X:", &animation_channel->rotation_keys[0].quaternion.x, -1.0, 1.0, 1, 2, rotation_box, rotation_layout, 1));
+  key_options.push_back(create_option_group("Y:", &animation_channel->rotation_keys[0].quaternion.y, -1.0, 1.0, 1, 2, rotation_box, rotation_layout, 2));
+  key_options.push_back(create_option_group("Z:", &animation_channel->rotation_keys[0].quaternion.z, -1.0, 1.0, 1, 2, rotation_box, rotation_layout, 3));
   animation_channel_layout->addWidget(rotation_box, 0, 1, 1, -1);
 
+  // Playback only reads the packed frames, so they are rebuilt from the edited keys
+  for (auto option : key_options) {
+    connect(static_cast<Slider_Spinbox_Group*>(option), &Slider_Spinbox_Group::valueChanged, this,
+      [this, animation]() {
+        QMutexLocker lock(simulation_mutex);
+        animation->pack();
+      }
+    );
+  }
+
   QScrollArea *scrolling = new QScrollArea(this);
   scrolling->setWindowFlags(Qt::Window);
   scrolling->setWindowTitle(tr(animation_channel->name.c_str()));
@@ -804,7 +860,8 @@ QWidget* Settings::create_option_group(
   Slider_Spinbox_Group* group = new Slider_Spinbox_Group(min_val, max_val, step, decimals, name, parent);
   group->setValue(initial_value);
   connect(group, &Slider_Spinbox_Group::valueChanged, this,
-    [option](double value){
+    [this, option](double value){
+      QMutexLocker lock(simulation_mutex);
       (*option) = (T)value;
     }
   );
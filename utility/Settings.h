@@ -11,7 +11,6 @@
 #include <QVBoxLayout>
 #include <QTreeView>
 #include <QStandardItemModel>
-#include <QTimer>
 #include <QDebug>
 
 #include <vector>
@@ -29,6 +28,7 @@
 #include "../entities/meshes/Material.h"
 #include "../entities/meshes/shapes/Tesseract.h"
 #include "Utility.h"
+#include "CpuProfiler.h"
 
 class Settings : public QTabWidget {
   Q_OBJECT
@@ -37,8 +37,7 @@ public:
   Settings(QWidget* parent=nullptr);
   ~Settings();
 
-  void set_update_timer(QTimer* update_timer) {this->update_timer = update_timer;};
-  void update_settings() {emit updating();}
+  void update_settings(float delta_time) {PROFILE_ZONE("Settings::update_settings"); emit updating(delta_time);} // delta_time in ms
 
   void set_scene(Scene *scene);
   void set_camera(Camera *camera);
@@ -46,18 +45,20 @@ public:
   QStandardItem* set_mesh(Mesh* mesh);
   QStandardItem* set_material(Material* material);
   QScrollArea* set_animation(NodeAnimation* animation);
-  QScrollArea* set_animation_channel(NodeAnimationChannel* animation);
+  QScrollArea* set_animation_channel(NodeAnimation* animation, NodeAnimationChannel* animation_channel);
   void set_point_light(PointLight *point_light);
   void set_dirlight(DirectionalLight *sunlight);
 
   // Helper functions
   std::vector<Material*> get_node_materials(Node *node);
+  QPixmap texture_preview(const Texture& texture);
 
 signals:
-  void updating(); // Only for internal use (with lambdas)
+  void updating(float delta_time); // Only for internal use (with lambdas)
 
 private:
-  QTimer* update_timer = nullptr;
+  // The scene's simulation mutex, held while an option is written since the simulation thread reads node transforms
+  QMutex* simulation_mutex = nullptr;
 
   void create_list_tab(QGroupBox*& widget, QVBoxLayout*& layout, const char* name);
   // Node tab
@@ -79,6 +80,7 @@ private:
   // Icons
   void load_icons();
   std::unordered_map<const char*, QIcon> icons;
+  std::unordered_map<std::string, QPixmap> texture_previews;
 
   // Helper function to quickly make the options
   template <typename T>